@@ -0,0 +1,710 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/* not part of the library: benchmarks for the hot paths of layouting and output
+ *
+ * Run it from the base directory of the source tree, so that the fonts and layouts
+ * in tests/ are found. Each result is printed as one JSON object per line, so that
+ * the results of different versions can be compared with simple scripts. When an
+ * argument is given, only the benchmarks whose name contains it are run.
+ */
+
+#define USE_PUGI_XML
+
+#include "layouterXMLSaveLoad.h"
+
+#include <stll/layouter.h>
+#include <stll/layouterFont.h>
+#include <stll/layouterCSS.h>
+#include <stll/layouterXHTML.h>
+
+#include <stll/hyphendictionaries.h>
+#include <stll/hyphenationdictionaries/hyph_en_US.h>
+
+#include <stll/internal/glyphCache.h>
+#include <stll/internal/blurr.h>
+#include <stll/internal/rectanglePacker.h>
+#include <stll/internal/blitter.h>
+#include <stll/internal/gamma.h>
+
+#include <dirent.h>
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace STLL;
+
+// all heap allocations of the program are counted, so that the benchmarks
+// can report how many allocations an operation needs
+static std::atomic<uint64_t> heapAllocations{0};
+
+void * operator new(size_t s)
+{
+  heapAllocations++;
+
+  if (void * p = std::malloc(s ? s : 1))
+    return p;
+
+  throw std::bad_alloc();
+}
+
+void operator delete(void * p) noexcept
+{
+  std::free(p);
+}
+
+// runs the benchmarks and prints the results
+class Benchmark_c
+{
+  public:
+
+    explicit Benchmark_c(const std::string & f) : filter(f) { }
+
+    // call f repeatedly for at least minTime, f returns the number of items it has
+    // handled (characters, glyphs, runs, ...), so that the time per item can be given
+    void run(const std::string & name, const std::function<size_t(void)> & f)
+    {
+      if (!selected(name)) return;
+
+      // the first call fills caches and buffers
+      f();
+
+      uint64_t calls = 0;
+      uint64_t items = 0;
+
+      auto start = std::chrono::steady_clock::now();
+      std::chrono::steady_clock::duration elapsed;
+
+      do
+      {
+        items += f();
+        calls++;
+        elapsed = std::chrono::steady_clock::now() - start;
+      }
+      while (elapsed < minTime);
+
+      double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+
+      std::cout << "{\"name\": \"" << name << "\", \"calls\": " << calls
+                << ", \"ns_per_call\": " << ns/calls
+                << ", \"items_per_call\": " << (double)items/calls
+                << ", \"ns_per_item\": " << (items ? ns/items : 0.0) << "}" << std::endl;
+    }
+
+    // print a value that is not a time, e.g. a counter
+    void value(const std::string & name, double v)
+    {
+      if (!selected(name)) return;
+
+      std::cout << "{\"name\": \"" << name << "\", \"value\": " << v << "}" << std::endl;
+    }
+
+    bool selected(const std::string & name) const
+    {
+      return filter.empty() || name.find(filter) != std::string::npos;
+    }
+
+  private:
+    std::string filter;
+    std::chrono::milliseconds minTime{300};
+};
+
+static const std::u32string loremIpsum =
+  U"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut "
+  U"labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris "
+  U"nisi ut aliquip ex ea commodo consequat. Duis aute irure dolor in reprehenderit in voluptate velit "
+  U"esse cillum dolore eu fugiat nulla pariatur. Excepteur sint occaecat cupidatat non proident, sunt "
+  U"in culpa qui officia deserunt mollit anim id est laborum. ";
+
+// "the cup of nations" in arabic, the same text as in the tests
+static const std::u32string arabicText = U"كأس الأمم ";
+
+static std::u32string repeat(const std::u32string & s, size_t n)
+{
+  std::u32string res;
+  for (size_t i = 0; i < n; i++) res += s;
+  return res;
+}
+
+// documents in the style of those in the tests, that create the layouts in tests/*.lay
+static const std::vector<std::pair<std::string, std::string>> xhtmlDocuments =
+{
+  { "simple", "<html><body><p lang='en'>Test Text</p></body></html>" },
+  { "arabic", "<html><body><p lang='ar-arab'>كأس الأمم "
+              "كأس الأمم</p></body></html>" },
+  { "softhyphen", "<html><body><p lang='en'>Test&#173;Text&#173;Textwithaverylongadditiontomakeitlong</p></body></html>" },
+  { "underline", "<html><body><p lang='en' class='ul'>Test Text with an underline and a "
+                 "<a href='link'>link</a> in the middle</p></body></html>" },
+  { "list", "<html><body><ul><li><p>first item of the list</p></li><li><p>second item with a longer "
+            "text that needs more than one line in the list</p></li></ul></body></html>" },
+  { "table", "<html><body><table><colgroup><col width='100px' /><col width='200px' /></colgroup>"
+             "<tr><td><p>Test1</p></td><td><p>Test2 with more text in the cell</p></td></tr>"
+             "<tr><td><p>Test3</p></td><td><p>Test4</p></td></tr></table></body></html>" },
+  { "long", "<html><body><p lang='en'>Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do "
+            "eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis "
+            "nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat.</p><p lang='en'>Duis "
+            "aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla "
+            "pariatur.</p></body></html>" },
+};
+
+// the layout files of the tests
+static std::vector<std::string> layoutFiles(void)
+{
+  std::vector<std::string> res;
+
+  if (DIR * d = opendir("tests"))
+  {
+    while (dirent * e = readdir(d))
+    {
+      std::string n = e->d_name;
+
+      if (n.size() > 4 && n.compare(n.size()-4, 4, ".lay") == 0)
+        res.push_back("tests/" + n);
+    }
+
+    closedir(d);
+  }
+
+  std::sort(res.begin(), res.end());
+
+  return res;
+}
+
+// an in memory surface with 3 bytes per pixel to paint into
+class Surface_c
+{
+  public:
+    Surface_c(int w, int h) : width(w), height(h), pitch(3*w), pixels(3*w*h, 0) { }
+
+    int width, height, pitch;
+    std::vector<uint8_t> pixels;
+};
+
+// paint all commands of a layout onto the surface with the blitters
+static size_t paintLayout(const TextLayout_c & l, Surface_c & s, internal::GlyphCache_c & cache,
+                          const internal::Gamma_c<> & g, SubPixelArrangement sp)
+{
+  auto pxget = [](const uint8_t * p) -> auto { return std::make_tuple(p[0], p[1], p[2]); };
+  auto pxput = [](uint8_t * p, uint8_t r, uint8_t gr, uint8_t b) -> void { p[0] = r; p[1] = gr; p[2] = b; };
+  auto blend = [&g](int a1, int a2, int b1, int b2, int c) -> auto { return internal::blend(a1, a2, b1, b2, c, g); };
+
+  size_t painted = 0;
+
+  for (const auto & i : l.getData())
+  {
+    const internal::PaintData_c * img;
+
+    if (i.command == CommandData_c::CMD_GLYPH)
+      img = &cache.getGlyph(i.font, i.glyphIndex, sp, i.blurr);
+    else if (i.command == CommandData_c::CMD_RECT)
+      img = &cache.getRect(i.w, i.h, sp, i.blurr);
+    else
+      continue;
+
+    Color_c c = g.forward(i.c);
+
+    if (sp == SUBP_NONE)
+      internal::outputGlyph_NONE(i.x, i.y, *img, c, s.pixels.data(), s.pitch, 3, s.width, s.height,
+                                 pxget, pxput, blend);
+    else
+      internal::outputGlyph_HorizontalRGB(i.x, i.y, *img, c.r(), c.g(), c.b(), c.a(),
+                                          s.pixels.data(), s.pitch, 3, s.width, s.height,
+                                          pxget, pxput, blend);
+    painted++;
+  }
+
+  return painted;
+}
+
+int main(int argc, char ** argv)
+{
+  Benchmark_c bench(argc > 1 ? argv[1] : "");
+
+  auto fc = std::make_shared<FontCache_c>();
+
+  addHyphenDictionary({"en"}, std::istringstream((const char*)hyph_en_US));
+
+  CodepointAttributes_c a;
+  a.font = fc->getFont(FontResource_c("tests/FreeSans.ttf"), 16*64);
+  a.c = Color_c(255, 255, 255);
+  a.lang = "en";
+  AttributeIndex_c attr(a);
+
+  CodepointAttributes_c ar;
+  ar.font = fc->getFont(FontResource_c("tests/Amiri.ttf"), 16*64);
+  ar.c = Color_c(255, 255, 255);
+  ar.lang = "ar-arab";
+  AttributeIndex_c arattr(ar);
+
+  CodepointAttributes_c sh = a;
+  sh.flags = CodepointAttributes_c::FL_UNDERLINE;
+  sh.shadows.push_back(CodepointAttributes_c::Shadow_c{Color_c(0, 0, 0), 64, 64, 0});
+  AttributeIndex_c shattr(sh);
+
+  RectangleShape_c shape(400*64);
+
+  std::u32string paragraph = repeat(loremIpsum, 3);
+
+  // paragraph layout with the different line breaking settings
+  for (bool optimize : { false, true })
+    for (bool hyphenate : { false, true })
+    {
+      LayoutProperties_c prop;
+      prop.optimizeLinebreaks = optimize;
+      prop.hyphenate = hyphenate;
+
+      bench.run(std::string("layoutParagraph/") + (optimize ? "optimizing" : "greedy") +
+                (hyphenate ? "/hyphenate" : "/nohyphenate"), [&]()
+      {
+        layoutParagraph(paragraph, attr, shape, prop);
+        return paragraph.size();
+      });
+    }
+
+  {
+    LayoutProperties_c prop;
+    prop.ltr = false;
+    std::u32string txt = repeat(arabicText, 40);
+
+    bench.run("layoutParagraph/arabic", [&]()
+    {
+      layoutParagraph(txt, arattr, shape, prop);
+      return txt.size();
+    });
+  }
+
+  // the shape cache: all text found in the cache and the cache emptied before each layout
+  {
+    LayoutProperties_c prop;
+
+    bench.run("shapeCache/warm", [&]()
+    {
+      layoutParagraph(paragraph, attr, shape, prop);
+      return paragraph.size();
+    });
+
+    bench.run("shapeCache/cold", [&]()
+    {
+      clearShapeCache();
+      layoutParagraph(paragraph, attr, shape, prop);
+      return paragraph.size();
+    });
+  }
+
+  // reusing the memory of a layout context, after the first paragraphs
+  // its buffers should not grow any more
+  {
+    LayoutProperties_c prop;
+    LayoutContext_c context;
+
+    bench.run("layoutContext/layoutParagraph", [&]()
+    {
+      layoutParagraph(paragraph, attr, shape, prop, 0, context);
+      return paragraph.size();
+    });
+
+    auto before = context.getStatistics();
+    for (int i = 0; i < 100; i++)
+      layoutParagraph(paragraph, attr, shape, prop, 0, context);
+    auto after = context.getStatistics();
+
+    bench.value("layoutContext/bufferGrowthsPerParagraph",
+                (double)(after.bufferGrowths-before.bufferGrowths)/(after.paragraphs-before.paragraphs));
+
+    // the phases of the layout as seen by the layout statistics
+    LayoutStats_c stats;
+    context.setLayoutStats(&stats);
+    for (int i = 0; i < 100; i++)
+      layoutParagraph(paragraph, attr, shape, prop, 0, context);
+    context.setLayoutStats(nullptr);
+
+    bench.value("layoutStats/bidiNs", stats.bidiNs/100.0);
+    bench.value("layoutStats/linebreakNs", stats.linebreakNs/100.0);
+    bench.value("layoutStats/hyphenationNs", stats.hyphenationNs/100.0);
+    bench.value("layoutStats/itemizeNs", stats.itemizeNs/100.0);
+    bench.value("layoutStats/shapingNs", stats.shapingNs/100.0);
+    bench.value("layoutStats/runsNs", stats.runsNs/100.0);
+    bench.value("layoutStats/breakingNs", stats.breakingNs/100.0);
+    bench.value("layoutStats/outputNs", stats.outputNs/100.0);
+  }
+
+  // heap allocations per glyph with warm caches, the remaining allocations
+  // are those for the resulting layout
+  {
+    LayoutProperties_c prop;
+    LayoutContext_c context;
+
+    std::vector<std::pair<std::string, std::u32string>> texts =
+    {
+      { "paragraph", paragraph },
+      { "label", U"Settings" },
+      { "arabic", repeat(arabicText, 10) },
+    };
+
+    for (const auto & t : texts)
+    {
+      const AttributeIndex_c & at = t.first == "arabic" ? arattr : attr;
+      prop.ltr = t.first != "arabic";
+
+      size_t glyphs = 0;
+      for (const auto & c : layoutParagraph(t.second, at, shape, prop, 0, context).getData())
+        if (c.command == CommandData_c::CMD_GLYPH)
+          glyphs++;
+
+      uint64_t before = heapAllocations;
+      for (int i = 0; i < 100; i++)
+        layoutParagraph(t.second, at, shape, prop, 0, context);
+      uint64_t after = heapAllocations;
+
+      bench.value("allocations/" + t.first + "/perGlyph", (double)(after-before)/(100*std::max<size_t>(glyphs, 1)));
+    }
+  }
+
+  // short labels, the typical text of a user interface
+  {
+    LayoutProperties_c prop;
+    std::u32string label = U"Settings";
+
+    bench.run("label/layoutParagraph", [&]()
+    {
+      layoutParagraph(label, attr, shape, prop);
+      return label.size();
+    });
+
+    std::u32string counter = U"Score: 12345 points";
+    DynamicLabel_c dyn(U"Score: ", U"12345", U" points", attr, std::make_shared<RectangleShape_c>(400*64), prop);
+    int v = 0;
+
+    bench.run("label/dynamicLabel", [&]()
+    {
+      dyn.update(std::u32string(1, U'0'+v%10) + U"2345");
+      v++;
+      return counter.size();
+    });
+
+    bench.run("label/layoutParagraphChanging", [&]()
+    {
+      counter[7] = U'0'+v%10;
+      v++;
+      layoutParagraph(counter, attr, shape, prop);
+      return counter.size();
+    });
+  }
+
+  // the shortcuts for simple text compared to the full bidi and line breaking algorithms,
+  // the glyphs are shaped by HarfBuzz in both cases
+  {
+    std::vector<std::u32string> labels = { U"Settings", U"Open file...", U"Volume: 75", U"Save and quit",
+                                           U"Player 2 wins!", U"Level 12, 3 lives left" };
+
+    for (bool shortcuts : { true, false })
+    {
+      LayoutProperties_c prop;
+      prop.simpleTextShortcuts = shortcuts;
+      std::string n = shortcuts ? "shortcuts" : "full";
+
+      bench.run("simpleText/" + n + "/labels", [&]()
+      {
+        size_t chars = 0;
+
+        for (const auto & l : labels)
+        {
+          layoutParagraph(l, attr, shape, prop);
+          chars += l.size();
+        }
+
+        return chars;
+      });
+
+      bench.run("simpleText/" + n + "/paragraph", [&]()
+      {
+        layoutParagraph(paragraph, attr, shape, prop);
+        return paragraph.size();
+      });
+    }
+  }
+
+  // measuring compared to layouting, with shadowed and underlined text
+  {
+    LayoutProperties_c prop;
+
+    bench.run("measure/layoutParagraph", [&]()
+    {
+      layoutParagraph(paragraph, shattr, shape, prop);
+      return paragraph.size();
+    });
+
+    bench.run("measure/measureParagraph", [&]()
+    {
+      measureParagraph(paragraph, shattr, shape, prop);
+      return paragraph.size();
+    });
+
+    prop.maxLines = 2;
+
+    bench.run("measure/layoutParagraphMaxLines", [&]()
+    {
+      layoutParagraph(paragraph, shattr, shape, prop);
+      return paragraph.size();
+    });
+  }
+
+  // line breaking only, for paragraphs from 1K to 1M runs, the time per run
+  // should stay about the same
+  for (size_t runs : { 1000, 10000, 100000, 1000000 })
+  {
+    std::string n = std::to_string(runs);
+
+    if (!bench.selected("breakParagraph/greedy/" + n) && !bench.selected("breakParagraph/optimizing/" + n))
+      continue;
+
+    // each word and each space is a run
+    std::u32string txt = repeat(loremIpsum, std::max<size_t>(runs/2/69, 1));
+
+    for (bool optimize : { false, true })
+    {
+      LayoutProperties_c prop;
+      prop.optimizeLinebreaks = optimize;
+      prop.hyphenate = false;
+
+      auto shaped = shapeParagraph(txt, attr, prop);
+
+      bench.run(std::string("breakParagraph/") + (optimize ? "optimizing/" : "greedy/") + n, [&]()
+      {
+        breakParagraph(shaped, shape, prop, 0);
+        return runs;
+      });
+    }
+  }
+
+  // many paragraphs in parallel with a growing number of threads
+  {
+    std::vector<ParagraphJob_c> jobs(256);
+    auto s = std::make_shared<RectangleShape_c>(400*64);
+
+    for (auto & j : jobs)
+    {
+      j.txt32 = loremIpsum;
+      j.attr = attr;
+      j.shape = s;
+    }
+
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+
+    for (unsigned int w = 1; w <= cores; w *= 2)
+    {
+      bench.run("layoutParagraphs/workers" + std::to_string(w), [&]()
+      {
+        layoutParagraphs(jobs, w);
+        return jobs.size();
+      });
+    }
+  }
+
+  // concurrent requests to a font cache, with all fonts in the cache and with a budget,
+  // that is too small for the sizes used, so that fonts are removed and created again
+  for (size_t budget : { size_t(0), size_t(1) })
+  {
+    FontCache_c cache;
+    cache.setBudget(budget);
+
+    std::vector<FontResource_c> res = { FontResource_c("tests/FreeSans.ttf"), FontResource_c("tests/Amiri.ttf") };
+
+    // sizes from 8 to 24 pixels, with a budget only few of the fonts stay in the cache
+    const uint32_t calls = budget ? 100 : 10000;
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+
+    for (unsigned int w = 1; w <= cores; w *= 2)
+    {
+      bench.run(std::string("fontCache/") + (budget ? "evicting" : "cached") + "/threads" + std::to_string(w), [&]()
+      {
+        std::vector<std::thread> threads;
+
+        for (unsigned int t = 0; t < w; t++)
+          threads.emplace_back([&cache, &res, calls, t]()
+          {
+            for (uint32_t i = 0; i < calls; i++)
+              cache.getFont(res[(i+t) % res.size()], (8 + (i*7+t) % 17) * 64);
+          });
+
+        for (auto & t : threads)
+          t.join();
+
+        return w*calls;
+      });
+    }
+  }
+
+  // XHTML layout
+  {
+    TextStyleSheet_c s(fc);
+
+    s.addFont("sans", FontResource_c("tests/FreeSans.ttf"));
+    s.addFont("sans-ar", FontResource_c("tests/Amiri.ttf"));
+    s.addRule("body", "font-size", "16px");
+    s.addRule("body", "color", "#ffffff");
+    s.addRule("p[lang|=ar]", "direction", "rtl");
+    s.addRule("p[lang|=ar]", "font-family", "sans-ar");
+    s.addRule(".ul", "text-decoration", "underline");
+    s.addRule("a", "color", "#0000ff");
+    s.addRule("td", "border-width", "1px");
+    s.addRule("td", "border-color", "#ff0000");
+
+    for (const auto & d : xhtmlDocuments)
+    {
+      bench.run("layoutXHTML/" + d.first, [&]()
+      {
+        layoutXHTML(Pugi, d.second, s, RectangleShape_c(400*64));
+        return d.second.size();
+      });
+    }
+  }
+
+  // the glyph cache, hits with all glyphs of a paragraph already rendered and misses
+  // with a new cache for each call
+  TextLayout_c layout = layoutParagraph(paragraph, attr, shape, LayoutProperties_c());
+
+  {
+    std::set<std::pair<FontFace_c*, glyphIndex_t>> seen;
+    std::vector<CommandData_c> glyphs;
+
+    for (const auto & c : layout.getData())
+      if (c.command == CommandData_c::CMD_GLYPH && seen.insert(std::make_pair(c.font.get(), c.glyphIndex)).second)
+        glyphs.push_back(c);
+
+    for (auto sp : { SUBP_NONE, SUBP_RGB })
+    {
+      std::string n = sp == SUBP_NONE ? "/none" : "/rgb";
+
+      internal::GlyphCache_c cache;
+
+      bench.run("glyphCache/hit" + n, [&]()
+      {
+        for (const auto & g : glyphs)
+          cache.getGlyph(g.font, g.glyphIndex, sp, 0);
+
+        return glyphs.size();
+      });
+
+      bench.run("glyphCache/miss" + n, [&]()
+      {
+        internal::GlyphCache_c c;
+
+        for (const auto & g : glyphs)
+          c.getGlyph(g.font, g.glyphIndex, sp, 0);
+
+        return glyphs.size();
+      });
+    }
+  }
+
+  // blurring a glyph sized image
+  for (double r : { 1.0, 4.0 })
+  {
+    std::vector<uint8_t> img(64*64);
+
+    for (size_t i = 0; i < img.size(); i++)
+      img[i] = (i % 7 == 0) ? 255 : 0;
+
+    bench.run("gaussBlur/radius" + std::to_string((int)r), [&]()
+    {
+      internal::gaussBlur(img.data(), 64, 64, 64, r, 1, 1);
+      return img.size();
+    });
+  }
+
+  // filling a texture atlas with glyph sized rectangles
+  {
+    internal::RectanglePacker_c packer(1024, 1024);
+    uint32_t seed = 1;
+
+    bench.run("rectanglePacker/allocate", [&]()
+    {
+      packer.clear();
+      size_t n = 0;
+
+      while (true)
+      {
+        seed = seed * 1103515245 + 12345;
+        uint32_t w = 4 + (seed >> 16) % 28;
+        uint32_t h = 8 + (seed >> 8) % 24;
+
+        if (!packer.allocate(w, h)) break;
+        n++;
+      }
+
+      return n;
+    });
+  }
+
+  // painting onto an in memory surface
+  {
+    Surface_c surface(800, 600);
+    internal::Gamma_c<> g;
+    g.setGamma(22);
+
+    for (auto sp : { SUBP_NONE, SUBP_RGB })
+    {
+      internal::GlyphCache_c cache;
+
+      bench.run(std::string("blitter/paragraph") + (sp == SUBP_NONE ? "/none" : "/rgb"), [&]()
+      {
+        return paintLayout(layout, surface, cache, g, sp);
+      });
+    }
+
+    // the layouts of the tests, loaded from their files
+    std::vector<TextLayout_c> layouts;
+
+    for (const auto & f : layoutFiles())
+    {
+      pugi::xml_document doc;
+
+      if (doc.load_file(f.c_str()))
+        layouts.push_back(loadLayoutFromXML(doc.child("layout"), fc));
+    }
+
+    internal::GlyphCache_c cache;
+
+    bench.run("blitter/testLayouts", [&]()
+    {
+      size_t n = 0;
+
+      for (const auto & l : layouts)
+        n += paintLayout(l, surface, cache, g, SUBP_RGB);
+
+      return n;
+    });
+  }
+
+  return 0;
+}
@@ -34,7 +34,6 @@
 
 #include <boost/concept_check.hpp>
 
-#include <fstream>
 #include <sstream>
 
 #define TXT_WIDTH 750
@@ -51,23 +50,6 @@ public:
   virtual int32_t getRight(int32_t top, int32_t /*bottom*/) const { return TXT_WIDTH-top/8; }
 };
 
-std::pair<std::shared_ptr<uint8_t>, size_t> loadFile(const std::string & fn)
-{
-  std::ifstream f(fn.c_str());
-
-  f.seekg(0, std::ios_base::end);
-
-  auto size = f.tellg();
-
-  uint8_t * dat = new uint8_t[size];
-
-  f.seekg(0, std::ios_base::beg);
-
-  f.read(reinterpret_cast<char*>(dat), size);
-
-  return std::make_pair(std::shared_ptr<uint8_t>(dat, std::default_delete<uint8_t[]>()), size);
-}
-
 class layoutInfo_c
 {
   public:
@@ -178,17 +160,17 @@ int main ()
   // alle Fonts, die so genutzt werden: familie heißt sans, und dann der bold Font dazu
   {
     FontResource_c r;
-    r.addFont("/usr/share/fonts/noto/NotoSans-Regular.ttf");
-    r.addFont("/usr/share/fonts/noto/NotoSansHebrew-Regular.ttf");
-    r.addFont("/usr/share/fonts/noto/NotoKufiArabic-Regular.ttf");
+    r.addMappedFont("/usr/share/fonts/noto/NotoSans-Regular.ttf");
+    r.addMappedFont("/usr/share/fonts/noto/NotoSansHebrew-Regular.ttf");
+    r.addMappedFont("/usr/share/fonts/noto/NotoKufiArabic-Regular.ttf");
 
     styleSheet.addFont("sans", r);
   }
   {
     FontResource_c r;
-    r.addFont("/usr/share/fonts/noto/NotoSans-Bold.ttf");
-    r.addFont("/usr/share/fonts/noto/NotoSansHebrew-Bold.ttf");
-    r.addFont("/usr/share/fonts/noto/NotoKufiArabic-Bold.ttf");
+    r.addMappedFont("/usr/share/fonts/noto/NotoSans-Bold.ttf");
+    r.addMappedFont("/usr/share/fonts/noto/NotoSansHebrew-Bold.ttf");
+    r.addMappedFont("/usr/share/fonts/noto/NotoKufiArabic-Bold.ttf");
 
     styleSheet.addFont("sans", r, "normal", "normal", "bold");
   }
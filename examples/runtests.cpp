@@ -26,11 +26,22 @@
 #include <stll/layouterCSS.h>
 #include <stll/layouterXHTML.h>
 #include <stll/layouterFont.h>
+#include <stll/hyphendictionaries.h>
+#include <stll/hyphenationdictionaries/hyph_en_US.h>
 #include "layouterXMLSaveLoad.h"
 
+#include <hb.h>
+#include <hb-ft.h>
+
 #include <pugixml.hpp>
 
 #include <string>
+#include <thread>
+#include <atomic>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
 
 #if   defined(USE_PUGI_XML)
 #define XMLLIB Pugi
@@ -917,3 +928,1293 @@ BOOST_AUTO_TEST_CASE( Links )
     "<tr><td class='va-mid'><a href='l1'>Test</a></td><td>Table cell with some text to get a linebreak</td></tr><tr><td>T</td><td>Table</td></tr></table></body></html>",
     s, STLL::RectangleShape_c(1000*64)), "tests/link-08.lay"));
 }
+
+BOOST_AUTO_TEST_CASE( Shape_Cache )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+  STLL::TextStyleSheet_c s(c);
+
+  s.addFont("sans", STLL::FontResource_c("tests/FreeSans.ttf"));
+  s.addRule("body", "font-size", "16px");
+  s.addRule("body", "color", "#ffffff");
+  s.setUseOptimizingLayouter(false);
+  s.setHyphenate(false);
+
+  const char * txt = "<html><body><p lang='en'>Test Text Test Text with a few more words</p></body></html>";
+
+  STLL::clearShapeCache();
+
+  auto l1 = STLL::layoutXHTML(XMLLIB, txt, s, STLL::RectangleShape_c(100*64));
+  auto s1 = STLL::getShapeCacheStatistics();
+
+  // repeated words within the paragraph are found in the cache
+  BOOST_CHECK(s1.misses > 0);
+  BOOST_CHECK(s1.hits > 0);
+  BOOST_CHECK(s1.entries > 0);
+  BOOST_CHECK(s1.bytes <= s1.budget);
+
+  // the second layout must be completely served from the cache and be identical
+  auto l2 = STLL::layoutXHTML(XMLLIB, txt, s, STLL::RectangleShape_c(100*64));
+  auto s2 = STLL::getShapeCacheStatistics();
+
+  BOOST_CHECK_EQUAL(s2.misses, s1.misses);
+  BOOST_CHECK(s2.hits > s1.hits);
+  BOOST_CHECK(l1 == l2);
+
+  // without budget nothing is stored, but the result stays the same
+  STLL::setShapeCacheBudget(0);
+  BOOST_CHECK(STLL::getShapeCacheStatistics().entries == 0);
+
+  auto l3 = STLL::layoutXHTML(XMLLIB, txt, s, STLL::RectangleShape_c(100*64));
+  BOOST_CHECK(STLL::getShapeCacheStatistics().entries == 0);
+  BOOST_CHECK(l1 == l3);
+
+  STLL::setShapeCacheBudget(4*1024*1024);
+}
+
+BOOST_AUTO_TEST_CASE( Optimizing_Linebreaks )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+  STLL::TextStyleSheet_c s(c);
+
+  s.addFont("sans", STLL::FontResource_c("tests/FreeSans.ttf"));
+  s.addRule("body", "font-size", "16px");
+  s.addRule("body", "color", "#ffffff");
+  s.setUseOptimizingLayouter(true);
+  s.setHyphenate(false);
+
+  std::string txt;
+  for (int i = 0; i < 200; i++)
+    txt += "Lorem ipsum dolor sit amet, consectetur adipiscing elit. ";
+
+  // all glyphs of a long paragraph must stay within the shape
+  auto l = STLL::layoutXHTML(XMLLIB, "<html><body><p lang='en'>" + txt + "</p></body></html>",
+                             s, STLL::RectangleShape_c(200*64));
+
+  BOOST_CHECK(l.getHeight() > 100*16*64);
+
+  for (const auto & d : l.getData())
+    if (d.command == STLL::CommandData_c::CMD_GLYPH)
+      BOOST_CHECK(d.x >= 0 && d.x < 200*64);
+
+  // a word that is wider than the shape still results in a layout
+  auto l2 = STLL::layoutXHTML(XMLLIB,
+    "<html><body><p lang='en'>Test Textwithaverylongadditiontomakeitlong Text</p></body></html>",
+    s, STLL::RectangleShape_c(50*64));
+
+  BOOST_CHECK(l2.getHeight() >= 3*16*64);
+}
+
+BOOST_AUTO_TEST_CASE( Shaped_Paragraph )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+
+  STLL::CodepointAttributes_c a;
+  a.font = c->getFont(STLL::FontResource_c("tests/FreeSans.ttf"), 16*64);
+  a.c = STLL::Color_c(255, 255, 255);
+  a.lang = "en";
+  a.flags = STLL::CodepointAttributes_c::FL_UNDERLINE;
+
+  STLL::AttributeIndex_c attr(a);
+
+  std::u32string txt = U"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor "
+                       U"incididunt ut labore et dolore magna aliqua.\nUt enim ad minim veniam.";
+
+  STLL::LayoutProperties_c prop;
+  prop.hyphenate = false;
+  prop.align = STLL::LayoutProperties_c::ALG_JUSTIFY_LEFT;
+
+  auto shaped = STLL::shapeParagraph(txt, attr, prop);
+
+  // breaking the same shaped paragraph several times must give the same
+  // result as a full layout for each width
+  for (int w : { 100, 200, 1000, 150 })
+  {
+    prop.optimizeLinebreaks = false;
+    BOOST_CHECK(STLL::breakParagraph(shaped, STLL::RectangleShape_c(w*64), prop) ==
+                STLL::layoutParagraph(txt, attr, STLL::RectangleShape_c(w*64), prop));
+
+    prop.optimizeLinebreaks = true;
+    BOOST_CHECK(STLL::breakParagraph(shaped, STLL::RectangleShape_c(w*64), prop, 10*64) ==
+                STLL::layoutParagraph(txt, attr, STLL::RectangleShape_c(w*64), prop, 10*64));
+  }
+
+  BOOST_CHECK_THROW(STLL::breakParagraph(STLL::ShapedParagraph_c(), STLL::RectangleShape_c(100*64), prop),
+                    STLL::LayoutException_c);
+}
+
+BOOST_AUTO_TEST_CASE( Incremental_Paragraph )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+
+  STLL::CodepointAttributes_c a;
+  a.font = c->getFont(STLL::FontResource_c("tests/FreeSans.ttf"), 16*64);
+  a.c = STLL::Color_c(255, 255, 255);
+  a.lang = "en";
+
+  STLL::CodepointAttributes_c b = a;
+  b.c = STLL::Color_c(255, 0, 0);
+
+  STLL::AttributeIndex_c attr(a);
+  STLL::AttributeIndex_c battr(b);
+
+  std::u32string txt = U"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor "
+                       U"incididunt ut labore et dolore magna aliqua.\nUt enim ad minim veniam, quis nostrud "
+                       U"exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat.";
+
+  STLL::RectangleShape_c shape(150*64);
+
+  for (bool optimize : { false, true })
+  {
+    STLL::LayoutProperties_c prop;
+    prop.optimizeLinebreaks = optimize;
+    prop.align = STLL::LayoutProperties_c::ALG_JUSTIFY_LEFT;
+
+    STLL::IncrementalParagraph_c par(txt, attr, prop);
+
+    BOOST_CHECK(par.layout(shape) == STLL::layoutParagraph(txt, attr, shape, prop));
+
+    // after each edit the result must be the same as a full layout of the new text
+    auto l = par.edit(6, 0, U"x", battr, shape);
+    BOOST_CHECK(l == STLL::layoutParagraph(par.getText(), par.getAttributes(), shape, prop));
+
+    l = par.edit(120, 0, U"and some more words ", battr, shape);
+    BOOST_CHECK(l == STLL::layoutParagraph(par.getText(), par.getAttributes(), shape, prop));
+
+    l = par.edit(30, 12, U"", attr, shape);
+    BOOST_CHECK(l == STLL::layoutParagraph(par.getText(), par.getAttributes(), shape, prop));
+
+    l = par.edit(par.getText().size()-3, 3, U"ing\nend", attr, shape);
+    BOOST_CHECK(l == STLL::layoutParagraph(par.getText(), par.getAttributes(), shape, prop));
+
+    l = par.edit(0, 0, U"Start ", battr, shape);
+    BOOST_CHECK(l == STLL::layoutParagraph(par.getText(), par.getAttributes(), shape, prop));
+
+    BOOST_CHECK(STLL::breakParagraph(par.getShaped(), shape, prop) == l);
+
+    BOOST_CHECK_THROW(par.edit(par.getText().size()+1, 0, U"x", attr, shape), STLL::LayoutException_c);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( Concurrent_Layouts )
+{
+  // all threads share the stylesheet and with it the font cache and the fonts
+  auto c = std::make_shared<STLL::FontCache_c>();
+  STLL::TextStyleSheet_c s(c);
+
+  s.addFont("sans", STLL::FontResource_c("tests/FreeSans.ttf"));
+  s.addFont("sans-ar", STLL::FontResource_c("tests/Amiri.ttf"));
+  s.addRule("body", "font-size", "16px");
+  s.addRule("body", "color", "#ffffff");
+  s.addRule("p[lang|=ar]", "direction", "rtl");
+  s.addRule("p[lang|=ar]", "font-family", "sans-ar");
+  s.setUseOptimizingLayouter(false);
+  s.setHyphenate(false);
+
+  class Case_c
+  {
+    public:
+      std::string xhtml;
+      int32_t width;
+      std::string file;
+      pugi::xml_document doc;
+  };
+
+  std::vector<Case_c> cases(4);
+
+  cases[0].xhtml = "<html><body><p lang='en'>Test Text</p></body></html>";
+  cases[0].width = 1000;
+  cases[0].file = "tests/simple-01.lay";
+  cases[1].xhtml = "<html><body><p lang='ar-arab'>كأس الأمم</p></body></html>";
+  cases[1].width = 1000;
+  cases[1].file = "tests/simple-03.lay";
+  cases[2].xhtml = "<html><body><p lang='en'>Test&#173;Text&#173;Textwithaverylongadditiontomakeitlong</p></body></html>";
+  cases[2].width = 300;
+  cases[2].file = "tests/simple-04.lay";
+  cases[3].xhtml = "<html><body><p lang='en'>Te<img width='10px' height='10px' src='a' />st</p></body></html>";
+  cases[3].width = 300;
+  cases[3].file = "tests/simple-05.lay";
+
+  for (auto & cs : cases)
+    BOOST_REQUIRE(cs.doc.load_file(cs.file.c_str()));
+
+  // Boost.Test checks can only be done in the main thread, so the threads only count
+  // the layouts that are not as expected
+  std::atomic<int> failures(0);
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < 8; t++)
+  {
+    threads.emplace_back([&cases, &s, &failures, t]()
+    {
+      try
+      {
+        for (int r = 0; r < 20; r++)
+        {
+          auto & cs = cases[(t+r) % cases.size()];
+
+          if (!compare(STLL::layoutXHTML(XMLLIB, cs.xhtml, s, STLL::RectangleShape_c(cs.width*64)),
+                       cs.doc.child("layout")))
+            failures++;
+        }
+      }
+      catch (...)
+      {
+        failures++;
+      }
+    });
+  }
+
+  for (auto & t : threads)
+    t.join();
+
+  BOOST_CHECK_EQUAL(failures.load(), 0);
+}
+
+BOOST_AUTO_TEST_CASE( Parallel_Paragraphs )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+
+  STLL::CodepointAttributes_c a;
+  a.font = c->getFont(STLL::FontResource_c("tests/FreeSans.ttf"), 16*64);
+  a.c = STLL::Color_c(255, 255, 255);
+  a.lang = "en";
+
+  std::vector<std::u32string> texts {
+    U"Lorem ipsum dolor sit amet, consectetur adipiscing elit.",
+    U"Sed do eiusmod tempor incididunt ut labore et dolore magna aliqua.",
+    U"Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat.",
+    U"Short"
+  };
+
+  std::vector<STLL::ParagraphJob_c> jobs;
+
+  for (int i = 0; i < 50; i++)
+  {
+    STLL::ParagraphJob_c j;
+
+    j.txt32 = texts[i % texts.size()];
+    j.attr = STLL::AttributeIndex_c(a);
+    j.shape = std::make_shared<STLL::RectangleShape_c>((100+10*i)*64);
+    j.prop.optimizeLinebreaks = (i % 2) == 0;
+    j.ystart = i*64;
+
+    jobs.push_back(j);
+  }
+
+  // the results must be the same as a serial layout for any number of workers
+  for (unsigned int workers : { 1, 3, 0 })
+  {
+    auto res = STLL::layoutParagraphs(jobs, workers);
+
+    BOOST_REQUIRE_EQUAL(res.size(), jobs.size());
+
+    for (size_t i = 0; i < jobs.size(); i++)
+      BOOST_CHECK(res[i] == STLL::layoutParagraph(jobs[i].txt32, jobs[i].attr, *jobs[i].shape,
+                                                  jobs[i].prop, jobs[i].ystart));
+  }
+
+  BOOST_CHECK(STLL::layoutParagraphs(std::vector<STLL::ParagraphJob_c>()).empty());
+
+  jobs[7].shape.reset();
+  BOOST_CHECK_THROW(STLL::layoutParagraphs(jobs, 4), STLL::LayoutException_c);
+}
+
+BOOST_AUTO_TEST_CASE( Font_Fallback )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+
+  STLL::FontResource_c res("tests/FreeSans.ttf");
+  res.addFont("tests/Amiri.ttf");
+
+  auto f = c->getFont(res, 16*64);
+
+  auto sans = c->getFont(STLL::FontResource_c("tests/FreeSans.ttf"), 16*64);
+  auto amiri = c->getFont(STLL::FontResource_c("tests/Amiri.ttf"), 16*64);
+
+  BOOST_CHECK(sans.get(U'a')->containsGlyph(U'a'));
+  BOOST_CHECK(!sans.get(U'a')->containsGlyph(U'\U00000643'));
+  BOOST_CHECK(amiri.get(U'a')->containsGlyph(U'\U00000643'));
+  BOOST_CHECK(!sans.get(U'a')->containsGlyph(U'\U0010FFFF'));
+  BOOST_CHECK(!sans.get(U'a')->containsGlyph(0x110000));
+
+  // asking twice must give the same face, the second time the remembered one
+  for (int i = 0; i < 2; i++)
+  {
+    BOOST_CHECK(f.get(U'a') == sans.get(U'a'));
+    BOOST_CHECK(f.get(U'\U00000643') == amiri.get(U'a'));
+
+    // characters that are in none of the faces use the first face
+    BOOST_CHECK(f.get(U'\U0010FFFF') == sans.get(U'a'));
+  }
+
+  BOOST_CHECK(!STLL::Font_c().get(U'a'));
+}
+
+BOOST_AUTO_TEST_CASE( Font_Sizes )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+
+  auto small = c->getFont(STLL::FontResource_c("tests/FreeSans.ttf"), 16*64);
+  auto big = c->getFont(STLL::FontResource_c("tests/FreeSans.ttf"), 32*64);
+
+  // both sizes share the FreeType face of this thread, but have their own metrics
+  BOOST_CHECK(small.get(U'a') != big.get(U'a'));
+  BOOST_CHECK(small.get(U'a')->getFace() == big.get(U'a')->getFace());
+  BOOST_CHECK(std::abs((int)big.getHeight() - 2*(int)small.getHeight()) <= 64);
+  BOOST_CHECK(big.getAscender() > small.getAscender());
+
+  STLL::CodepointAttributes_c a;
+  a.c = STLL::Color_c(255, 255, 255);
+  a.lang = "en";
+  a.font = small;
+  STLL::AttributeIndex_c smallAttr(a);
+  a.font = big;
+  STLL::AttributeIndex_c bigAttr(a);
+
+  STLL::LayoutProperties_c prop;
+  std::u32string txt = U"Test Text with some words";
+
+  // using the sizes one after the other must not change the results
+  auto l1 = STLL::layoutParagraph(txt, smallAttr, STLL::RectangleShape_c(1000*64), prop);
+  auto l2 = STLL::layoutParagraph(txt, bigAttr, STLL::RectangleShape_c(1000*64), prop);
+  STLL::clearShapeCache();
+  BOOST_CHECK(l1 == STLL::layoutParagraph(txt, smallAttr, STLL::RectangleShape_c(1000*64), prop));
+  BOOST_CHECK(l2.getRight() > l1.getRight());
+
+  // another thread gets its own face with its own sizes
+  bool same = false;
+  FT_FaceRec_ * face = nullptr;
+  STLL::TextLayout_c l3;
+  size_t bytes = big.get(U'a')->getMemoryUsage();
+
+  std::thread t([&]()
+  {
+    face = big.get(U'a')->getFace();
+    same = face == small.get(U'a')->getFace();
+    STLL::clearShapeCache();
+    l3 = STLL::layoutParagraph(txt, bigAttr, STLL::RectangleShape_c(1000*64), prop);
+  });
+  t.join();
+
+  BOOST_CHECK(same);
+  BOOST_CHECK(face != big.get(U'a')->getFace());
+  BOOST_CHECK(l2 == l3);
+
+  // the size and face of the thread are released when it ends
+  BOOST_CHECK_EQUAL(big.get(U'a')->getMemoryUsage(), bytes);
+
+  // sizes used by other threads can be released
+  small = STLL::Font_c();
+  smallAttr = STLL::AttributeIndex_c();
+  c->clear();
+  BOOST_CHECK(l2 == STLL::layoutParagraph(txt, bigAttr, STLL::RectangleShape_c(1000*64), prop));
+}
+
+BOOST_AUTO_TEST_CASE( Bitmap_Font_Sizes )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+
+  // the bitmap font only has a strike with 16 pixels, other sizes can not be created
+  auto f = c->getFont(STLL::FontResource_c("tests/Bitmap16.bdf"), 16*64);
+  BOOST_CHECK(f.get(U'a'));
+
+  BOOST_CHECK_THROW(c->getFont(STLL::FontResource_c("tests/Bitmap16.bdf"), 32*64), STLL::FreetypeException_c);
+  BOOST_CHECK_THROW(c->getFont(STLL::FontResource_c("tests/Bitmap16.bdf"), 32*64), STLL::FreetypeException_c);
+
+  // the failed sizes leave nothing behind, neither in this thread nor in others
+  bool thrown = false;
+  size_t bytes = 0;
+
+  std::thread t([&]()
+  {
+    try
+    {
+      c->getFont(STLL::FontResource_c("tests/Bitmap16.bdf"), 8*64);
+    }
+    catch (STLL::FreetypeException_c &)
+    {
+      thrown = true;
+    }
+
+    bytes = f.get(U'a')->getMemoryUsage();
+  });
+  t.join();
+
+  BOOST_CHECK(thrown);
+  BOOST_CHECK(bytes > 0);
+  BOOST_CHECK(f.get(U'a')->getMemoryUsage() > 0);
+  c->clear();
+}
+
+BOOST_AUTO_TEST_CASE( Bitmap_Font_Layout )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+
+  auto f = c->getFont(STLL::FontResource_c("tests/Bitmap16.bdf"), 16*64);
+
+  STLL::CodepointAttributes_c a;
+  a.c = STLL::Color_c(255, 255, 255);
+  a.lang = "en";
+  a.font = f;
+  STLL::AttributeIndex_c attr(a);
+
+  STLL::LayoutProperties_c prop;
+  std::u32string txt = U"abbabaab";
+
+  // the font has no tables for HarfBuzz, the glyphs must be those of the character map of FreeType
+  auto l = STLL::layoutParagraph(txt, attr, STLL::RectangleShape_c(1000*64), prop);
+
+  std::vector<uint32_t> expected;
+
+  for (auto ch : txt)
+    expected.push_back(FT_Get_Char_Index(f.get(ch)->getFace(), ch));
+
+  std::vector<uint32_t> glyphs;
+  std::vector<int32_t> x;
+
+  for (const auto & d : l.getData())
+    if (d.command == STLL::CommandData_c::CMD_GLYPH)
+    {
+      glyphs.push_back(d.glyphIndex);
+      x.push_back(d.x);
+    }
+
+  BOOST_CHECK(expected[0] != 0 && expected[1] != 0 && expected[0] != expected[1]);
+  BOOST_CHECK(glyphs == expected);
+
+  // all glyphs of the font are 8 pixels wide
+  for (size_t i = 1; i < x.size(); i++)
+    BOOST_CHECK_EQUAL(x[i] - x[i-1], 8*64);
+}
+
+BOOST_AUTO_TEST_CASE( Glyph_Advances )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+
+  // the advances must be exactly those HarfBuzz gets from FreeType, the
+  // rounding of the font tables differs for some glyphs and sizes
+  for (uint32_t size : { 6, 8, 12, 16, 24, 36, 72 })
+  {
+    auto f = c->getFont(STLL::FontResource_c("tests/FreeSans.ttf"), size*64).get(U'a');
+
+    hb_font_t * font = f->getHarfbuzzFont();
+    hb_font_t * ft = hb_ft_font_create(f->getFace(), nullptr);
+
+    unsigned int glyphs = hb_face_get_glyph_count(hb_font_get_face(font));
+    unsigned int differences = 0;
+
+    for (hb_codepoint_t g = 0; g < glyphs; g++)
+      if (hb_font_get_glyph_h_advance(font, g) != hb_font_get_glyph_h_advance(ft, g))
+        differences++;
+
+    BOOST_CHECK(glyphs > 0);
+    BOOST_CHECK_EQUAL(differences, 0);
+
+    for (char32_t ch : std::u32string(U"J\u0134\u0190\u01C8\u0187"))
+    {
+      hb_codepoint_t g = 0;
+      BOOST_CHECK(hb_font_get_nominal_glyph(font, ch, &g));
+      BOOST_CHECK_EQUAL(hb_font_get_glyph_h_advance(font, g), hb_font_get_glyph_h_advance(ft, g));
+    }
+
+    hb_font_destroy(ft);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( Mapped_Fonts )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+
+  STLL::FontResource_c mapped;
+  mapped.addMappedFont("tests/FreeSans.ttf");
+
+  BOOST_CHECK(mapped.getRessource(0).getData());
+  BOOST_CHECK(mapped.getRessource(0).getDatasize() > 0);
+
+  // all fonts created from the resource use the one mapping
+  auto f = c->getFont(mapped, 16*64);
+  BOOST_CHECK(f.get(U'a')->getResource().getData() == mapped.getRessource(0).getData());
+  BOOST_CHECK(c->getFont(mapped, 32*64).get(U'a')->getResource().getData() == mapped.getRessource(0).getData());
+
+  // the mapped font gives the same layout as the font loaded from the file
+  auto file = c->getFont(STLL::FontResource_c("tests/FreeSans.ttf"), 16*64);
+
+  STLL::CodepointAttributes_c a;
+  a.c = STLL::Color_c(255, 255, 255);
+  a.lang = "en";
+  a.font = f;
+  STLL::AttributeIndex_c mappedAttr(a);
+  a.font = file;
+  STLL::AttributeIndex_c fileAttr(a);
+
+  STLL::LayoutProperties_c prop;
+  std::u32string txt = U"Test Text with some words";
+
+  auto l1 = STLL::layoutParagraph(txt, mappedAttr, STLL::RectangleShape_c(200*64), prop);
+  auto l2 = STLL::layoutParagraph(txt, fileAttr, STLL::RectangleShape_c(200*64), prop);
+
+  BOOST_REQUIRE_EQUAL(l1.getData().size(), l2.getData().size());
+  BOOST_CHECK_EQUAL(l1.getHeight(), l2.getHeight());
+
+  for (size_t i = 0; i < l1.getData().size(); i++)
+  {
+    BOOST_CHECK_EQUAL(l1.getData()[i].x, l2.getData()[i].x);
+    BOOST_CHECK_EQUAL(l1.getData()[i].y, l2.getData()[i].y);
+    BOOST_CHECK_EQUAL(l1.getData()[i].glyphIndex, l2.getData()[i].glyphIndex);
+  }
+
+  STLL::FontResource_c missing;
+  BOOST_CHECK_THROW(missing.addMappedFont("tests/missing.ttf"), STLL::FreetypeException_c);
+}
+
+BOOST_AUTO_TEST_CASE( Font_Cache_Budget )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+  STLL::FontResource_c res("tests/FreeSans.ttf");
+  STLL::LayoutProperties_c prop;
+
+  auto layout = [&c, &res, &prop](uint32_t size)
+  {
+    STLL::CodepointAttributes_c a;
+    a.c = STLL::Color_c(255, 255, 255);
+    a.lang = "en";
+    a.font = c->getFont(res, size);
+
+    return STLL::layoutParagraph(U"Test Text", STLL::AttributeIndex_c(a), STLL::RectangleShape_c(1000*64), prop);
+  };
+
+  // only the layout holds the font face
+  auto l = layout(16*64);
+  auto face = l.getData()[0].font;
+
+  auto st = c->getStatistics();
+  BOOST_CHECK_EQUAL(st.faces, 1u);
+  BOOST_CHECK_EQUAL(st.misses, 1u);
+  BOOST_CHECK(st.bytes > 0);
+  BOOST_CHECK_EQUAL(st.budget, 0u);
+
+  // with a budget that is too small for any font, all fonts that are not
+  // in use are removed as soon as the next font is added
+  c->setBudget(1);
+
+  for (uint32_t s = 8; s < 40; s++)
+    c->getFont(res, s*64);
+
+  st = c->getStatistics();
+  BOOST_CHECK_EQUAL(st.faces, 2u);
+  BOOST_CHECK_EQUAL(st.misses, 32u);
+  BOOST_CHECK_EQUAL(st.hits, 1u);
+  BOOST_CHECK_EQUAL(st.evictions, 30u);
+
+  // the face of the layout was kept
+  BOOST_CHECK(c->getFont(res, 16*64).get(U'a') == face);
+  BOOST_CHECK(l == layout(16*64));
+
+  // many threads getting fonts and keeping layouts, none of the faces
+  // of the kept layouts must be removed
+  std::atomic<int> failures(0);
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < 4; t++)
+  {
+    threads.emplace_back([&layout, &c, &res, &failures, t]()
+    {
+      try
+      {
+        std::vector<std::pair<uint32_t, STLL::TextLayout_c>> kept;
+
+        for (int r = 0; r < 40; r++)
+        {
+          uint32_t size = (8 + (t*7 + r) % 24) * 64;
+          auto l = layout(size);
+
+          if (r % 4 == 0)
+            kept.emplace_back(size, l);
+
+          for (auto & k : kept)
+            if (c->getFont(res, k.first).get(U'a') != k.second.getData()[0].font)
+              failures++;
+        }
+      }
+      catch (...)
+      {
+        failures++;
+      }
+    });
+  }
+
+  for (auto & t : threads)
+    t.join();
+
+  BOOST_CHECK_EQUAL(failures.load(), 0);
+  BOOST_CHECK(c->getFont(res, 16*64).get(U'a') == face);
+
+  // without a limit nothing is removed any more
+  c->setBudget(0);
+  size_t faces = c->getStatistics().faces;
+  c->getFont(res, 50*64);
+  c->getFont(res, 51*64);
+  BOOST_CHECK_EQUAL(c->getStatistics().faces, faces + 2);
+}
+
+BOOST_AUTO_TEST_CASE( FreeType_Memory )
+{
+  auto lib = std::make_shared<STLL::FreeTypeLibrary_c>();
+
+  // the modules of the library are allocated through the allocator
+  auto start = lib->getMemoryStatistics();
+  BOOST_CHECK(start.bytes > 0);
+  BOOST_CHECK(start.allocations > 0);
+  BOOST_CHECK(start.peakBytes >= start.bytes);
+
+  size_t openedBytes;
+
+  {
+    STLL::FontCache_c c(lib);
+    auto f = c.getFont(STLL::FontResource_c("tests/FreeSans.ttf"), 16*64);
+
+    auto opened = lib->getMemoryStatistics();
+    openedBytes = opened.bytes;
+    BOOST_CHECK(opened.bytes > start.bytes);
+    BOOST_CHECK_EQUAL(c.getStatistics().freetypeBytes, opened.bytes);
+
+    // the cache counts the FreeType memory of the face and size it opened
+    BOOST_CHECK(c.getStatistics().bytes >= opened.bytes - start.bytes);
+
+    // rendering allocates and frees the same small blocks again and again
+    for (int r = 0; r < 2; r++)
+      for (STLL::glyphIndex_t g = 36; g < 62; g++)
+        f.get(U'a')->renderGlyph(g, STLL::SUBP_RGB);
+
+    auto rendered = lib->getMemoryStatistics();
+    BOOST_CHECK(rendered.allocations > opened.allocations);
+    BOOST_CHECK(rendered.poolHits > opened.poolHits);
+  }
+
+  // closing the fonts returns their memory
+  auto end = lib->getMemoryStatistics();
+  BOOST_CHECK(end.bytes < openedBytes);
+  BOOST_CHECK(end.pooledBytes > 0);
+}
+
+BOOST_AUTO_TEST_CASE( Hyphen_Dictionaries )
+{
+  std::string text((const char*)hyph_en_US);
+
+  std::istringstream in(text);
+  std::ostringstream out;
+  STLL::compileHyphenDictionary(in, out);
+
+  // aligned data is used in place and must stay valid as long as the dictionary is
+  // registered, that is until the program ends
+  static std::string compiled;
+  compiled = out.str();
+
+  // register the same dictionary in all possible ways, each one for its own language
+  STLL::addHyphenDictionary({"xt"}, std::istringstream(text));
+  STLL::addHyphenDictionary({"xc"}, compiled.data(), compiled.size());
+  STLL::addHyphenDictionary({"xs"}, std::istringstream(compiled));
+
+  {
+    std::ofstream f("hyphen_test.bin", std::ios::binary);
+    f << compiled;
+  }
+  STLL::addHyphenDictionaryFile({"xf"}, "hyphen_test.bin");
+  std::remove("hyphen_test.bin");
+
+  // unaligned data is copied
+  std::vector<char> unaligned(compiled.size()+1);
+  memcpy(unaligned.data()+1, compiled.data(), compiled.size());
+  STLL::addHyphenDictionary({"xu"}, unaligned.data()+1, compiled.size());
+  std::vector<char>().swap(unaligned);
+
+  BOOST_CHECK_THROW(STLL::addHyphenDictionary({"xb"}, compiled.data(), 16), std::runtime_error);
+  BOOST_CHECK_THROW(STLL::addHyphenDictionary({"xb"}, std::istringstream("garbage")), std::runtime_error);
+  BOOST_CHECK_THROW(STLL::addHyphenDictionaryFile({"xb"}, "tests/missing.bin"), std::runtime_error);
+
+  auto c = std::make_shared<STLL::FontCache_c>();
+  auto font = c->getFont(STLL::FontResource_c("tests/FreeSans.ttf"), 16*64);
+  STLL::LayoutProperties_c prop;
+
+  auto layout = [&font, &prop](const std::string & lang)
+  {
+    STLL::CodepointAttributes_c a;
+    a.c = STLL::Color_c(255, 255, 255);
+    a.lang = lang;
+    a.font = font;
+
+    return STLL::layoutParagraph(U"Hyphenation of extraordinarily complicated and incomprehensible words",
+                                 STLL::AttributeIndex_c(a), STLL::RectangleShape_c(100*64), prop);
+  };
+
+  // with a dictionary words get broken and hyphens added
+  auto ref = layout("xt");
+  BOOST_CHECK(ref.getData().size() > layout("xn").getData().size());
+
+  for (auto lang : { "xc", "xs", "xf", "xu" })
+  {
+    auto l = layout(lang);
+
+    BOOST_REQUIRE_EQUAL(l.getData().size(), ref.getData().size());
+    BOOST_CHECK_EQUAL(l.getHeight(), ref.getHeight());
+
+    for (size_t i = 0; i < l.getData().size(); i++)
+    {
+      BOOST_CHECK_EQUAL(l.getData()[i].x, ref.getData()[i].x);
+      BOOST_CHECK_EQUAL(l.getData()[i].y, ref.getData()[i].y);
+      BOOST_CHECK_EQUAL(l.getData()[i].glyphIndex, ref.getData()[i].glyphIndex);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( Attribute_Index )
+{
+  STLL::CodepointAttributes_c a, b, d;
+  a.lang = "en";
+  b.lang = "de";
+  d.lang = "fr";
+
+  STLL::AttributeIndex_c attr(d);
+
+  BOOST_CHECK(!attr.hasAttribute(0));
+  BOOST_CHECK(attr[100].lang == "fr");
+
+  // ranges include the end index
+  attr.set(0, 9, a);
+  attr.set(10, 19, b);
+  attr.set(20, 29, a);
+
+  BOOST_CHECK(attr[0].lang == "en");
+  BOOST_CHECK(attr[9].lang == "en");
+  BOOST_CHECK(attr[10].lang == "de");
+  BOOST_CHECK(attr[25].lang == "en");
+  BOOST_CHECK(attr.hasAttribute(29));
+  BOOST_CHECK(!attr.hasAttribute(30));
+  BOOST_CHECK(attr[30].lang == "fr");
+  BOOST_CHECK_EQUAL(attr.runCount(), 4);
+
+  // identical attributes are stored once, so neighbouring runs merge
+  attr.set(15, 19, a);
+  attr.set(10, 14, a);
+  BOOST_CHECK_EQUAL(attr.runCount(), 2);
+  BOOST_CHECK_EQUAL(attr.runEnd(attr.findRun(12)), 30);
+
+  // a single index in the middle splits the run
+  attr.set(5, b);
+  BOOST_CHECK(attr[4].lang == "en");
+  BOOST_CHECK(attr[5].lang == "de");
+  BOOST_CHECK(attr[6].lang == "en");
+  BOOST_CHECK_EQUAL(attr.runCount(), 4);
+
+  // replace indices 4 to 6 with 2 indices of b
+  attr.replace(4, 3, 2, STLL::AttributeIndex_c(b));
+  BOOST_CHECK(attr[3].lang == "en");
+  BOOST_CHECK(attr[4].lang == "de");
+  BOOST_CHECK(attr[5].lang == "de");
+  BOOST_CHECK(attr[6].lang == "en");
+  BOOST_CHECK(attr.hasAttribute(5));
+  BOOST_CHECK(attr.hasAttribute(28));
+  BOOST_CHECK(!attr.hasAttribute(29));
+  BOOST_CHECK_EQUAL(attr.runCount(), 4);
+
+  // the runs know the language atoms of their attributes
+  BOOST_CHECK_EQUAL(attr.runLanguage(attr.findRun(3)), attr.runLanguage(attr.findRun(6)));
+  BOOST_CHECK_EQUAL(attr.runLanguage(attr.findRun(4)), STLL::AttributeIndex_c(b).runLanguage(0));
+  BOOST_CHECK(attr.runLanguage(attr.findRun(3)) != attr.runLanguage(attr.findRun(4)));
+  BOOST_CHECK(attr.runLanguage(attr.findRun(3)) != attr.runLanguage(attr.findRun(30)));
+  BOOST_CHECK_EQUAL(STLL::AttributeIndex_c().runLanguage(0), 0);
+}
+
+BOOST_AUTO_TEST_CASE( Layout_Context )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+
+  STLL::CodepointAttributes_c a;
+  a.font = c->getFont(STLL::FontResource_c("tests/FreeSans.ttf"), 16*64);
+  a.c = STLL::Color_c(255, 255, 255);
+  a.lang = "en";
+
+  std::u32string txt = U"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor "
+                       U"incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam.";
+
+  STLL::AttributeIndex_c attr(a);
+  STLL::RectangleShape_c shape(200*64);
+  STLL::LayoutContext_c context;
+
+  for (bool optimize : { false, true })
+  {
+    STLL::LayoutProperties_c prop;
+    prop.optimizeLinebreaks = optimize;
+
+    // the context must not change the result
+    auto l = STLL::layoutParagraph(txt, attr, shape, prop, 0, context);
+    BOOST_CHECK(l == STLL::layoutParagraph(txt, attr, shape, prop, 0));
+
+    auto s = STLL::shapeParagraph(txt, attr, prop);
+    BOOST_CHECK(STLL::breakParagraph(s, shape, prop, 0, context) == l);
+
+    // once the context has seen the paragraph, layouting it again doesn't grow its buffers
+    STLL::layoutParagraph(txt, attr, shape, prop, 0, context);
+    auto before = context.getStatistics();
+
+    for (int i = 0; i < 5; i++)
+      BOOST_CHECK(STLL::layoutParagraph(txt, attr, shape, prop, 0, context) == l);
+
+    auto after = context.getStatistics();
+
+    BOOST_CHECK_EQUAL(after.paragraphs, before.paragraphs+5);
+    BOOST_CHECK_EQUAL(after.bufferGrowths, before.bufferGrowths);
+    BOOST_CHECK(after.arenaBytes > 0);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( Simple_Text )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+
+  STLL::CodepointAttributes_c a;
+  a.font = c->getFont(STLL::FontResource_c("tests/FreeSans.ttf"), 16*64);
+  a.c = STLL::Color_c(255, 255, 255);
+
+  STLL::AttributeIndex_c attr(a);
+  STLL::LayoutProperties_c prop;
+
+  // a shape so narrow, that every possible line break is taken
+  STLL::RectangleShape_c shape(1);
+
+  auto lines = [&](const std::u32string & txt)
+  {
+    return STLL::layoutParagraph(txt, attr, shape, prop).getHeight() /
+           STLL::layoutParagraph(U"x", attr, shape, prop).getHeight();
+  };
+
+  // simple ASCII text takes the table driven line breaking
+  BOOST_CHECK_EQUAL(lines(U"aaa bbb"), 2);
+  BOOST_CHECK_EQUAL(lines(U"aaa  bbb ccc"), 3);
+  BOOST_CHECK_EQUAL(lines(U"aaa.bbb"), 1);
+  BOOST_CHECK_EQUAL(lines(U"aaa, bbb"), 2);
+  BOOST_CHECK_EQUAL(lines(U"aaa!bbb"), 2);
+  BOOST_CHECK_EQUAL(lines(U"aaa7bbb"), 1);
+  BOOST_CHECK_EQUAL(lines(U"aaa\nbbb"), 2);
+
+  // the rest goes to liblinebreak
+  BOOST_CHECK_EQUAL(lines(U"aaa 1.5"), 2);
+  BOOST_CHECK_EQUAL(lines(U"aaa-bbb"), 2);
+  BOOST_CHECK_EQUAL(lines(U"\u00E4\u00E4\u00E4 bbb"), 2);
+
+  // without the shortcuts the layouts must be the same
+  STLL::LayoutProperties_c full;
+  full.simpleTextShortcuts = false;
+  STLL::RectangleShape_c wide(100*64);
+
+  for (std::u32string txt : { U"aaa bbb", U"aaa, bbb!ccc", U"Score: 12345 points", U"aaa\nbbb 7.5 ccc",
+                              U"Lorem ipsum dolor sit amet, consectetur adipiscing elit" })
+  {
+    BOOST_CHECK(STLL::layoutParagraph(txt, attr, shape, prop) == STLL::layoutParagraph(txt, attr, shape, full));
+    BOOST_CHECK(STLL::layoutParagraph(txt, attr, wide, prop) == STLL::layoutParagraph(txt, attr, wide, full));
+  }
+}
+
+BOOST_AUTO_TEST_CASE( Dynamic_Label )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+
+  STLL::CodepointAttributes_c a;
+  a.font = c->getFont(STLL::FontResource_c("tests/FreeSans.ttf"), 16*64);
+  a.c = STLL::Color_c(255, 255, 255);
+  a.lang = "en";
+
+  STLL::AttributeIndex_c attr(a);
+  auto shape = std::make_shared<STLL::RectangleShape_c>(200*64);
+
+  for (auto align : { STLL::LayoutProperties_c::ALG_LEFT, STLL::LayoutProperties_c::ALG_CENTER,
+                      STLL::LayoutProperties_c::ALG_RIGHT })
+  {
+    STLL::LayoutProperties_c prop;
+    prop.align = align;
+
+    STLL::DynamicLabel_c label(U"Total: ", U"12.50", U" EUR", attr, shape, prop, 64);
+
+    BOOST_CHECK(label.getLayout() == STLL::layoutParagraph(U"Total: 12.50 EUR", attr, *shape, prop, 64));
+
+    // the result must always be the same as a complete layout, also for values
+    // that don't fit into the line or contain characters that were not prepared
+    for (std::u32string v : { U"0.00", U"1234567.89", U"-3", U"n/a", U"", U"7",
+                              U"123456789012345678901234567890123456789012345678901234567890", U"42.42" })
+    {
+      auto l = label.update(v);
+
+      BOOST_CHECK(l == STLL::layoutParagraph(U"Total: " + v + U" EUR", attr, *shape, prop, 64));
+      BOOST_CHECK(label.getValue() == v);
+    }
+
+    BOOST_CHECK(label.getFastUpdates() > 0);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( Dynamic_Label_Context )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+
+  // the font replaces the 1 in "100" by another glyph, all pairs of the digits are
+  // shaped plainly, so only shaping the complete value shows the difference
+  STLL::CodepointAttributes_c a;
+  a.font = c->getFont(STLL::FontResource_c("tests/Contextual.ttf"), 16*64);
+  a.c = STLL::Color_c(255, 255, 255);
+  a.lang = "en";
+
+  STLL::AttributeIndex_c attr(a);
+  auto shape = std::make_shared<STLL::RectangleShape_c>(200*64);
+  STLL::LayoutProperties_c prop;
+
+  STLL::DynamicLabel_c label(U"12: ", U"5", U" .0", attr, shape, prop, 64);
+
+  STLL::LayoutStats_c stats;
+  label.setLayoutStats(&stats);
+
+  for (std::u32string v : { U"10", U"100", U"00", U"2100", U"1000", U"101", U"7", U"10.0", U"100" })
+  {
+    auto l = label.update(v);
+
+    BOOST_CHECK(l == STLL::layoutParagraph(U"12: " + v + U" .0", attr, *shape, prop, 64));
+  }
+
+  // the values were shaped to check them
+  BOOST_CHECK(label.getFastUpdates() > 0);
+  BOOST_CHECK(stats.shapeCalls > 0);
+}
+
+BOOST_AUTO_TEST_CASE( Dynamic_Label_Shaping )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+
+  // the font has no rules for the digits that go beyond pairs
+  STLL::CodepointAttributes_c a;
+  a.font = c->getFont(STLL::FontResource_c("tests/FreeSans.ttf"), 16*64);
+  a.c = STLL::Color_c(255, 255, 255);
+  a.lang = "en";
+
+  STLL::AttributeIndex_c attr(a);
+  auto shape = std::make_shared<STLL::RectangleShape_c>(200*64);
+  STLL::LayoutProperties_c prop;
+
+  STLL::DynamicLabel_c label(U"Time: ", U"0.00", U" s", attr, shape, prop, 64);
+
+  STLL::LayoutStats_c stats;
+  label.setLayoutStats(&stats);
+
+  std::vector<std::u32string> values;
+
+  for (int i = 1; i <= 100; i++)
+  {
+    std::string v = std::to_string(i*37 / 100) + "." + std::to_string(10 + i*37 % 90);
+    values.push_back(std::u32string(v.begin(), v.end()));
+    label.update(values.back());
+  }
+
+  // new values are placed without asking HarfBuzz or the shape cache
+  BOOST_CHECK_EQUAL(label.getFastUpdates(), 100u);
+  BOOST_CHECK_EQUAL(stats.shapeCalls, 0u);
+  BOOST_CHECK_EQUAL(stats.shapeCacheHits, 0u);
+
+  label.setLayoutStats(nullptr);
+  BOOST_CHECK(label.getLayout() == STLL::layoutParagraph(U"Time: " + values.back() + U" s", attr, *shape, prop, 64));
+}
+
+BOOST_AUTO_TEST_CASE( Measure_Paragraph )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+
+  STLL::CodepointAttributes_c a;
+  a.font = c->getFont(STLL::FontResource_c("tests/FreeSans.ttf"), 16*64);
+  a.c = STLL::Color_c(255, 255, 255);
+  a.lang = "en";
+  a.flags = STLL::CodepointAttributes_c::FL_UNDERLINE;
+  a.shadows.push_back(STLL::CodepointAttributes_c::Shadow_c{STLL::Color_c(0, 0, 0), 64, 64, 0});
+
+  std::u32string txt = U"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor "
+                       U"incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam.";
+
+  STLL::AttributeIndex_c attr(a);
+  STLL::RectangleShape_c shape(150*64);
+
+  for (auto align : { STLL::LayoutProperties_c::ALG_LEFT, STLL::LayoutProperties_c::ALG_JUSTIFY_LEFT })
+  {
+    STLL::LayoutProperties_c prop;
+    prop.align = align;
+
+    auto l = STLL::layoutParagraph(txt, attr, shape, prop, 10*64);
+    auto m = STLL::measureParagraph(txt, attr, shape, prop, 10*64);
+
+    BOOST_CHECK_EQUAL(m.height, l.getHeight());
+    BOOST_CHECK_EQUAL(m.firstBaseline, l.getFirstBaseline());
+    BOOST_CHECK_EQUAL(m.left, l.getLeft());
+    BOOST_CHECK_EQUAL(m.right, l.getRight());
+
+    BOOST_REQUIRE(m.lines.size() > 1);
+    BOOST_CHECK_EQUAL(m.lines.front().top, 10*64);
+    BOOST_CHECK_EQUAL(m.lines.back().bottom, (int32_t)m.height);
+    BOOST_CHECK(m.getWidth() <= 150*64);
+
+    for (size_t i = 0; i+1 < m.lines.size(); i++)
+    {
+      BOOST_CHECK_EQUAL(m.lines[i].bottom, m.lines[i+1].top);
+      BOOST_CHECK_EQUAL(m.lines[i].left, 0);
+
+      // justified lines reach the right edge, except for the last
+      if (align == STLL::LayoutProperties_c::ALG_JUSTIFY_LEFT)
+        BOOST_CHECK(m.lines[i].right >= 150*64-1);
+    }
+
+    // measuring the shaped paragraph gives the same
+    auto m2 = STLL::measureParagraph(STLL::shapeParagraph(txt, attr, prop), shape, prop, 10*64);
+
+    BOOST_CHECK_EQUAL(m2.height, m.height);
+    BOOST_REQUIRE_EQUAL(m2.lines.size(), m.lines.size());
+
+    for (size_t i = 0; i < m.lines.size(); i++)
+      BOOST_CHECK_EQUAL(m2.lines[i].right, m.lines[i].right);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( Content_Widths )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+
+  STLL::CodepointAttributes_c a;
+  a.font = c->getFont(STLL::FontResource_c("tests/FreeSans.ttf"), 16*64);
+  a.c = STLL::Color_c(255, 255, 255);
+  a.lang = "en";
+
+  std::u32string txt = U"Lorem ipsum dolor sit amet, consectetur adipiscing elit.";
+
+  STLL::AttributeIndex_c attr(a);
+
+  for (int32_t indent : { 0, 20*64 })
+  {
+    STLL::LayoutProperties_c prop;
+    prop.indent = indent;
+
+    auto shaped = STLL::shapeParagraph(txt, attr, prop);
+    auto w = STLL::getContentWidths(shaped, prop);
+
+    BOOST_CHECK(w.minContent > 0);
+    BOOST_CHECK(w.minContent < w.maxContent);
+
+    // the second call uses the stored values, the text version calculates the same
+    auto w2 = STLL::getContentWidths(shaped, prop);
+    auto w3 = STLL::getContentWidths(txt, attr, prop);
+
+    BOOST_CHECK_EQUAL(w2.minContent, w.minContent);
+    BOOST_CHECK_EQUAL(w2.maxContent, w.maxContent);
+    BOOST_CHECK_EQUAL(w3.minContent, w.minContent);
+    BOOST_CHECK_EQUAL(w3.maxContent, w.maxContent);
+
+    // the max-content width is the narrowest without a line break
+    BOOST_CHECK_EQUAL(STLL::measureParagraph(shaped, STLL::RectangleShape_c(w.maxContent), prop).lines.size(), 1);
+    BOOST_CHECK_EQUAL(STLL::measureParagraph(shaped, STLL::RectangleShape_c(w.maxContent-1), prop).lines.size(), 2);
+
+    // at the min-content width nothing overflows
+    auto m = STLL::measureParagraph(shaped, STLL::RectangleShape_c(w.minContent), prop);
+    BOOST_CHECK(m.lines.size() > 1);
+    for (const auto & l : m.lines)
+      BOOST_CHECK(l.right <= w.minContent);
+
+    // one less and the widest word overflows
+    auto m2 = STLL::measureParagraph(shaped, STLL::RectangleShape_c(w.minContent-1), prop);
+    bool overflow = false;
+    for (const auto & l : m2.lines)
+      if (l.right > w.minContent-1) overflow = true;
+    BOOST_CHECK(overflow);
+  }
+
+  // mandatory breaks limit the max-content width
+  STLL::LayoutProperties_c prop;
+  auto w1 = STLL::getContentWidths(U"Lorem ipsum dolor", attr, prop);
+  auto w2 = STLL::getContentWidths(U"Lorem ipsum dolor\nsit", attr, prop);
+  BOOST_CHECK_EQUAL(w1.maxContent, w2.maxContent);
+  BOOST_CHECK_EQUAL(w1.minContent, w2.minContent);
+}
+
+BOOST_AUTO_TEST_CASE( Paragraph_Parts )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+
+  STLL::CodepointAttributes_c a;
+  a.font = c->getFont(STLL::FontResource_c("tests/FreeSans.ttf"), 16*64);
+  a.c = STLL::Color_c(255, 255, 255);
+  a.lang = "en";
+
+  std::u32string txt = U"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor "
+                       U"incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud "
+                       U"exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat.";
+
+  STLL::AttributeIndex_c attr(a);
+  STLL::RectangleShape_c shape(150*64);
+  STLL::LayoutProperties_c prop;
+
+  auto shaped = STLL::shapeParagraph(txt, attr, prop);
+  auto full = STLL::breakParagraph(shaped, shape, prop, 10*64);
+  auto lines = STLL::measureParagraph(shaped, shape, prop, 10*64).lines.size();
+
+  BOOST_REQUIRE(lines > 4);
+
+  // limited by the number of lines
+  {
+    STLL::ParagraphContinuation_c cont(shaped, 10*64);
+    STLL::TextLayout_c l;
+    size_t parts = 0;
+
+    while (!cont.isFinished())
+    {
+      l.append(STLL::layoutParagraphPart(cont, shape, prop, 0, 2));
+      parts++;
+    }
+
+    BOOST_CHECK_EQUAL(parts, (lines+1)/2);
+    BOOST_CHECK_EQUAL(cont.getYPosition(), (int32_t)full.getHeight());
+    BOOST_CHECK(l == full);
+  }
+
+  // limited by the height, each part must stay within the limit
+  {
+    int32_t pageHeight = 3*full.getHeight()/lines;
+
+    STLL::ParagraphContinuation_c cont(shaped, 10*64);
+    STLL::TextLayout_c l;
+
+    while (!cont.isFinished())
+    {
+      int32_t y = cont.getYPosition();
+      auto p = STLL::layoutParagraphPart(cont, shape, prop, pageHeight);
+
+      BOOST_CHECK(!p.getData().empty());
+      BOOST_CHECK(cont.getYPosition() > y);
+      BOOST_CHECK(cont.getYPosition() <= y + pageHeight);
+      BOOST_CHECK_EQUAL(cont.getYPosition(), (int32_t)p.getHeight());
+
+      l.append(p);
+    }
+
+    BOOST_CHECK(l == full);
+  }
+
+  // a finished continuation gives empty layouts
+  STLL::ParagraphContinuation_c cont;
+  BOOST_CHECK(cont.isFinished());
+  BOOST_CHECK(STLL::layoutParagraphPart(cont, shape, prop, 0).getData().empty());
+}
+
+BOOST_AUTO_TEST_CASE( Max_Lines )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+
+  STLL::CodepointAttributes_c a;
+  a.font = c->getFont(STLL::FontResource_c("tests/FreeSans.ttf"), 16*64);
+  a.c = STLL::Color_c(255, 255, 255);
+  a.lang = "en";
+
+  std::u32string txt = U"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor "
+                       U"incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam. ";
+
+  STLL::AttributeIndex_c attr(a);
+  STLL::RectangleShape_c shape(150*64);
+
+  STLL::LayoutProperties_c prop;
+  prop.optimizeLinebreaks = false;
+
+  auto full = STLL::measureParagraph(txt, attr, shape, prop);
+  BOOST_REQUIRE(full.lines.size() > 3);
+
+  prop.maxLines = 2;
+
+  auto m = STLL::measureParagraph(txt, attr, shape, prop);
+  auto l = STLL::layoutParagraph(txt, attr, shape, prop);
+
+  BOOST_REQUIRE_EQUAL(m.lines.size(), 2);
+  BOOST_CHECK_EQUAL(m.height, l.getHeight());
+  BOOST_CHECK_EQUAL(m.lines[1].bottom, full.lines[1].bottom);
+
+  // the first line is not changed, the last one stays within the shape
+  BOOST_CHECK_EQUAL(m.lines[0].right, full.lines[0].right);
+  BOOST_CHECK(m.lines[1].right <= 150*64);
+
+  // the ellipsis is visible
+  prop.ellipsis = U"";
+  BOOST_CHECK(!(STLL::layoutParagraph(txt, attr, shape, prop) == l));
+  prop.ellipsis = U"\u2026";
+
+  // text behind the visible lines doesn't change anything
+  std::u32string longtxt;
+  for (int i = 0; i < 1000; i++) longtxt += txt;
+
+  BOOST_CHECK(STLL::layoutParagraph(longtxt, attr, shape, prop) == l);
+
+  // text that fits is not changed
+  auto unlimited = prop;
+  unlimited.maxLines = 0;
+  prop.maxLines = full.lines.size();
+  BOOST_CHECK(STLL::layoutParagraph(txt, attr, shape, prop) == STLL::layoutParagraph(txt, attr, shape, unlimited));
+
+  // lines longer than the first section, so that the text is handled in several sections
+  std::u32string midtxt;
+  for (int i = 0; i < 10; i++) midtxt += txt;
+
+  STLL::RectangleShape_c wide(2000*64);
+  auto wideLines = STLL::measureParagraph(midtxt, attr, wide, unlimited).lines.size();
+  BOOST_REQUIRE(wideLines > 2);
+
+  prop.maxLines = wideLines;
+  BOOST_CHECK(STLL::layoutParagraph(midtxt, attr, wide, prop) == STLL::layoutParagraph(midtxt, attr, wide, unlimited));
+}
+
+BOOST_AUTO_TEST_CASE( Layout_Stats )
+{
+  auto c = std::make_shared<STLL::FontCache_c>();
+
+  STLL::CodepointAttributes_c a;
+  a.font = c->getFont(STLL::FontResource_c("tests/FreeSans.ttf"), 16*64);
+  a.c = STLL::Color_c(255, 255, 255);
+  a.lang = "en";
+
+  std::u32string txt = U"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor "
+                       U"incididunt ut labore et dolore magna aliqua.";
+
+  STLL::AttributeIndex_c attr(a);
+  STLL::RectangleShape_c shape(150*64);
+  STLL::LayoutProperties_c prop;
+
+  STLL::LayoutContext_c context;
+  STLL::LayoutStats_c stats;
+
+  context.setLayoutStats(&stats);
+  auto l = STLL::layoutParagraph(txt, attr, shape, prop, 0, context);
+
+  BOOST_CHECK_EQUAL(stats.paragraphs, 1);
+  BOOST_CHECK(stats.runs > 20);
+  BOOST_CHECK(stats.glyphs >= txt.size()-20);
+  BOOST_CHECK(stats.shapeCalls + stats.shapeCacheHits > 0);
+  BOOST_CHECK(stats.candidatePairs > 0);
+  BOOST_CHECK(stats.shapingNs + stats.breakingNs + stats.outputNs > 0);
+
+  // the same text again finds all shaped text in the cache
+  stats.reset();
+  BOOST_CHECK(STLL::layoutParagraph(txt, attr, shape, prop, 0, context) == l);
+  BOOST_CHECK_EQUAL(stats.paragraphs, 1);
+  BOOST_CHECK_EQUAL(stats.shapeCalls, 0);
+
+  // the greedy line breaking doesn't evaluate candidates
+  stats.reset();
+  prop.optimizeLinebreaks = false;
+  STLL::measureParagraph(txt, attr, shape, prop, 0, context);
+  BOOST_CHECK_EQUAL(stats.candidatePairs, 0);
+  BOOST_CHECK(stats.runs > 20);
+
+  // detached statistics don't change
+  context.setLayoutStats(nullptr);
+  stats.reset();
+  STLL::layoutParagraph(txt, attr, shape, prop, 0, context);
+  BOOST_CHECK_EQUAL(stats.paragraphs, 0);
+  BOOST_CHECK_EQUAL(stats.runs, 0);
+}
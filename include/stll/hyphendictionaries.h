@@ -24,6 +24,7 @@
 
 #include <string>
 #include <istream>
+#include <ostream>
 #include <vector>
 
 /** \file
@@ -43,8 +44,8 @@ namespace STLL {
  *              for the language "en" and use "en-US" in your language tag
  *              it will use your hyphenation dictionary
  * \param str must point to an input stream of a hyphen dictionary, the file
- *            must be an UTF-8 encoded Open Office hyphen dictionary, nothing
- *            else is not supported
+ *            must be an UTF-8 encoded Open Office hyphen dictionary or a dictionary
+ *            compiled with compileHyphenDictionary, nothing else is not supported
  */
 void addHyphenDictionary(const std::vector<std::string> & langs, std::istream & str);
 
@@ -52,6 +53,42 @@ void addHyphenDictionary(const std::vector<std::string> & langs, std::istream &
  */
 void addHyphenDictionary(const std::vector<std::string> & langs, std::istream && str);
 
+/** \brief register a compiled hyphen dictionary that is already in memory
+ *
+ * The dictionary is used where it is, nothing is parsed or copied, so this is the
+ * fastest way to get a dictionary, e.g. with an array that was created by
+ * stll-hyphen-compiler and compiled into your program.
+ *
+ * \param langs the languages, see the other addHyphenDictionary function
+ * \param data the compiled dictionary, the memory must stay valid as long as
+ *             the dictionary is registered. When it is not aligned to 4 bytes
+ *             a copy is made
+ * \param size size of the data in bytes
+ */
+void addHyphenDictionary(const std::vector<std::string> & langs, const void * data, size_t size);
+
+/** \brief register a compiled hyphen dictionary from a file
+ *
+ * The file is mapped into memory and used in place, so only the pages
+ * that are really required during hyphenation will be read.
+ *
+ * \param langs the languages, see the other addHyphenDictionary function
+ * \param pathname name of the file that was created by compileHyphenDictionary
+ */
+void addHyphenDictionaryFile(const std::vector<std::string> & langs, const std::string & pathname);
+
+/** \brief compile a hyphen dictionary into the binary format
+ *
+ * The result can be loaded much faster than the text dictionary, see
+ * the addHyphenDictionary functions. The format depends on the byte order
+ * of the machine, so compile it on a machine of the same type as the one that
+ * uses the result.
+ *
+ * \param in the text dictionary, same as for addHyphenDictionary
+ * \param out the compiled dictionary is written into this stream
+ */
+void compileHyphenDictionary(std::istream & in, std::ostream & out);
+
 }
 
 #endif
\ No newline at end of file
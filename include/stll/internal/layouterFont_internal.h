@@ -75,6 +75,18 @@ class FontFileResource_c
     }
 };
 
+/** \brief map a font file read only into memory
+ *
+ * The result is a font resource for a font in RAM, the mapping is removed when the last copy of
+ * the data pointer is gone. The pages of the mapping are shared with all other processes that
+ * map or read the same file
+ *
+ * \param pathname the file to map
+ * \return the font resource with the mapped data, the description is the path
+ * \throw FreetypeException_c when the file can not be opened or mapped
+ */
+FontFileResource_c mapFontFile(const std::string & pathname);
+
 } }
 
 #endif
@@ -33,6 +33,8 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <unordered_map>
+#include <algorithm>
 
 #include <stdint.h>
 
@@ -392,7 +394,7 @@ class CodepointAttributes_c
   bool operator==(const CodepointAttributes_c & rhs) const
   {
     return c == rhs.c && font == rhs.font && lang == rhs.lang
-      && flags == rhs.flags && shadows.size() && rhs.shadows.size()
+      && flags == rhs.flags && shadows.size() == rhs.shadows.size()
       && std::equal(shadows.begin(), shadows.end(), rhs.shadows.begin())
       && inlay == rhs.inlay && baseline_shift == rhs.baseline_shift
       && link == rhs.link;
@@ -424,62 +426,72 @@ class CodepointAttributes_c
  *
  * This class behaves a bit like a vector of codepointAttributed in that you can
  * get an attribute for an index. The index is of type size_t
+ *
+ * Internally the index is stored as a list of runs of indices with the same attribute. Each
+ * distinct attribute is stored only once. Looking up an index takes logarithmic time
+ * in the number of runs, walking over the runs with the run functions is constant time per run.
  */
 class AttributeIndex_c
 {
   private:
-    // possible values that we can assign, the first attribute is used
+    // the distinct attributes, the first attribute is used
     // for all values that no specific attribute is assigned to
-    std::vector<CodepointAttributes_c> val;
-    // value asignment
-    std::vector<size_t> map;
+    std::vector<std::shared_ptr<const CodepointAttributes_c>> val;
 
-  public:
+    // the language atoms of the attributes in val, so that the layouter
+    // doesn't need to look up the language strings
+    std::vector<uint32_t> languages;
 
-    AttributeIndex_c(void)
+    // one run of indices with the same attribute, the run goes from start
+    // to the start of the next run, the last run covers everything behind it
+    class Run_c
     {
-      CodepointAttributes_c a;
-      val.emplace_back(std::move(a));
-    }
+      public:
+        size_t start;
+        uint32_t value;
+    };
+
+    // the runs, sorted by start, the first run always starts at 0
+    std::vector<Run_c> runs;
+
+    // hash of the attributes to their index in val, used to find
+    // identical attributes, the first attribute is not in here
+    std::unordered_multimap<size_t, uint32_t> interned;
+
+    // get the index in val for an attribute, adding it, when it is not yet there
+    uint32_t intern(const CodepointAttributes_c & a);
+
+    // set the indices from start to end (excluding) to the value v
+    void assign(size_t start, size_t end, uint32_t v);
+
+  public:
+
+    AttributeIndex_c(void) : AttributeIndex_c(CodepointAttributes_c()) { }
 
     /** \brief create an index where all entries have the same attribute
      *  \param a the attribute that all will share
      */
-    AttributeIndex_c(CodepointAttributes_c a)
-    {
-      val.emplace_back(a);
-    }
+    AttributeIndex_c(CodepointAttributes_c a);
 
     /** \brief set attributes for a single indices
      *  \param i index that will have the attribute
      *  \param a the attribute
      */
-    void set(size_t i, CodepointAttributes_c a)
+    void set(size_t i, const CodepointAttributes_c & a)
     {
-      size_t v = val.size();
-      val.emplace_back(a);
-
-      if (map.size() <= i) map.resize(i+1);
-
-      map[i] = v;
+      assign(i, i+1, intern(a));
     }
 
     /** \brief set attributes for a range of indices
      *  \param start first index that should have the attribute
-     *  \param end first index that will no longer have the attribute
+     *  \param end last index that will have the attribute
      *  \param a the attribute
      */
-    void set(size_t start, size_t end, CodepointAttributes_c a)
+    void set(size_t start, size_t end, const CodepointAttributes_c & a)
     {
-      size_t v = val.size();
-      val.emplace_back(a);
-
       if (start > end) std::swap(start, end);
 
-      if (map.size() <= end) map.resize(end+1);
-
-      for (size_t i = start; i <= end; i++)
-        map[i] = v;
+      assign(start, end+1, intern(a));
     }
 
     /** \brief get the attribute for given index
@@ -488,16 +500,56 @@ class AttributeIndex_c
      */
     const CodepointAttributes_c & operator[](size_t i) const
     {
-      if (i < map.size())
-        return val[map[i]];
-      else
-        return val[0];
+      return *val[runs[findRun(i)].value];
     }
 
     bool hasAttribute(size_t i) const
     {
-      return (i < map.size()) && (map[i] != 0);
+      return runs[findRun(i)].value != 0;
+    }
+
+    /** \brief replace a range of indices with the attributes of another index
+     *
+     * This is used to keep the attributes in sync with a text that is edited. All
+     * indices behind the replaced range are moved by inserted-removed.
+     *
+     *  \param start first index to replace
+     *  \param removed number of indices to remove at start
+     *  \param inserted number of indices to insert at start
+     *  \param a the attributes for the inserted indices, index 0 of a is for the index start
+     */
+    void replace(size_t start, size_t removed, size_t inserted, const AttributeIndex_c & a);
+
+    /** \name Functions to walk over the runs of indices with the same attribute
+     *  @{ */
+
+    /** \brief get the number of runs, the last run covers all indices behind its start */
+    size_t runCount(void) const { return runs.size(); }
+
+    /** \brief find the run that contains index i */
+    size_t findRun(size_t i) const
+    {
+      return std::upper_bound(runs.begin(), runs.end(), i,
+                              [](size_t p, const Run_c & r) { return p < r.start; }) - runs.begin() - 1;
     }
+
+    /** \brief get the first index of run r */
+    size_t runStart(size_t r) const { return runs[r].start; }
+
+    /** \brief get the first index behind run r, SIZE_MAX for the last run */
+    size_t runEnd(size_t r) const { return r+1 < runs.size() ? runs[r+1].start : SIZE_MAX; }
+
+    /** \brief get the attribute of run r */
+    const CodepointAttributes_c & runAttribute(size_t r) const { return *val[runs[r].value]; }
+
+    /** \brief check, if run r has an attribute assigned, see hasAttribute */
+    bool runHasAttribute(size_t r) const { return runs[r].value != 0; }
+
+    /** \brief get the language atom of the attribute of run r, the layouter uses
+     * these to compare languages, you normally don't need this
+     */
+    uint32_t runLanguage(size_t r) const { return languages[runs[r].value]; }
+    /** @} */
 };
 
 /** \brief base class to define the shape to layout text into
@@ -596,6 +648,10 @@ class LayoutProperties_c
      * The fast linebreak algorithm simply breaks a line as soon as the next part
      * doesn't fit onto the line. The optimizing algorithm tries to limit raggedness
      * of the lines and tries to avoid hyphenating words
+     *
+     * \note layoutParagraph and measureParagraph ignore this when maxLines is set, the
+     * optimizing algorithm needs the text up to the next forced line break, which would
+     * mean shaping text that is never shown
      */
     bool optimizeLinebreaks = true;
 
@@ -606,6 +662,39 @@ class LayoutProperties_c
      * The attribute must contain language information or no hyphenation will take place
      */
     bool hyphenate = true;
+
+    /** \brief use the shortcuts for simple text
+     *
+     * Left to right paragraphs with only characters in front of the hebrew block skip the
+     * bidi algorithm, text made of ASCII letters, digits, spaces and common punctuation gets
+     * its line breaks from a small table instead of libunibreak. The results are the same,
+     * switch this off to compare the time with the full algorithms, or when hunting bugs.
+     *
+     * \note there is no shortcut for shaping, the glyphs are always positioned by HarfBuzz,
+     * as the kerning and the other features of the fonts can not be reproduced exactly without it
+     */
+    bool simpleTextShortcuts = true;
+
+    /** \brief the maximal number of lines of the paragraph, 0 for no limit
+     *
+     * When the text needs more lines, the last line ends with the ellipsis. Runs at the
+     * end of that line are removed or shortened until the ellipsis fits. The text behind the
+     * last line is never shaped, so the time needed depends on the visible text only.
+     *
+     * The lines are always broken with the fast linebreak algorithm, optimizeLinebreaks is
+     * ignored, so the lines might differ from those of a layout without this limit.
+     *
+     * This is used by layoutParagraph and measureParagraph. The functions working with
+     * shaped paragraphs and IncrementalParagraph_c ignore it, as their text is already shaped.
+     */
+    uint32_t maxLines = 0;
+
+    /** \brief the text that ends the last line when the text is cut because of maxLines
+     *
+     * It uses the attributes of the last visible character and is placed at the end of the
+     * line in the direction of the paragraph. When empty the text is cut without any mark.
+     */
+    std::u32string ellipsis = U"\u2026";
 };
 
 // This exception gets thrown when layout paragraph encounters a runtime error (out of memory, ...)
@@ -644,6 +733,557 @@ class LayoutException_c : public std::runtime_error
 TextLayout_c layoutParagraph(const std::u32string & txt32, const AttributeIndex_c & attr,
                              const Shape_c & shape, const LayoutProperties_c & prop, int32_t ystart = 0);
 
+/** \brief one paragraph to layout with layoutParagraphs, the members are the
+ * arguments of layoutParagraph
+ */
+class ParagraphJob_c
+{
+  public:
+    std::u32string txt32;                  ///< the text to layout
+    AttributeIndex_c attr;                 ///< the attributes of the text
+    std::shared_ptr<const Shape_c> shape;  ///< the shape of the paragraph, must not be empty
+    LayoutProperties_c prop;               ///< the layout properties
+    int32_t ystart = 0;                    ///< the vertical starting point
+};
+
+/** \brief Layout many independent paragraphs in parallel.
+ *
+ * The paragraphs are distributed onto a pool of worker threads. The threads are kept
+ * for later calls, so that the fonts and shaping buffers they have set up can be reused.
+ * The fonts used in the jobs must be usable from several threads, which is the case for
+ * all fonts from a FontCache_c.
+ *
+ * The result is the same as calling layoutParagraph for each job one after the other.
+ *
+ * \param jobs the paragraphs to layout
+ * \param workers the number of threads to use, 0 uses one thread per processor core
+ * \return the layouts of the paragraphs in the order of the jobs
+ * \throw LayoutException_c or FreetypeException_c, when one of the paragraphs fails
+ */
+std::vector<TextLayout_c> layoutParagraphs(const std::vector<ParagraphJob_c> & jobs, unsigned int workers = 0);
+
+namespace internal { class ShapedParagraphData_c; }
+
+/** \brief a paragraph of text that is prepared for line breaking
+ *
+ * This contains the results of all the steps of paragraph layout that don't depend on
+ * the shape: bidi analysis, line break and hyphenation positions, font selection and shaping.
+ * Create it with shapeParagraph and then turn it into layouts for as many shapes as you like
+ * using breakParagraph, e.g. when the window size changes.
+ *
+ * The content can not be changed, so copies are cheap and share the data.
+ */
+class ShapedParagraph_c
+{
+  public:
+
+    /** \brief create an empty object, it can not be used for breakParagraph
+     */
+    ShapedParagraph_c(void) { }
+
+    /** \brief create from the internal data, you don't need this, use shapeParagraph
+     */
+    explicit ShapedParagraph_c(std::shared_ptr<const internal::ShapedParagraphData_c> d) : data(std::move(d)) { }
+
+    /** \brief get the internal data, you don't need this
+     */
+    const internal::ShapedParagraphData_c * getData(void) const { return data.get(); }
+
+    /** \brief check, if the object contains a shaped paragraph
+     */
+    explicit operator bool() const { return (bool)data; }
+
+  private:
+    std::shared_ptr<const internal::ShapedParagraphData_c> data;
+};
+
+/** \brief Do all the shape independent steps of layoutParagraph.
+ *
+ * Of the layout properties only ltr, underlineFont, links and hyphenate are used here. The
+ * others are only needed when calling breakParagraph.
+ *
+ * \param txt32 the utf-32 encoded text to layout, see layoutParagraph
+ * \param attr the attributes (colours, ...) for all the characters in the text
+ * \param prop the layout properties
+ * \return the shaped paragraph to hand to breakParagraph
+ */
+ShapedParagraph_c shapeParagraph(const std::u32string & txt32, const AttributeIndex_c & attr,
+                                 const LayoutProperties_c & prop);
+
+/** \brief Break a shaped paragraph into lines.
+ *
+ * breakParagraph(shapeParagraph(txt32, attr, prop), shape, prop, ystart) gives the same result
+ * as layoutParagraph(txt32, attr, shape, prop, ystart).
+ *
+ * Of the layout properties only align, indent and optimizeLinebreaks are used here.
+ *
+ * \param shaped the paragraph as returned by shapeParagraph
+ * \param shape the shape that the final result is supposed to have
+ * \param prop the layout properties
+ * \param ystart the vertical starting point (in 1/64th pixels) of your output
+ * \return the resulting layout
+ */
+TextLayout_c breakParagraph(const ShapedParagraph_c & shaped, const Shape_c & shape,
+                            const LayoutProperties_c & prop, int32_t ystart = 0);
+
+namespace internal { class LayoutContextData_c; }
+
+/** \brief statistics about the memory use of a layout context
+ */
+class LayoutContextStatistics_c
+{
+  public:
+    uint64_t paragraphs = 0;       ///< number of paragraphs layouted with the context
+    uint64_t bufferGrowths = 0;    ///< number of times the buffers of the context had to grow, when several
+                                   ///< buffers grow while layouting one paragraph, this counts as one. Only
+                                   ///< the memory of the context is counted, see LayoutContext_c
+    size_t arenaBytes = 0;         ///< size of the memory arena for the scratch data of a paragraph
+};
+
+/** \brief detailed numbers about the work done for the layout of paragraphs
+ *
+ * Attach an object of this class to a layout context with LayoutContext_c::setLayoutStats
+ * and all layouts done with that context add their numbers to it. Reset the object before a
+ * call to get the numbers of that call only. Without attached statistics nothing is measured.
+ *
+ * The object is used by the thread that uses the context, so don't read it while
+ * a layout is running.
+ */
+class LayoutStats_c
+{
+  public:
+
+    /** \name time spent in the phases of the layout, in nanoseconds
+     *  @{ */
+    uint64_t bidiNs = 0;          ///< finding the text direction with fribidi
+    uint64_t linebreakNs = 0;     ///< finding the possible line break positions
+    uint64_t hyphenationNs = 0;   ///< finding the hyphenation positions
+    uint64_t itemizeNs = 0;       ///< splitting the text into runs including the font fallback
+    uint64_t shapingNs = 0;       ///< shaping the runs, including the shape cache lookups
+    uint64_t runsNs = 0;          ///< creating the drawing commands of the runs
+    uint64_t breakingNs = 0;      ///< breaking the runs into lines
+    uint64_t outputNs = 0;        ///< placing the lines into the final layout or measuring them
+    /** @} */
+
+    uint64_t paragraphs = 0;          ///< number of layout calls
+    uint64_t runs = 0;                ///< number of runs created
+    uint64_t shapeCalls = 0;          ///< number of times harfbuzz was used to shape text
+    uint64_t shapeCacheHits = 0;      ///< number of times the shaped text was found in the shape cache
+    uint64_t glyphs = 0;              ///< number of glyphs in the created runs
+    uint64_t candidatePairs = 0;      ///< line start and end pairs that the optimizing line breaking evaluated
+    uint64_t hyphenationLookups = 0;  ///< number of words looked up in the hyphenation dictionaries
+    uint64_t contextGrowths = 0;      ///< growths of the layout context buffers, see LayoutContextStatistics_c
+
+    /** \brief set all values back to zero
+     */
+    void reset(void) { *this = LayoutStats_c(); }
+};
+
+/** \brief reusable memory for the layout of paragraphs
+ *
+ * Layouting a paragraph needs a lot of temporary data: embedding levels, line break
+ * positions, the runs with their drawing commands, the line breaking tables, ...
+ * Normally all this is allocated for each paragraph and freed afterwards. A layout context
+ * keeps this memory, so that the layout of similar paragraphs needs no heap allocations
+ * for the temporary data, once the context has seen a paragraph of that size. The memory
+ * is never given back, until the context is destroyed.
+ *
+ * Some memory still comes from the heap for each paragraph: the resulting layout, the
+ * glyphs of text that is not found in the shape cache and the attributes of the hyphens.
+ *
+ * A context can only be used by one thread at a time, the best is to keep one
+ * context per thread.
+ */
+class LayoutContext_c
+{
+  public:
+    LayoutContext_c(void);
+    ~LayoutContext_c(void);
+
+    LayoutContext_c(const LayoutContext_c &) = delete;
+    LayoutContext_c & operator=(const LayoutContext_c &) = delete;
+
+    /** \brief get the statistics of the context
+     */
+    LayoutContextStatistics_c getStatistics(void) const;
+
+    /** \brief attach the statistics that all following layouts with this context add their numbers to
+     *
+     * \param stats the statistics, they must stay valid until they are detached again
+     *              by a call with nullptr, which is the default
+     */
+    void setLayoutStats(LayoutStats_c * stats);
+
+    /** \brief get the internal data, you don't need this
+     */
+    internal::LayoutContextData_c & getData(void) { return *data; }
+
+  private:
+    std::unique_ptr<internal::LayoutContextData_c> data;
+};
+
+/** \brief layoutParagraph using the memory of a layout context for the temporary data
+ *
+ * The result is the same as with the function without context.
+ *
+ * \throw LayoutException_c when the context is used by another thread at the same time
+ */
+TextLayout_c layoutParagraph(const std::u32string & txt32, const AttributeIndex_c & attr,
+                             const Shape_c & shape, const LayoutProperties_c & prop, int32_t ystart,
+                             LayoutContext_c & context);
+
+/** \brief breakParagraph using the memory of a layout context for the temporary data
+ *
+ * The result is the same as with the function without context.
+ *
+ * \throw LayoutException_c when the context is used by another thread at the same time
+ */
+TextLayout_c breakParagraph(const ShapedParagraph_c & shaped, const Shape_c & shape,
+                            const LayoutProperties_c & prop, int32_t ystart, LayoutContext_c & context);
+
+/** \brief the size of a paragraph as returned by measureParagraph
+ *
+ * The values are the same as those of the TextLayout_c that layoutParagraph returns.
+ */
+class ParagraphMetrics_c
+{
+  public:
+
+    /** \brief the extents of one line, all values in 1/64th pixels
+     */
+    class Line_c
+    {
+      public:
+        int32_t top = 0;       ///< top of the line
+        int32_t bottom = 0;    ///< bottom of the line, top of the next line
+        int32_t baseline = 0;  ///< vertical position of the baseline
+        int32_t left = 0;      ///< where the text of the line starts
+        int32_t right = 0;     ///< where the text of the line ends
+    };
+
+    uint32_t height = 0;        ///< same as TextLayout_c::getHeight
+    int32_t firstBaseline = 0;  ///< same as TextLayout_c::getFirstBaseline
+    int32_t left = 0;           ///< same as TextLayout_c::getLeft
+    int32_t right = 0;          ///< same as TextLayout_c::getRight
+    std::vector<Line_c> lines;  ///< the lines of the paragraph from top to bottom
+
+    /** \brief the width of the widest line
+     */
+    int32_t getWidth(void) const
+    {
+      int32_t w = 0;
+      for (const auto & l : lines) w = std::max(w, l.right-l.left);
+      return w;
+    }
+};
+
+/** \brief Find out the size of a paragraph without creating the layout.
+ *
+ * This does all the steps of layoutParagraph except for creating the drawing commands,
+ * so it is faster, especially for text with shadows, underlines or links. Use it, when
+ * you only need to know the size of the paragraph, e.g. for sizing tables or lists.
+ *
+ * The parameters are the same as for layoutParagraph.
+ */
+ParagraphMetrics_c measureParagraph(const std::u32string & txt32, const AttributeIndex_c & attr,
+                                    const Shape_c & shape, const LayoutProperties_c & prop, int32_t ystart = 0);
+
+/** \brief measureParagraph using the memory of a layout context for the temporary data
+ */
+ParagraphMetrics_c measureParagraph(const std::u32string & txt32, const AttributeIndex_c & attr,
+                                    const Shape_c & shape, const LayoutProperties_c & prop, int32_t ystart,
+                                    LayoutContext_c & context);
+
+/** \brief Find out the size of a shaped paragraph, this only does the line breaking
+ *
+ * The parameters are the same as for breakParagraph.
+ */
+ParagraphMetrics_c measureParagraph(const ShapedParagraph_c & shaped, const Shape_c & shape,
+                                    const LayoutProperties_c & prop, int32_t ystart = 0);
+
+/** \brief the position where the layout of a paragraph that is laid out in parts continues
+ *
+ * Create it with a shaped paragraph and the vertical start position and then call
+ * layoutParagraphPart repeatedly until isFinished returns true. The object remembers where the
+ * last part stopped, so each call continues exactly at that point, this allows paging readers
+ * or displaying the start of a huge paragraph before the rest is laid out.
+ */
+class ParagraphContinuation_c
+{
+  public:
+
+    /** \brief create a continuation that is already finished
+     */
+    ParagraphContinuation_c(void) { }
+
+    /** \brief create a continuation that starts at the beginning of a paragraph
+     *
+     * \param shaped the shaped paragraph to layout
+     * \param ystart the vertical position of the first line
+     */
+    ParagraphContinuation_c(ShapedParagraph_c shaped, int32_t ystart = 0) :
+      shaped(std::move(shaped)), ypos(ystart) { }
+
+    /** \brief true, when all lines of the paragraph have been laid out
+     */
+    bool isFinished(void) const;
+
+    /** \brief the vertical position where the next part will start, after the
+     * last part this is the height of the whole paragraph
+     */
+    int32_t getYPosition(void) const { return ypos; }
+
+    /** \brief get the shaped paragraph that is laid out
+     */
+    const ShapedParagraph_c & getShaped(void) const { return shaped; }
+
+  private:
+    ShapedParagraph_c shaped;
+    size_t run = 0;
+    int32_t ypos = 0;
+
+    friend TextLayout_c layoutParagraphPart(ParagraphContinuation_c & cont, const Shape_c & shape,
+                                            const LayoutProperties_c & prop, int32_t maxHeight,
+                                            uint32_t maxLines);
+};
+
+/** \brief Layout the next lines of a paragraph, stopping when a limit is reached.
+ *
+ * The lines are created in the same way as breakParagraph would create them, so for the
+ * normal line breaking all parts together are identical to the layout of the whole paragraph
+ * and together they do the same work as one call to breakParagraph.
+ *
+ * Each part contains at least one line, even when that line is higher than allowed,
+ * so that each call makes progress.
+ *
+ * With the optimizing line breaking the paragraph can only be split at the mandatory line
+ * breaks, so a part may contain more lines or be higher than the limits allow.
+ *
+ * \param cont the continuation, it is updated to the position after the returned part
+ * \param shape the shape to layout into, the same for all parts
+ * \param prop the layout properties, the same for all parts
+ * \param maxHeight the maximal height of the part in 1/64th pixels, 0 for no limit
+ * \param maxLines the maximal number of lines in the part, 0 for no limit
+ * \return the layout of the lines of this part, its height is the vertical position
+ *         where the part ends, so parts can be appended without offset. When the
+ *         continuation is already finished an empty layout is returned
+ */
+TextLayout_c layoutParagraphPart(ParagraphContinuation_c & cont, const Shape_c & shape,
+                                 const LayoutProperties_c & prop, int32_t maxHeight,
+                                 uint32_t maxLines = 0);
+
+/** \brief the intrinsic widths of a paragraph as returned by getContentWidths, all values in 1/64th pixels
+ */
+class ContentWidths_c
+{
+  public:
+    int32_t minContent = 0;  ///< width of the widest part of the paragraph that can not be broken
+    int32_t maxContent = 0;  ///< width of the widest line when lines are only broken where the text requires it
+};
+
+/** \brief Find out the min-content and max-content width of a shaped paragraph.
+ *
+ * This is meant for auto sizing containers like table columns or shrink to fit boxes, it
+ * avoids laying the paragraph out at trial widths. The widths are calculated in one pass over
+ * the shaped runs without doing any line breaking:
+ * - the min-content width is the width of the widest section of the paragraph between two
+ *   possible line break positions, so if the paragraph was shaped with hyphenation the hyphen
+ *   positions are taken into account including the width of the visible hyphen
+ * - the max-content width is the width of the widest line, when the text is only broken at the
+ *   mandatory line breaks
+ *
+ * Laying out the paragraph into a rectangle of max-content width results in no additional line breaks,
+ * a rectangle of min-content width is the narrowest one without text overflowing the rectangle.
+ *
+ * The widths are stored within the shaped paragraph, so only the first call does the calculation,
+ * all later calls, also from other threads, are very cheap.
+ *
+ * \param shaped the shaped paragraph
+ * \param prop the layout properties, only the indent and the alignment are used, they should
+ *             be the same as for the breakParagraph call
+ * \return the widths, the indent of the first line is included in the values
+ * \throw LayoutException_c when the paragraph has not been shaped
+ */
+ContentWidths_c getContentWidths(const ShapedParagraph_c & shaped, const LayoutProperties_c & prop);
+
+/** \brief Find out the min-content and max-content width of a paragraph.
+ *
+ * This is the same as shaping the paragraph and calling getContentWidths for the result, but it
+ * doesn't create the drawing commands for the text. Use the version for shaped paragraphs
+ * when you need the widths several times or want to layout the paragraph afterwards.
+ */
+ContentWidths_c getContentWidths(const std::u32string & txt32, const AttributeIndex_c & attr,
+                                 const LayoutProperties_c & prop);
+
+namespace internal { class IncrementalParagraphData_c; }
+
+/** \brief a paragraph that is layouted again after small edits
+ *
+ * This is meant for text editors, where the paragraph changes a bit with every keystroke.
+ * The object keeps the text, the shaped runs and the lines of the last layout. When
+ * the text is edited, only the words around the edit are shaped again and the line
+ * breaking restarts at the first line that might change and stops as soon as the lines
+ * start at the same places as before.
+ *
+ * The result is always the same as calling layoutParagraph with the edited text.
+ *
+ * \note all calls to layout and edit of one object need to use the same shape, otherwise
+ * the lines that are taken over from the previous layout will be wrong
+ */
+class IncrementalParagraph_c
+{
+  public:
+
+    /** \brief create the paragraph, the parameters are the same as for shapeParagraph
+     */
+    IncrementalParagraph_c(const std::u32string & txt32, const AttributeIndex_c & attr,
+                           const LayoutProperties_c & prop);
+    ~IncrementalParagraph_c(void);
+
+    /** \brief layout the complete paragraph
+     *
+     * \param shape the shape that the final result is supposed to have
+     * \param ystart the vertical starting point (in 1/64th pixels) of your output
+     * \return the resulting layout
+     */
+    TextLayout_c layout(const Shape_c & shape, int32_t ystart = 0);
+
+    /** \brief change the text and layout the paragraph again
+     *
+     * \param offset position of the first character to remove
+     * \param removed number of characters to remove
+     * \param inserted the text to insert at offset
+     * \param attr the attributes of the inserted text, index 0 is for the first inserted character
+     * \param shape the shape that the final result is supposed to have, same as in the
+     *              previous calls
+     * \param ystart the vertical starting point (in 1/64th pixels) of your output
+     * \return the resulting layout
+     */
+    TextLayout_c edit(size_t offset, size_t removed, const std::u32string & inserted,
+                      const AttributeIndex_c & attr, const Shape_c & shape, int32_t ystart = 0);
+
+    /** \brief get the current text */
+    const std::u32string & getText(void) const;
+
+    /** \brief get the attributes of the current text */
+    const AttributeIndex_c & getAttributes(void) const;
+
+    /** \brief get the shaped paragraph of the current text, e.g. to
+     * break it for a different shape with breakParagraph
+     */
+    ShapedParagraph_c getShaped(void) const;
+
+  private:
+    std::unique_ptr<internal::IncrementalParagraphData_c> data;
+};
+
+namespace internal { class DynamicLabelData_c; }
+
+/** \brief a single line label with a value that changes often
+ *
+ * This is meant for counters, timers, prices and similar texts on dashboards that are
+ * drawn again many times per second. The label consists of a fixed text in front of and behind
+ * the value. The glyphs for a set of characters (digits, separators and signs) are prepared
+ * when the label is created, so when the value changes only the run of the value is
+ * created again from these glyphs and the line is put together again. There is no
+ * bidi analysis, line breaking or shaping on updates. Only when the font has rules for the
+ * prepared characters that span more than two of them, like contextual alternates, the
+ * value is shaped to check the glyphs.
+ *
+ * The result is always the same as calling layoutParagraph with the complete text. When
+ * this can not be guaranteed the complete text is layouted. This happens when
+ * - the value contains characters that are not in the prepared set, or that change their
+ *   shape depending on the neighbouring characters, e.g. with kerning, ligatures or
+ *   contextual alternates
+ * - the label doesn't fit into one line
+ * - the text is not left to right
+ * - the value is empty or the value is not separated from the fixed text by a space (or
+ *   the start and end of the text)
+ */
+class DynamicLabel_c
+{
+  public:
+
+    /** \brief create the label and layout it
+     *
+     * \param prefix the fixed text in front of the value
+     * \param value the initial value
+     * \param suffix the fixed text behind the value
+     * \param attr the attributes for the complete text, prefix + value + suffix, all values
+     *             use the attribute of the first character of the initial value
+     * \param shape the shape of the label
+     * \param prop the layout properties
+     * \param ystart the vertical starting point (in 1/64th pixels) of your output
+     * \param charset the characters to prepare glyphs for, spaces are never prepared
+     */
+    DynamicLabel_c(const std::u32string & prefix, const std::u32string & value, const std::u32string & suffix,
+                   const AttributeIndex_c & attr, std::shared_ptr<const Shape_c> shape,
+                   const LayoutProperties_c & prop, int32_t ystart = 0,
+                   const std::u32string & charset = U"0123456789.,:+-%");
+    ~DynamicLabel_c(void);
+
+    /** \brief change the value and return the new layout
+     */
+    TextLayout_c update(const std::u32string & value);
+
+    /** \brief get the layout of the current value
+     */
+    const TextLayout_c & getLayout(void) const;
+
+    /** \brief get the current value
+     */
+    const std::u32string & getValue(void) const;
+
+    /** \brief get the number of updates that were done without layouting the complete text
+     */
+    uint64_t getFastUpdates(void) const;
+
+    /** \brief attach the statistics that all following updates add their numbers to
+     *
+     * \param stats the statistics, they must stay valid until they are detached again
+     *              by a call with nullptr, which is the default
+     */
+    void setLayoutStats(LayoutStats_c * stats);
+
+  private:
+    std::unique_ptr<internal::DynamicLabelData_c> data;
+};
+
+/** \brief statistics about the cache of shaped text runs
+ *
+ * The layouter keeps the result of shaping text runs in a cache. This is
+ * especially helpful when the same words are used over and over again, or when
+ * the same paragraph is layouted for different widths.
+ */
+class ShapeCacheStatistics_c
+{
+  public:
+    uint64_t hits = 0;    ///< number of times a run was found in the cache
+    uint64_t misses = 0;  ///< number of times a run had to be shaped
+    size_t entries = 0;   ///< number of shaped runs currently in the cache
+    size_t bytes = 0;     ///< approximate memory used by the cache
+    size_t budget = 0;    ///< maximal memory the cache is allowed to use
+};
+
+/** \brief get the current statistics of the shape cache
+ */
+ShapeCacheStatistics_c getShapeCacheStatistics(void);
+
+/** \brief set the maximal amount of memory that the shape cache may use
+ *
+ * When the cache grows beyond this size the runs that have not been used the longest
+ * time are removed. The cache is split into several parts with their own locks, so that
+ * threads don't wait for each other, each part gets an equal share of the budget.
+ * Setting this to 0 disables the cache. The default is 4 MB.
+ *
+ * \param bytes the new budget in bytes
+ */
+void setShapeCacheBudget(size_t bytes);
+
+/** \brief remove all entries from the shape cache and reset the statistics
+ */
+void clearShapeCache(void);
+
 }
 
 #endif
@@ -41,8 +41,12 @@
 #include <stdexcept>
 
 struct FT_FaceRec_;
+struct FT_SizeRec_;
 struct FT_LibraryRec_;
 struct FT_GlyphSlotRec_;
+struct hb_font_t;
+struct hb_shape_plan_t;
+struct hb_segment_properties_t;
 
 namespace STLL {
 
@@ -75,6 +79,15 @@ class FreetypeException_c : public std::runtime_error
 
 class FreeTypeLibrary_c;
 
+namespace internal
+{
+  class FontFile_c;
+  class FontFaceData_c;
+  class FontInstance_c;
+  class FreeTypeLibraryData_c;
+  class FontCacheData_c;
+}
+
 /** \brief This class represents a font resource.
  *
  *  A font is a collection of several font files that together constitute of the font. If several
@@ -104,6 +117,20 @@ class FontResource_c
       resources.emplace_back(internal::FontFileResource_c(pathname));
     };
 
+    /** add another font to the resource: a file given its path, that is mapped into memory.
+     *
+     * The file is mapped read only right away. All faces, sizes and HarfBuzz fonts created from
+     * this resource and its copies use that one mapping, nothing is copied and the pages are shared
+     * with other processes using the same file. This is especially useful for big fonts, e.g. CJK fonts
+     *
+     * \param pathname File name of the file to use as font
+     * \throw FreetypeException_c when the file can not be mapped
+     */
+    void addMappedFont(const std::string & pathname)
+    {
+      resources.emplace_back(internal::mapFontFile(pathname));
+    }
+
     /** add another font to the resource: from memory.
      *
      * \param data is a pair containing a shared pointer to the data and the size of the data
@@ -141,6 +168,15 @@ class FontResource_c
 };
 
 /** \brief This class represents one font, made out of one font file resource with a certain size.
+ *
+ * A font face can be used from several threads at the same time. FreeType faces and the HarfBuzz
+ * structures on top of them can only be used by one thread at a time, so each thread that uses
+ * the font gets its own FreeType size object and HarfBuzz font. The FreeType faces are
+ * shared between all sizes of the same font file: each thread opens the file only once and each
+ * size of the font is a FT_Size object on that face. All HarfBuzz fonts of a font file use
+ * the same HarfBuzz face, so its tables and shape plans exist only once. The instance of a
+ * thread and its FreeType face are released when the thread ends or the font face is destroyed,
+ * whatever happens first.
  */
 class FontFace_c : boost::noncopyable
 {
@@ -158,14 +194,28 @@ class FontFace_c : boost::noncopyable
         GlyphSlot_c(int width, int height) : w(width), h(height), top(0), left(0), pitch(0), data(0) {}
     };
 
+    /** \brief create a font face with its own font file
+     */
     FontFace_c(std::shared_ptr<FreeTypeLibrary_c> l, const internal::FontFileResource_c & r, uint32_t size);
+
+    /** \brief create a font face for one size of an already opened font file
+     *
+     * \param file the opened font file
+     * \param r the resource the font file was opened from
+     * \param size the requested size
+     */
+    FontFace_c(std::shared_ptr<internal::FontFile_c> file, const internal::FontFileResource_c & r, uint32_t size);
     ~FontFace_c();
 
     /** \brief Get the FreeType structure for this font
      *
      * This is required for example for harfbuzz. You normally don't need this when using STLL
+     *
+     * \note the returned face belongs to the calling thread, don't hand it to other threads
+     * \note the face is shared with the other sizes of the font file, the size of this font
+     * is only active until the next call to a function of another size
      */
-    FT_FaceRec_ * getFace(void) const { return f; }
+    FT_FaceRec_ * getFace(void) const;
 
     /** \name Functions to get font metrics
      *  @{ */
@@ -209,22 +259,83 @@ class FontFace_c : boost::noncopyable
      * \param sp the requested sub-pixel arrangement to apply to the rendering
      * \return a pointer to the FreeType glyph slot record, see FreeType documentation
      * \note glyphs are always rendered unhinted 8-bit FreeType bitmaps
+     * \note the returned slot stays valid until the calling thread renders the next glyph of this font
      */
     GlyphSlot_c renderGlyph(glyphIndex_t glyphIndex, SubPixelArrangement sp);
 
     /** \brief check if a given character is available within this font
+     *
+     * The check uses a bitmap of the character map that is created together with the font face.
+     *
      * \param ch the unicode character to check
      * \return true, when the character is available within the font, false otherwise
      */
-    bool containsGlyph(char32_t ch);
+    bool containsGlyph(char32_t ch) const
+    {
+      if (ch >= 0x110000) return false;
+
+      const uint64_t * b = coverage + 4*coverageIndex[ch >> 8];
+      return (b[(ch >> 6) & 3] >> (ch & 63)) & 1;
+    }
+
+    /** \brief Get the HarfBuzz font structure for this font
+     *
+     * The structure is created on first use and kept as long as this font face exists. You
+     * normally don't need this when using STLL
+     *
+     * \note the returned font belongs to the calling thread, don't hand it to other threads
+     */
+    hb_font_t * getHarfbuzzFont(void);
+
+    /** \brief Get a HarfBuzz shape plan for this font
+     *
+     * Plans are created on first use for each combination of script, language and direction
+     * and kept as long as this font face exists. You normally don't need this when using STLL
+     *
+     * \param props the segment properties of the text that is supposed to be shaped
+     * \note the returned plan belongs to the calling thread, don't hand it to other threads
+     */
+    hb_shape_plan_t * getShapePlan(const hb_segment_properties_t & props);
+
+    /** \brief get the approximate memory used by this font face
+     *
+     * This contains the FreeType sizes and HarfBuzz fonts of all threads that used the font face,
+     * but not the font file, the FreeType faces and the shape plans, these belong to the font file.
+     * You normally don't need this when using STLL
+     */
+    size_t getMemoryUsage(void) const;
 
   private:
-    FT_FaceRec_ *f;
-    std::shared_ptr<FreeTypeLibrary_c> lib;
+
+    // get the FreeType size and HarfBuzz structures of the calling thread, they are created
+    // when necessary
+    internal::FontInstance_c & getInstance(void) const;
+
+    // get the instance of the calling thread and make its size the active one of the face
+    internal::FontInstance_c & activate(void) const;
+
+    std::shared_ptr<internal::FontFile_c> file;
     internal::FontFileResource_c rec;
     uint32_t size;
+
+    // the metrics of this size
+    uint32_t height;
+    int32_t ascender, descender;
+    int32_t underlinePosition, underlineThickness;
+
+    // the instances of all threads that use this font face
+    std::shared_ptr<internal::FontFaceData_c> data;
+
+    // the characters in the character map of the font as a two level bitmap, the index
+    // contains one entry per 256 codepoints pointing to the 4 words of the bitmap of those
+    // codepoints, all blocks without any character point to the empty bitmap at index 0,
+    // the bitmaps belong to the font file
+    const uint16_t * coverageIndex;
+    const uint64_t * coverage;
 };
 
+namespace internal { class FontFallbackMemo_c; }
+
 /** \brief contains all the FontFaces_c of one FontRessource_c
  *
  * You usually don't create this class, it is greated for you by FontCache_c::getFont
@@ -236,15 +347,21 @@ class Font_c
     Font_c(void) {}
 
     /** add a font face to the font */
-    void add(std::shared_ptr<FontFace_c> f) { fonts.emplace_back(std::move(f)); }
+    void add(std::shared_ptr<FontFace_c> f);
 
     /** iterators for for loops */
     auto begin(void) const { return fonts.begin(); }
     auto end(void) const { return fonts.end(); }
 
     /** \brief find the fontface that contains the codepoint
+     *
+     * The result is remembered, so that the next request for the same codepoint
+     * doesn't need to check the font faces again
+     *
+     * \return the first face containing the codepoint, the first face, when none contains
+     * it, or an empty pointer, when the font has no faces
      */
-    std::shared_ptr<FontFace_c> get(char32_t codepoint) const;
+    const std::shared_ptr<FontFace_c> & get(char32_t codepoint) const;
 
     // some functions that get metrics of this font, they are always taken from the
     // first font face in the font
@@ -262,9 +379,29 @@ class Font_c
 
   private:
     std::vector<std::shared_ptr<FontFace_c>> fonts;
+
+    // the remembered results of get, shared between copies of this font
+    std::shared_ptr<internal::FontFallbackMemo_c> memo;
+};
+
+/** \brief statistics of the memory used by a FreeType library instance, see
+ * FreeTypeLibrary_c::getMemoryStatistics
+ */
+class FreeTypeMemoryStatistics_c
+{
+  public:
+    size_t bytes = 0;          ///< bytes currently allocated by FreeType
+    size_t peakBytes = 0;      ///< the largest value of bytes since the library was created
+    size_t pooledBytes = 0;    ///< bytes of freed small blocks that are kept for reuse
+    uint64_t allocations = 0;  ///< number of allocations done by FreeType
+    uint64_t poolHits = 0;     ///< number of allocations that reused a block from the pool
 };
 
 /** \brief This class encapsulates an instance of the FreeType library
+ *
+ * All memory of the library is allocated through an allocator of STLL. It keeps freed small blocks
+ * in a pool for reuse, as FreeType allocates and frees many small blocks while rendering
+ * glyphs, and it counts the memory used by the library.
  *
  * The class exposes the functions of the FreeType library instance that are
  * required by STLL. You normally don't need to use this interface at all.
@@ -285,8 +422,11 @@ class FreeTypeLibrary_c : boost::noncopyable
      *
      * Usually you don't use this function directly but you use the FontFace_c class
      *
+     * This function and doneFace may be called from several threads at the same time
+     *
      * \param res The resource to use to create the font
-     * \param size The requested font size
+     * \param size The requested font size, 0 to keep the default size of the face, e.g. when
+     *             the sizes are created later on as FT_Size objects
      * \return The FT_Face value
      */
     FT_FaceRec_ * newFace(const internal::FontFileResource_c & r, uint32_t size);
@@ -299,13 +439,43 @@ class FreeTypeLibrary_c : boost::noncopyable
      */
     void doneFace(FT_FaceRec_ * f);
 
+    /** \brief get the current memory statistics of the library
+     */
+    FreeTypeMemoryStatistics_c getMemoryStatistics(void) const;
+
   private:
 
+    // the allocator and the lock for creating and destroying faces
+    std::unique_ptr<internal::FreeTypeLibraryData_c> data;
+
     FT_LibraryRec_ *lib;
 };
 
+/** \brief statistics of a font cache, see FontCache_c::getStatistics
+ */
+class FontCacheStatistics_c
+{
+  public:
+    uint64_t hits = 0;       ///< number of times a font face was found in the cache
+    uint64_t misses = 0;     ///< number of times a font face had to be created
+    uint64_t evictions = 0;  ///< number of unused font faces removed to stay within the budget
+    size_t faces = 0;        ///< number of font faces currently in the cache
+    size_t bytes = 0;        ///< memory used by the font faces in the cache and their font files, without the font data
+    size_t budget = 0;       ///< maximal memory the cache is allowed to use, 0 for no limit
+    size_t freetypeBytes = 0;  ///< memory currently allocated by the FreeType library of the cache
+};
+
 /** \brief this class encapsulates open fonts of a single library, it makes
  *  sure that each font is open only once
+ *
+ * The cache and the fonts it returns can be used from several threads at the same time. The
+ * fonts are distributed onto several shards by their font file, each with its own lock, so
+ * that threads asking for different fonts don't wait for each other.
+ *
+ * The cache can be given a memory budget. When it is exceeded, the font faces that have not
+ * been asked for the longest time are removed from the cache. Only faces that are not used
+ * anywhere else, e.g. in a Font_c or a layout, are removed, so the cache may stay above the
+ * budget, when all fonts are in use.
  */
 class FontCache_c
 {
@@ -316,20 +486,23 @@ class FontCache_c
      * I am not really sure where is might be useful to use multiple caches on one
      * library... though
      */
-    FontCache_c(std::shared_ptr<FreeTypeLibrary_c> l) : lib(l) {}
+    FontCache_c(std::shared_ptr<FreeTypeLibrary_c> l);
 
     /** \brief Create a cache using an instance of the FreeType library that is created
      * specifically for this cache instance
      *
-     * This is usually the thing you need, create one instance of this
-     * class per thread of your application that needs to access the library
+     * This is usually the thing you need, all threads of your application can
+     * share the instance
      */
-    FontCache_c(void) : lib(std::make_shared<FreeTypeLibrary_c>()) {}
+    FontCache_c(void);
+
+    ~FontCache_c();
 
     /** \brief Get a font face from this cache with the given resource and size.
      *
      * If there is already one instance of this font open, it will be used
-     * otherwise a new one will be opened.
+     * otherwise a new one will be opened. All sizes of a font file share the
+     * opened file, so asking for a new size of a known font is cheap.
      *
      * \param res The resource to use to create the font instance
      * \param idx the index, which font do we want to get from the ressource
@@ -343,44 +516,28 @@ class FontCache_c
     /** \brief remove all fonts from the cache, fonts that are still in use will be kept, but all others
      * are removed
      */
-    void clear(void)
-    {
-      for(auto it = fonts.begin(); it != fonts.end(); )
-      {
-        if(it->second.use_count() == 1)
-        {
-          it = fonts.erase(it);
-        }
-        else
-        {
-          ++it;
-        }
-      }
-    }
-
-  private:
-
-    class FontFaceParameter_c
-    {
-      public:
-        internal::FontFileResource_c res;
-        uint32_t size;
+    void clear(void);
 
-        FontFaceParameter_c(const internal::FontFileResource_c r, uint32_t s) : res(std::move(r)), size(s) {}
+    /** \brief set the maximal amount of memory that the fonts in the cache may use
+     *
+     * The memory of a font contains the FreeType faces and sizes, as measured when they were created,
+     * and an estimate for the HarfBuzz structures of the font and its font file. The font data itself,
+     * that is the mapped file or the buffer of the application, is not counted, neither is the memory
+     * FreeType keeps after loading glyphs, e.g. for the autohinter, see FreeTypeLibrary_c for that.
+     * The default is 0, which means no limit.
+     *
+     * \param bytes the new budget in bytes
+     */
+    void setBudget(size_t bytes);
 
-        bool operator<(const FontFaceParameter_c & b) const
-        {
-          if (res < b.res) return true;
-          if (b.res < res) return false;
+    /** \brief get the current statistics of the cache
+     */
+    FontCacheStatistics_c getStatistics(void);
 
-          if (size < b.size) return true;
-          return false;
-        }
-    };
+  private:
 
-    // all open fonts, used to check whether they have all been released
-    // on library destruction
-    std::map<FontFaceParameter_c, std::shared_ptr<FontFace_c> > fonts;
+    // the shards with the fonts and the memory accounting
+    std::unique_ptr<internal::FontCacheData_c> data;
 
     // the library to use
     std::shared_ptr<FreeTypeLibrary_c> lib;
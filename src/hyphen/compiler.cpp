@@ -0,0 +1,111 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+// compiles hyphen dictionaries into the binary format that STLL can use
+// without parsing, see addHyphenDictionary and addHyphenDictionaryFile
+
+#include "hyphen.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+
+using namespace STLL::internal;
+
+static void help()
+{
+  fprintf(stderr, "correct syntax is:\n");
+  fprintf(stderr, "stll-hyphen-compiler [-c name] hyphen_dictionary_file output_file\n");
+  fprintf(stderr, "  -c name: write a C header with an array of the given name instead of the binary file\n");
+}
+
+int main(int argc, char ** argv)
+{
+  std::string name;
+  int arg = 1;
+
+  if (arg + 1 < argc && std::string(argv[arg]) == "-c")
+  {
+    name = argv[arg+1];
+    arg += 2;
+  }
+
+  if (arg + 2 != argc)
+  {
+    help();
+    return 1;
+  }
+
+  std::ifstream in(argv[arg]);
+  if (!in)
+  {
+    fprintf(stderr, "Couldn't find file %s\n", argv[arg]);
+    return 1;
+  }
+
+  std::vector<uint32_t> data;
+
+  try
+  {
+    data = HyphenDict<char32_t>::compile(in);
+  }
+  catch (std::exception & e)
+  {
+    fprintf(stderr, "Error compiling %s: %s\n", argv[arg], e.what());
+    return 1;
+  }
+
+  const uint8_t * bytes = reinterpret_cast<const uint8_t*>(data.data());
+  size_t size = data.size() * sizeof(uint32_t);
+
+  std::ofstream out(argv[arg+1], std::ios::binary);
+
+  if (name.empty())
+  {
+    out.write(reinterpret_cast<const char*>(bytes), size);
+  }
+  else
+  {
+    // the array must be aligned, so that the dictionary can be used in place
+    out << "alignas(4) unsigned char " << name << "[] = {";
+
+    char buf[8];
+
+    for (size_t i = 0; i < size; i++)
+    {
+      snprintf(buf, sizeof(buf), "0x%02x", bytes[i]);
+      out << ((i % 12 == 0) ? "\n  " : " ") << buf << ((i + 1 < size) ? "," : "");
+    }
+
+    out << "\n};\nunsigned int " << name << "_len = " << size << ";\n";
+  }
+
+  if (!out)
+  {
+    fprintf(stderr, "Error writing %s\n", argv[arg+1]);
+    return 1;
+  }
+
+  return 0;
+}
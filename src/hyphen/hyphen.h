@@ -85,6 +85,9 @@
 #include <utility>
 #include <stll/utf-8.h>
 #include <stdexcept>
+#include <type_traits>
+#include <cstring>
+#include <stdint.h>
 
 namespace STLL { namespace internal {
 
@@ -112,7 +115,7 @@ struct constants<char>
 
   bool getline(std::istream & f, std::string & line) const
   {
-    return std::getline(f, line);
+    return static_cast<bool>(std::getline(f, line));
   }
 
   int stoi(const std::string & t) const
@@ -146,7 +149,7 @@ struct constants<char32_t>
   bool getline(std::istream & f, std::u32string & line) const
   {
     std::string temp;
-    bool result = std::getline(f, temp);
+    bool result = static_cast<bool>(std::getline(f, temp));
     line = STLL::u8_convertToU32(temp);
     return result;
   }
@@ -274,6 +277,12 @@ class casefolding
           lowcase[i] = i+startindex;
     }
 
+    // create the folding from a ready table, as it is stored in compiled dictionaries
+    casefolding(char32_t start, std::vector<char32_t> table) : lowcase(std::move(table)), startindex(start) {}
+
+    char32_t getStart(void) const { return startindex; }
+    const std::vector<char32_t> & getTable(void) const { return lowcase; }
+
     std::basic_string<C> fold(const std::basic_string<C> & in) const
     {
       size_t pos = 0;
@@ -297,6 +306,23 @@ class casefolding
 };
 
 // supported values for C: char and char32_t
+//
+// The dictionary is always used in a flat form: an array of 32 bit words that contains
+// no pointers, only offsets. Text dictionaries are compiled into this form while loading,
+// compiled dictionaries can be used directly where they are, e.g. in a mapped file or in
+// an array that was embedded into the program
+//
+// The layout of the compiled form, all offsets are in words from the start of the data:
+// - header: magic, version, size of the code units, size in words, number of levels,
+//   offset of each level. The 2nd level is the nextlevel of the first
+// - level: see FlatLevel, the states are sorted by the length of their string, so fallback
+//   states always come before the states that fall back to them
+// - state: see FlatState
+// - transition: character and new state, the transitions of a state are sorted by character
+// - match: one byte per entry, 4 of them packed into one word
+// - characters: one code unit per word, used by the replacements and the nohyphen strings
+// - replacement and nohyphen: index of the first character and length
+// - case folding: the lower case character for each character starting at casefoldStart
 template <class C>
 class HyphenDict
 {
@@ -315,6 +341,85 @@ class HyphenDict
 
     const constants<C> con;
 
+    enum
+    {
+      FLAT_MAGIC = 0x59485453,  // "STHY" when stored little endian
+      FLAT_VERSION = 1,
+      FLAT_MAX_LEVELS = 2
+    };
+
+    struct FlatHeader
+    {
+      uint32_t magic;
+      uint32_t version;
+      uint32_t codeUnit;
+      uint32_t size;
+      uint32_t levelCount;
+      uint32_t levels[FLAT_MAX_LEVELS];
+    };
+
+    struct FlatLevel
+    {
+      uint32_t lhmin, rhmin, clhmin, crhmin;
+      uint32_t stateCount, states;
+      uint32_t transCount, trans;
+      uint32_t matchCount, match;
+      uint32_t charCount, chars;
+      uint32_t replCount, repl;
+      uint32_t nohyphenCount, nohyphen;
+      uint32_t casefoldStart, casefoldCount, casefold;
+    };
+
+    struct FlatState
+    {
+      uint32_t trans;       // first transition
+      uint32_t transCount;
+      uint32_t fallback;    // fallback state + 1, 0 when there is none
+      uint32_t match;       // first match byte
+      uint32_t matchLength;
+      uint32_t repl;        // replacement + 1, 0 when there is none
+      uint32_t replInfo;    // replindex (signed) in the lowest byte, replcut in the next
+    };
+
+    struct FlatTrans
+    {
+      uint32_t ch;
+      uint32_t newState;
+    };
+
+    // the code units are stored as unsigned values, so that utf-8 bytes sort and
+    // compare the same way in all places
+    static uint32_t unit(C c)
+    {
+      return static_cast<typename std::make_unsigned<C>::type>(c);
+    }
+
+    template <class T>
+    static void append(std::vector<uint32_t> & out, const T & v)
+    {
+      static_assert(sizeof(T) % sizeof(uint32_t) == 0, "flat structures must consist of words");
+      size_t s = out.size();
+      out.resize(s + sizeof(T)/sizeof(uint32_t));
+      memcpy(out.data() + s, &v, sizeof(T));
+    }
+
+    static void check(bool ok)
+    {
+      if (!ok)
+      {
+        throw std::runtime_error("Compiled hyphen dictionary is broken");
+      }
+    }
+
+    // check that a table of count entries of the given number of words
+    // at the given offset is completely inside of size words
+    static void checkTable(uint32_t offset, uint64_t count, uint64_t words, size_t size)
+    {
+      check(offset <= size && count * words <= size - offset);
+    }
+
+    // the structures that are used while loading text dictionaries, they
+    // are converted into the flat form afterwards
     struct HyphenTrans
     {
       HyphenTrans(C c, int n) : new_state(n), ch(c) {}
@@ -329,27 +434,14 @@ class HyphenDict
       std::vector<HyphenTrans> trans;
       string repl;
       int fallback_state = -1;
-      uint8_t replindex = 0;
+      int8_t replindex = 0;
       uint8_t replcut = 0;
     };
 
-    /* user options */
-    int lhmin = 0;    /* lefthyphenmin: min. hyph. distance from the left side */
-    int rhmin = 0;    /* righthyphenmin: min. hyph. distance from the right side */
-    int clhmin = 0;   /* min. hyph. distance from the left compound boundary */
-    int crhmin = 0;   /* min. hyph. distance from the right compound boundary */
-    std::vector<string> nohyphen; /* comma separated list of characters or character sequences with forbidden hyphenation */
-
-    /* system variables */
-    std::vector<HyphenState> states;
-    std::unique_ptr<HyphenDict> nextlevel;
-
-    std::unique_ptr<casefolding<C>> casefold;
-
     typedef std::map<string, int> HashTab;
 
     /* return val if found, otherwise -1 */
-    int hash_lookup (const HashTab & hashtab, const string & key)
+    static int hash_lookup (const HashTab & hashtab, const string & key)
     {
       auto a = hashtab.find(key);
 
@@ -359,174 +451,428 @@ class HyphenDict
       return -1;
     }
 
-    /* Get the state number, allocating a new state if necessary. */
-    int get_state (HashTab & hashtab, const string & string)
+    // one level of a text dictionary while it is loaded
+    class Builder
     {
-      int state_num = hash_lookup (hashtab, string);
+      public:
 
-      if (state_num >= 0)
-        return state_num;
+        const constants<C> con;
 
-      hashtab.insert(std::make_pair(string, states.size()));
+        /* user options */
+        int lhmin = 0;    /* lefthyphenmin: min. hyph. distance from the left side */
+        int rhmin = 0;    /* righthyphenmin: min. hyph. distance from the right side */
+        int clhmin = 0;   /* min. hyph. distance from the left compound boundary */
+        int crhmin = 0;   /* min. hyph. distance from the right compound boundary */
+        std::vector<string> nohyphen; /* comma separated list of characters or character sequences with forbidden hyphenation */
 
-      states.push_back(HyphenState());
+        /* system variables */
+        std::vector<HyphenState> states;
+        HashTab hashtab;
 
-      return states.size()-1;
-    }
+        std::unique_ptr<casefolding<C>> casefold;
 
-    void load_line(const string & buf2, HashTab & hashtab)
-    {
-      if (buf2.compare(0, 13, con.lefthyphenmin) == 0)
-      {
-        lhmin = con.stoi(buf2.substr(13));
-      }
-      else if (buf2.compare(0, 14, con.righthyphenmin) == 0)
-      {
-        rhmin = con.stoi(buf2.substr(14));
-      }
-      else if (buf2.compare(0, 21, con.compoundlefthyphenmin) == 0)
-      {
-        clhmin = con.stoi(buf2.substr(21));
-      }
-      else if (buf2.compare(0, 22, con.compoundrighthyphenmin) == 0)
-      {
-        crhmin = con.stoi(buf2.substr(22));
-      }
-      else if (buf2.compare(0, 4, con.casefold) == 0)
-      {
-        casefold = std::make_unique<casefolding<C>>(buf2.substr(4));
-      }
-      else if (buf2.compare(0, 8, con.nohyphen) == 0)
-      {
-        size_t space = 8;
-
-        // skip spaces
-        while (space < buf2.length() && (buf2[space] == ' ' || buf2[space] == '\t'))
-          space++;
+        Builder(void)
+        {
+          hashtab.insert(std::make_pair(con.empty, 0));
+          states.push_back(HyphenState());
+        }
 
-        // separate at commas and put into string vector
-        while (space < buf2.length())
+        /* Get the state number, allocating a new state if necessary. */
+        int get_state (const string & string)
         {
-          size_t start = space;
+          int state_num = hash_lookup (hashtab, string);
 
-          while (buf2[space] != ',' && buf2[space] != '\n' && space < buf2.length())
-            space++;
+          if (state_num >= 0)
+            return state_num;
 
-          nohyphen.emplace_back(buf2.substr(start, space-start));
-          space++;
+          hashtab.insert(std::make_pair(string, states.size()));
+
+          states.push_back(HyphenState());
+
+          return states.size()-1;
         }
-      }
-      else
-      {
-        uint8_t replindex = 0;
-        uint8_t replcut = 0;
-        string repl;
-
-        // when there is a slash, there should also be 2 commas, separate along them and put result
-        // into replindex, replcut and repl
-        auto slashpos = buf2.find_first_of('/');
-        if (slashpos != string::npos)
-        {
-          auto commapos1 = buf2.find_first_of(',', slashpos);
 
-          if (commapos1 != string::npos)
+        void load_line(const string & buf2)
+        {
+          if (buf2.compare(0, 13, con.lefthyphenmin) == 0)
           {
-            auto commapos2 = buf2.find_first_of(',', commapos1+1);
-
-            if (commapos2 != string::npos)
-            {
-              replindex = con.stoi(buf2.substr(commapos1+1, commapos2-commapos1-1)) - 1;
-              replcut = con.stoi(buf2.substr(commapos2+1));
-              repl = buf2.substr(slashpos+1, commapos1-slashpos-1);
-            }
+            lhmin = con.stoi(buf2.substr(13));
           }
-          else
+          else if (buf2.compare(0, 14, con.righthyphenmin) == 0)
           {
-            replcut = slashpos;
-            repl = buf2.substr(slashpos+1);
+            rhmin = con.stoi(buf2.substr(14));
           }
-        }
-
-        string word;
-        string pattern = con.zero;
-
-        for (size_t i = 0; i < buf2.length() && buf2[i] != '/'; i++)
-        {
-          if (buf2[i] >= '0' && buf2[i] <= '9')
+          else if (buf2.compare(0, 21, con.compoundlefthyphenmin) == 0)
           {
-            pattern.back() = buf2[i];
+            clhmin = con.stoi(buf2.substr(21));
           }
-          else
+          else if (buf2.compare(0, 22, con.compoundrighthyphenmin) == 0)
           {
-            word += buf2[i];
-            pattern += '0';
+            crhmin = con.stoi(buf2.substr(22));
           }
-        }
+          else if (buf2.compare(0, 4, con.casefold) == 0)
+          {
+            casefold = std::make_unique<casefolding<C>>(buf2.substr(4));
+          }
+          else if (buf2.compare(0, 8, con.nohyphen) == 0)
+          {
+            size_t space = 8;
 
-        size_t i = 0;
-        if (repl.length() == 0)
-        {
-          /* Optimize away leading zeroes */
-          while (pattern[i] == '0') i++;
-        }
-        else
-        {
-          if (word[0] == '.') i++;
-          if (con.utf8)
+            // skip spaces
+            while (space < buf2.length() && (buf2[space] == ' ' || buf2[space] == '\t'))
+              space++;
+
+            // separate at commas and put into string vector
+            while (space < buf2.length())
+            {
+              size_t start = space;
+
+              while (buf2[space] != ',' && buf2[space] != '\n' && space < buf2.length())
+                space++;
+
+              nohyphen.emplace_back(buf2.substr(start, space-start));
+              space++;
+            }
+          }
+          else
           {
-            // because the discretionary hyphen positions and lengths are given
-            // in character lengths, we need to convert them to number of utf-8 bytes
-            int pu = -1;        /* unicode character position */
-            int ps = -1;        /* unicode start position (original replindex) */
-            size_t pc = (word[0] == '.') ? 1: 0; /* 8-bit character position */
-            for (; pc < word.length() + 1; pc++)
+            int8_t replindex = 0;
+            uint8_t replcut = 0;
+            string repl;
+
+            // when there is a slash, there should also be 2 commas, separate along them and put result
+            // into replindex, replcut and repl
+            auto slashpos = buf2.find_first_of('/');
+            if (slashpos != string::npos)
+            {
+              auto commapos1 = buf2.find_first_of(',', slashpos);
+
+              if (commapos1 != string::npos)
+              {
+                auto commapos2 = buf2.find_first_of(',', commapos1+1);
+
+                if (commapos2 != string::npos)
+                {
+                  replindex = con.stoi(buf2.substr(commapos1+1, commapos2-commapos1-1)) - 1;
+                  replcut = con.stoi(buf2.substr(commapos2+1));
+                  repl = buf2.substr(slashpos+1, commapos1-slashpos-1);
+                }
+              }
+              else
+              {
+                replcut = slashpos;
+                repl = buf2.substr(slashpos+1);
+              }
+            }
+
+            string word;
+            string pattern = con.zero;
+
+            for (size_t i = 0; i < buf2.length() && buf2[i] != '/'; i++)
             {
-              /* beginning of an UTF-8 character (not '10' start bits) */
-              if ((((uint8_t) word[pc]) >> 6) != 2) pu++;
-              if ((ps < 0) && (replindex == pu))
+              if (buf2[i] >= '0' && buf2[i] <= '9')
               {
-                ps = replindex;
-                replindex = (int8_t) pc;
+                pattern.back() = buf2[i];
               }
-              if ((ps >= 0) && ((pu - ps) == replcut))
+              else
               {
-                replcut = (int8_t) (pc - replindex);
-                break;
+                word += buf2[i];
+                pattern += '0';
               }
             }
-            if (word[0] == '.') replindex--;
-          }
-        }
 
-        int found = hash_lookup (hashtab, word);
-        int state_num = get_state(hashtab, word);
+            size_t i = 0;
+            if (repl.length() == 0)
+            {
+              /* Optimize away leading zeroes */
+              while (pattern[i] == '0') i++;
+            }
+            else
+            {
+              if (word[0] == '.') i++;
+              if (con.utf8)
+              {
+                // because the discretionary hyphen positions and lengths are given
+                // in character lengths, we need to convert them to number of utf-8 bytes
+                int pu = -1;        /* unicode character position */
+                int ps = -1;        /* unicode start position (original replindex) */
+                size_t pc = (word[0] == '.') ? 1: 0; /* 8-bit character position */
+                for (; pc < word.length() + 1; pc++)
+                {
+                  /* beginning of an UTF-8 character (not '10' start bits) */
+                  if ((((uint8_t) word[pc]) >> 6) != 2) pu++;
+                  if ((ps < 0) && (replindex == pu))
+                  {
+                    ps = replindex;
+                    replindex = (int8_t) pc;
+                  }
+                  if ((ps >= 0) && ((pu - ps) == replcut))
+                  {
+                    replcut = (int8_t) (pc - replindex);
+                    break;
+                  }
+                }
+                if (word[0] == '.') replindex--;
+              }
+            }
 
-        for (size_t x = 0; i+x < pattern.length(); x++)
-        {
-          states[state_num].match.push_back(pattern[i+x]);
-        }
+            int found = hash_lookup (hashtab, word);
+            int state_num = get_state(word);
 
-        states[state_num].repl = std::move(repl);
-        states[state_num].replindex = replindex;
-        if (replcut == 0)
-        {
-          states[state_num].replcut = word.length();
+            for (size_t x = 0; i+x < pattern.length(); x++)
+            {
+              states[state_num].match.push_back(pattern[i+x]);
+            }
+
+            states[state_num].repl = std::move(repl);
+            states[state_num].replindex = replindex;
+            if (replcut == 0)
+            {
+              states[state_num].replcut = word.length();
+            }
+            else
+            {
+              states[state_num].replcut = replcut;
+            }
+
+            /* now, put in the prefix transitions */
+            while (found < 0 && word.length() > 0)
+            {
+              int last_state = state_num;
+              C ch = word.back();
+              word.resize(word.length()-1);
+              found = hash_lookup (hashtab, word);
+              state_num = get_state(word);
+              states[state_num].trans.push_back(HyphenTrans(ch, last_state));
+            }
+          }
         }
-        else
+
+        /* put in the fallback states */
+        void add_fallbacks(void)
         {
-          states[state_num].replcut = replcut;
+          for (auto & e : hashtab)
+          {
+            if (e.first.length() > 0)
+            {
+              int state_num = 0;
+              int j = 1;
+
+              while (true)
+              {
+                state_num = hash_lookup(hashtab, e.first.substr(j));
+
+                if (state_num >= 0)
+                {
+                  states[e.second].fallback_state = state_num;
+                  break;
+                }
+
+                j++;
+              }
+            }
+          }
         }
 
-        /* now, put in the prefix transitions */
-        while (found < 0 && word.length() > 0)
+        // append the flat form of this level to out
+        void write(std::vector<uint32_t> & out) const
         {
-          int last_state = state_num;
-          C ch = word.back();
-          word.resize(word.length()-1);
-          found = hash_lookup (hashtab, word);
-          state_num = get_state(hashtab, word);
-          states[state_num].trans.push_back(HyphenTrans(ch, last_state));
+          // renumber the states so that they are sorted by the length of their string,
+          // the fallback state is always a suffix of the state, so it comes first
+          std::vector<std::pair<size_t, int>> order;
+          order.reserve(hashtab.size());
+          for (auto & e : hashtab)
+            order.push_back(std::make_pair(e.first.length(), e.second));
+          std::sort(order.begin(), order.end());
+
+          std::vector<uint32_t> newIndex(states.size());
+          for (size_t i = 0; i < order.size(); i++)
+            newIndex[order[i].second] = i;
+
+          std::vector<FlatState> flatStates;
+          std::vector<FlatTrans> flatTrans;
+          std::vector<uint8_t> flatMatch;
+          std::vector<uint32_t> chars;
+          std::vector<uint32_t> repl;
+          std::vector<uint32_t> noh;
+
+          for (auto & o : order)
+          {
+            const HyphenState & s = states[o.second];
+            FlatState f;
+
+            f.trans = flatTrans.size();
+            f.transCount = s.trans.size();
+            for (auto & t : s.trans)
+              flatTrans.push_back(FlatTrans{unit(t.ch), newIndex[t.new_state]});
+            std::sort(flatTrans.begin()+f.trans, flatTrans.end(),
+                [](const FlatTrans & a, const FlatTrans & b) { return a.ch < b.ch; });
+
+            f.fallback = (s.fallback_state >= 0) ? newIndex[s.fallback_state] + 1 : 0;
+
+            f.match = flatMatch.size();
+            f.matchLength = s.match.size();
+            flatMatch.insert(flatMatch.end(), s.match.begin(), s.match.end());
+
+            f.repl = 0;
+            if (s.repl.length())
+            {
+              repl.push_back(chars.size());
+              repl.push_back(s.repl.length());
+              for (auto c : s.repl) chars.push_back(unit(c));
+              f.repl = repl.size()/2;
+            }
+
+            f.replInfo = static_cast<uint8_t>(s.replindex) | (static_cast<uint32_t>(s.replcut) << 8);
+
+            flatStates.push_back(f);
+          }
+
+          for (auto & n : nohyphen)
+          {
+            noh.push_back(chars.size());
+            noh.push_back(n.length());
+            for (auto c : n) chars.push_back(unit(c));
+          }
+
+          size_t levelStart = out.size();
+
+          FlatLevel l;
+          append(out, l);
+
+          l.lhmin = lhmin;
+          l.rhmin = rhmin;
+          l.clhmin = clhmin;
+          l.crhmin = crhmin;
+
+          l.stateCount = flatStates.size();
+          l.states = out.size();
+          for (auto & s : flatStates) append(out, s);
+
+          l.transCount = flatTrans.size();
+          l.trans = out.size();
+          for (auto & t : flatTrans) append(out, t);
+
+          l.matchCount = flatMatch.size();
+          l.match = out.size();
+          out.resize(out.size() + (flatMatch.size()+3)/4);
+          if (!flatMatch.empty())
+            memcpy(out.data() + l.match, flatMatch.data(), flatMatch.size());
+
+          l.charCount = chars.size();
+          l.chars = out.size();
+          out.insert(out.end(), chars.begin(), chars.end());
+
+          l.replCount = repl.size()/2;
+          l.repl = out.size();
+          out.insert(out.end(), repl.begin(), repl.end());
+
+          l.nohyphenCount = noh.size()/2;
+          l.nohyphen = out.size();
+          out.insert(out.end(), noh.begin(), noh.end());
+
+          l.casefoldStart = casefold ? casefold->getStart() : 0;
+          l.casefoldCount = casefold ? casefold->getTable().size() : 0;
+          l.casefold = out.size();
+          if (casefold)
+            out.insert(out.end(), casefold->getTable().begin(), casefold->getTable().end());
+
+          memcpy(out.data() + levelStart, &l, sizeof(l));
         }
+    };
+
+    /* user options */
+    int lhmin = 0;    /* lefthyphenmin: min. hyph. distance from the left side */
+    int rhmin = 0;    /* righthyphenmin: min. hyph. distance from the right side */
+    int clhmin = 0;   /* min. hyph. distance from the left compound boundary */
+    int crhmin = 0;   /* min. hyph. distance from the right compound boundary */
+    std::vector<string> nohyphen; /* list of characters or character sequences with forbidden hyphenation */
+
+    /* system variables, they point into the flat dictionary */
+    const FlatState * states = nullptr;
+    const FlatTrans * trans = nullptr;
+    const uint8_t * match = nullptr;
+
+    // the replacement strings are small and few, they are copied out of the
+    // flat dictionary, so that we can hand out pointers to strings
+    std::vector<string> repl;
+
+    std::unique_ptr<HyphenDict> nextlevel;
+
+    std::unique_ptr<casefolding<C>> casefold;
+
+    // keeps the memory of the flat dictionary alive, it might be empty when the user
+    // guarantees that the memory stays valid
+    std::shared_ptr<const void> owner;
+
+    // take over the level that starts at the given offset within the flat dictionary,
+    // everything is checked, so that broken files can not result in accesses outside of
+    // the dictionary
+    void attach(const uint32_t * data, size_t size, uint32_t offset)
+    {
+      checkTable(offset, 1, sizeof(FlatLevel)/sizeof(uint32_t), size);
+
+      FlatLevel l;
+      memcpy(&l, data + offset, sizeof(l));
+
+      checkTable(l.states, l.stateCount, sizeof(FlatState)/sizeof(uint32_t), size);
+      checkTable(l.trans, l.transCount, sizeof(FlatTrans)/sizeof(uint32_t), size);
+      checkTable(l.match, (l.matchCount + 3ull)/4, 1, size);
+      checkTable(l.chars, l.charCount, 1, size);
+      checkTable(l.repl, l.replCount, 2, size);
+      checkTable(l.nohyphen, l.nohyphenCount, 2, size);
+      checkTable(l.casefold, l.casefoldCount, 1, size);
+      check(l.stateCount > 0);
+
+      lhmin = l.lhmin;
+      rhmin = l.rhmin;
+      clhmin = l.clhmin;
+      crhmin = l.crhmin;
+
+      states = reinterpret_cast<const FlatState*>(data + l.states);
+      trans = reinterpret_cast<const FlatTrans*>(data + l.trans);
+      match = reinterpret_cast<const uint8_t*>(data + l.match);
+
+      for (uint32_t i = 0; i < l.stateCount; i++)
+      {
+        const FlatState & s = states[i];
+
+        check(s.trans <= l.transCount && s.transCount <= l.transCount - s.trans);
+        check(s.match <= l.matchCount && s.matchLength <= l.matchCount - s.match);
+        check(s.repl <= l.replCount);
+        // the fallback chain must get shorter each time, or else we would loop forever
+        check(s.fallback <= i);
+        // a replacement without cut would stop the position fixup from moving forward
+        check(s.repl == 0 || (s.replInfo & 0xFF00) != 0);
+      }
+
+      for (uint32_t i = 0; i < l.transCount; i++)
+        check(trans[i].newState < l.stateCount);
+
+      const uint32_t * chars = data + l.chars;
+
+      auto getString = [chars, &l](const uint32_t * e) -> string
+      {
+        check(e[0] <= l.charCount && e[1] <= l.charCount - e[0]);
+
+        string s;
+        for (uint32_t i = 0; i < e[1]; i++)
+          s += static_cast<C>(chars[e[0]+i]);
+        return s;
+      };
+
+      repl.clear();
+      for (uint32_t i = 0; i < l.replCount; i++)
+        repl.push_back(getString(data + l.repl + 2*i));
+
+      nohyphen.clear();
+      for (uint32_t i = 0; i < l.nohyphenCount; i++)
+        nohyphen.push_back(getString(data + l.nohyphen + 2*i));
+
+      if (l.casefoldCount)
+      {
+        casefold = std::make_unique<casefolding<C>>(l.casefoldStart,
+            std::vector<char32_t>(data + l.casefold, data + l.casefold + l.casefoldCount));
       }
     }
 
@@ -543,54 +889,57 @@ class HyphenDict
       for (auto & r : result) r.rep = &con.empty;
 
       /* now, run the finite state machine */
-      int state = 0;
+      uint32_t state = 0;
       for (size_t i = 0; i < prep_word.length(); i++)
       {
-        C ch = prep_word[i];
+        uint32_t ch = unit(prep_word[i]);
         while (true)
         {
-          auto trans = std::find_if(states[state].trans.begin(), states[state].trans.end(),
-              [ch](const HyphenTrans & t) -> bool { return t.ch == ch; });
+          auto tbegin = trans + states[state].trans;
+          auto tend = tbegin + states[state].transCount;
+          auto t = std::lower_bound(tbegin, tend, ch,
+              [](const FlatTrans & a, uint32_t c) -> bool { return a.ch < c; });
 
-          if (trans == states[state].trans.end())
+          if (t == tend || t->ch != ch)
           {
-            state = states[state].fallback_state;
-
-            if (state == -1)
+            if (states[state].fallback == 0)
             {
               // ok, continue with next letter
               state = 0;
               break;
             }
+
+            state = states[state].fallback - 1;
           }
           else
           {
-            state = trans->new_state;
+            state = t->newState;
 
             /* Additional optimization is possible here - especially,
                elimination of trailing zeroes from the match. Leading zeroes
                have already been optimized. */
 
-            auto & match = states[state].match;
-            auto & repl = states[state].repl;
-            unsigned int replindex = states[state].replindex;
-            unsigned int replcut = states[state].replcut;
+            const FlatState & s = states[state];
+            const uint8_t * m = match + s.match;
+            const string & r = s.repl ? repl[s.repl-1] : con.empty;
+            int replindex = static_cast<int8_t>(s.replInfo & 0xFF);
+            unsigned int replcut = (s.replInfo >> 8) & 0xFF;
 
-            int offset = i - match.size();
+            int offset = i - s.matchLength;
             size_t k = std::max(-offset, 0);
-            size_t kend = std::min(match.size(), prep_word.length()-3-offset);
+            size_t kend = std::min<size_t>(s.matchLength, prep_word.length()-3-offset);
 
             while (k < kend)
             {
-              if (result[offset + k].hyphens < match[k])
+              if (result[offset + k].hyphens < m[k])
               {
-                result[offset + k].hyphens = match[k];
+                result[offset + k].hyphens = m[k];
 
-                if ((match[k] % 2) != 0)
+                if ((m[k] % 2) != 0 && offset + 1 + replindex >= 0 && offset + 1 + replindex < (int)result.size())
                 {
                   result[offset + 1 + replindex].cut = replcut;
-                  result[offset + 1 + k].rep = &repl;
-                  if (repl.length() && (k >= replindex) && (k <= replindex + replcut))
+                  result[offset + 1 + k].rep = &r;
+                  if (r.length() && ((int)k >= replindex) && (k <= replindex + replcut))
                   {
                     result[offset + 1 + replindex].pos = offset + 1 + k;
                   }
@@ -660,14 +1009,14 @@ class HyphenDict
     /* Unicode ligature length */
     static int hnj_ligature(C c)
     {
-      switch (c) {
-        case '\x80':              /* ff */
-        case '\x81':              /* fi */
-        case '\x82': return 0;    /* fl */
-        case '\x83':              /* ffi */
-        case '\x84': return 1;    /* ffl */
-        case '\x85':              /* long st */
-        case '\x86': return 0;    /* st */
+      switch (static_cast<uint8_t>(c)) {
+        case 0x80:              /* ff */
+        case 0x81:              /* fi */
+        case 0x82: return 0;    /* fl */
+        case 0x83:              /* ffi */
+        case 0x84: return 1;    /* ffl */
+        case 0x85:              /* long st */
+        case 0x86: return 0;    /* st */
       }
       return 0;
     }
@@ -768,32 +1117,24 @@ class HyphenDict
 
   public:
 
-    /** \brief create a new hyphenation dictionary by reading the given stream
+    /** \brief compile a text dictionary into the flat form
      *
      * \param f stream to read. The stream must be an openoffice dictionary, but only
      * UTF-8 encoded dictionaries are supported
+     * \return the flat dictionary, it can be stored and used with the constructor that
+     * takes the flat form
      */
-    HyphenDict(std::istream & f)
+    static std::vector<uint32_t> compile(std::istream & f)
     {
-      // this is a bit of magic that took me a while to understand:
-      // I create a derived class from HyphenDict that does have a default
-      // constructor. I can only do this because here I am inside of
-      // Hyphen Dict and I do have access to the default constructor
-      // of HyphenDict. Someone else will not be able to achieve this
-      struct make_unique_enabler : public HyphenDict<C> {};
+      const constants<C> con;
 
-      std::unique_ptr<HyphenDict<C>> dict[2];
+      Builder dict[2];
 
       bool nextlevelvalid = false;
 
       // loading one or two dictionaries (separated by NEXTLEVEL keyword)
       for (int k = 0; k < 2; k++)
       {
-        HashTab hashtab;
-        hashtab.insert(std::make_pair(con.empty, 0));
-        dict[k] = std::make_unique<make_unique_enabler>();
-        dict[k]->states.push_back(HyphenState());
-
         /* read in character set info */
         if (k == 0)
         {
@@ -818,7 +1159,7 @@ class HyphenDict
             }
             else if (line[0] != '%')
             {
-              dict[k]->load_line(line, hashtab);
+              dict[k].load_line(line);
             }
           }
         }
@@ -826,11 +1167,11 @@ class HyphenDict
         {
           /* default first level: hyphen and ASCII apostrophe */
 
-          dict[k]->load_line(con.line1, hashtab); /* remove hyphen */
-          dict[k]->load_line(con.line2, hashtab); /* ASCII apostrophe */
-          dict[k]->load_line(con.line3, hashtab); /* endash */
-          dict[k]->load_line(con.line4, hashtab); /* apostrophe */
-          dict[k]->load_line(con.line5, hashtab);
+          dict[k].load_line(con.line1); /* remove hyphen */
+          dict[k].load_line(con.line2); /* ASCII apostrophe */
+          dict[k].load_line(con.line3); /* endash */
+          dict[k].load_line(con.line4); /* apostrophe */
+          dict[k].load_line(con.line5);
         }
 
         /* Could do unioning of matches here (instead of the preprocessor script).
@@ -851,45 +1192,98 @@ class HyphenDict
 
          */
 
-        /* put in the fallback states */
+        dict[k].add_fallbacks();
+      }
 
-        for (auto & e : hashtab)
-        {
-          if (e.first.length() > 0)
-          {
-            int state_num = 0;
-            int j = 1;
+      const Builder * levels[2];
 
-            while (true)
-            {
-              state_num = hash_lookup(hashtab, e.first.substr(j));
+      if (nextlevelvalid)
+      {
+        levels[0] = &dict[0];
+        levels[1] = &dict[1];
+      }
+      else
+      {
+        dict[1].lhmin = dict[0].lhmin;
+        dict[1].rhmin = dict[0].rhmin;
+        dict[1].clhmin = (dict[0].clhmin) ? dict[0].clhmin : ((dict[0].lhmin) ? dict[0].lhmin : 3);
+        dict[1].crhmin = (dict[0].crhmin) ? dict[0].crhmin : ((dict[0].rhmin) ? dict[0].rhmin : 3);
+        dict[1].casefold = std::move(dict[0].casefold);
+        levels[0] = &dict[1];
+        levels[1] = &dict[0];
+      }
 
-              if (state_num >= 0)
-              {
-                dict[k]->states[e.second].fallback_state = state_num;
-                break;
-              }
+      FlatHeader h;
+      h.magic = FLAT_MAGIC;
+      h.version = FLAT_VERSION;
+      h.codeUnit = sizeof(C);
+      h.levelCount = 2;
 
-              j++;
-            }
-          }
-        }
+      std::vector<uint32_t> out;
+      append(out, h);
+
+      for (int k = 0; k < 2; k++)
+      {
+        h.levels[k] = out.size();
+        levels[k]->write(out);
       }
 
-      if (nextlevelvalid)
+      h.size = out.size();
+      memcpy(out.data(), &h, sizeof(h));
+
+      return out;
+    }
+
+    /** \brief create a new hyphenation dictionary by reading the given stream
+     *
+     * \param f stream to read. The stream must be an openoffice dictionary, but only
+     * UTF-8 encoded dictionaries are supported
+     */
+    HyphenDict(std::istream & f)
+    {
+      auto data = std::make_shared<std::vector<uint32_t>>(compile(f));
+      *this = HyphenDict(data, data->data(), data->size()*sizeof(uint32_t));
+    }
+
+    /** \brief create a new hyphenation dictionary from the flat form
+     *
+     * The flat form is used in place, nothing is copied
+     *
+     * \param o owner of the memory, it is kept as long as the dictionary exists. It may
+     * be empty when the memory stays valid anyway, e.g. for arrays compiled into the program
+     * \param data the flat dictionary, it must be aligned to 4 bytes
+     * \param size size of the data in bytes
+     */
+    HyphenDict(std::shared_ptr<const void> o, const void * data, size_t size) : owner(std::move(o))
+    {
+      if (reinterpret_cast<uintptr_t>(data) % alignof(uint32_t) != 0)
       {
-        dict[0]->nextlevel = std::move(dict[1]);
-        *this = std::move(*dict[0]);
+        throw std::runtime_error("Compiled hyphen dictionaries must be aligned to 4 bytes");
       }
-      else
+
+      const uint32_t * d = static_cast<const uint32_t*>(data);
+      size /= sizeof(uint32_t);
+
+      checkTable(0, 1, sizeof(FlatHeader)/sizeof(uint32_t), size);
+
+      FlatHeader h;
+      memcpy(&h, d, sizeof(h));
+
+      if (h.magic != FLAT_MAGIC || h.version != FLAT_VERSION)
+      {
+        throw std::runtime_error("Not a compiled hyphen dictionary or the wrong version");
+      }
+
+      check(h.codeUnit == sizeof(C));
+      check(h.size <= size);
+      check(h.levelCount >= 1 && h.levelCount <= FLAT_MAX_LEVELS);
+
+      attach(d, h.size, h.levels[0]);
+
+      if (h.levelCount > 1)
       {
-        dict[1]->lhmin = dict[0]->lhmin;
-        dict[1]->rhmin = dict[0]->rhmin;
-        dict[1]->clhmin = (dict[0]->clhmin) ? dict[0]->clhmin : ((dict[0]->lhmin) ? dict[0]->lhmin : 3);
-        dict[1]->crhmin = (dict[0]->crhmin) ? dict[0]->crhmin : ((dict[0]->rhmin) ? dict[0]->rhmin : 3);
-        dict[1]->casefold = std::move(dict[0]->casefold);
-        dict[1]->nextlevel = std::move(dict[0]);
-        *this = std::move(*dict[1]);
+        nextlevel.reset(new HyphenDict());
+        nextlevel->attach(d, h.size, h.levels[1]);
       }
     }
 
@@ -906,9 +1300,13 @@ class HyphenDict
       crhmin = d.crhmin;
 
       nohyphen = std::move(d.nohyphen);
-      states = std::move(d.states);
+      states = d.states;
+      trans = d.trans;
+      match = d.match;
+      repl = std::move(d.repl);
       nextlevel = std::move(d.nextlevel);
       casefold = std::move(d.casefold);
+      owner = std::move(d.owner);
 
       return *this;
     }
@@ -26,23 +26,115 @@
 
 #include <map>
 #include <memory>
+#include <iterator>
+#include <stdexcept>
+
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace STLL {
 
-static std::map<std::string, std::shared_ptr<internal::HyphenDict<char32_t>>> dictionaries;
+typedef internal::HyphenDict<char32_t> Dict_c;
+
+static std::map<std::string, std::shared_ptr<Dict_c>> dictionaries;
+
+// copy a compiled dictionary into properly aligned memory
+static std::shared_ptr<Dict_c> copyCompiled(const void * data, size_t size)
+{
+  auto d = std::make_shared<std::vector<uint32_t>>((size + sizeof(uint32_t) - 1) / sizeof(uint32_t));
+  memcpy(d->data(), data, size);
+
+  return std::make_shared<Dict_c>(d, d->data(), size);
+}
+
+static std::shared_ptr<Dict_c> loadDictionary(std::istream & str)
+{
+  // text dictionaries always start with the "UTF-8" line, everything
+  // else must be a compiled dictionary
+  if (str.peek() == 'U')
+  {
+    return std::make_shared<Dict_c>(str);
+  }
+
+  std::string data((std::istreambuf_iterator<char>(str)), std::istreambuf_iterator<char>());
+
+  return copyCompiled(data.data(), data.size());
+}
 
 void addHyphenDictionary(const std::vector<std::string> & langs, std::istream & str)
 {
-  auto dict = std::make_shared<internal::HyphenDict<char32_t>>(str);
+  auto dict = loadDictionary(str);
   for (auto & l : langs) dictionaries[l] = dict;
 }
 
 void addHyphenDictionary(const std::vector<std::string> & langs, std::istream && str)
 {
-  auto dict = std::make_shared<internal::HyphenDict<char32_t>>(str);
+  auto dict = loadDictionary(str);
+  for (auto & l : langs) dictionaries[l] = dict;
+}
+
+void addHyphenDictionary(const std::vector<std::string> & langs, const void * data, size_t size)
+{
+  std::shared_ptr<Dict_c> dict;
+
+  if (reinterpret_cast<uintptr_t>(data) % alignof(uint32_t) == 0)
+  {
+    // the user keeps the memory valid, so there is no owner
+    dict = std::make_shared<Dict_c>(std::shared_ptr<const void>(), data, size);
+  }
+  else
+  {
+    dict = copyCompiled(data, size);
+  }
+
+  for (auto & l : langs) dictionaries[l] = dict;
+}
+
+void addHyphenDictionaryFile(const std::vector<std::string> & langs, const std::string & pathname)
+{
+  int fd = open(pathname.c_str(), O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0)
+  {
+    throw std::runtime_error(std::string("Could not open hyphen dictionary '") + pathname + "'");
+  }
+
+  struct stat st;
+
+  if (fstat(fd, &st) != 0 || st.st_size <= 0)
+  {
+    close(fd);
+    throw std::runtime_error(std::string("Could not read hyphen dictionary '") + pathname + "'");
+  }
+
+  size_t s = st.st_size;
+  void * p = mmap(nullptr, s, PROT_READ, MAP_SHARED, fd, 0);
+
+  // the mapping stays valid after closing the file
+  close(fd);
+
+  if (p == MAP_FAILED)
+  {
+    throw std::runtime_error(std::string("Could not map hyphen dictionary '") + pathname + "'");
+  }
+
+  std::shared_ptr<const void> data(p, [s](const void * d) { munmap(const_cast<void*>(d), s); });
+
+  auto dict = std::make_shared<Dict_c>(data, p, s);
   for (auto & l : langs) dictionaries[l] = dict;
 }
 
+void compileHyphenDictionary(std::istream & in, std::ostream & out)
+{
+  auto data = Dict_c::compile(in);
+
+  out.write(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(uint32_t));
+}
+
 namespace internal {
 
 const HyphenDict<char32_t> * getHyphenDict(const std::string & lang)
@@ -0,0 +1,116 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#include "language_internal.h"
+
+#include <unordered_map>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+
+namespace STLL { namespace internal {
+
+static LanguageInfo_c createLanguageInfo(const std::string & lang)
+{
+  LanguageInfo_c res;
+
+  res.lang = lang;
+  res.hbLanguage = HB_LANGUAGE_INVALID;
+  res.hbScript = HB_SCRIPT_INVALID;
+
+  if (!lang.empty())
+  {
+    size_t i = lang.find_first_of('-');
+
+    if (i != std::string::npos)
+    {
+      // the 4 characters after the '-' are the script
+      auto c = [&lang](size_t p) -> char { return p < lang.length() ? lang[p] : 0; };
+
+      res.hbScript = hb_script_from_iso15924_tag(HB_TAG(c(i+1), c(i+2), c(i+3), c(i+4)));
+      res.hbLanguage = hb_language_from_string(lang.c_str(), i-1);
+    }
+    else
+    {
+      res.hbLanguage = hb_language_from_string(lang.c_str(), lang.length());
+    }
+  }
+
+  return res;
+}
+
+// the info of the empty language, atom 0
+static const LanguageInfo_c emptyLanguage = createLanguageInfo("");
+
+// the infos are kept in chunks that are never moved or freed, so that they can be read
+// without a lock. A chunk is published, once the info for its first atom is in there, the
+// other infos are written before their atom is handed out
+static const size_t chunkSize = 64;
+static std::array<std::atomic<LanguageInfo_c *>, 1024> languageChunks {};
+
+// the atoms of the language strings, only used with the mutex locked
+static std::mutex languageMutex;
+static std::unordered_map<std::string, uint32_t> languageAtoms;
+
+uint32_t getLanguageAtom(const std::string & lang)
+{
+  if (lang.empty()) return 0;
+
+  std::lock_guard<std::mutex> lock(languageMutex);
+
+  auto i = languageAtoms.find(lang);
+
+  if (i != languageAtoms.end())
+    return i->second;
+
+  uint32_t a = languageAtoms.size() + 1;
+
+  if (a >= chunkSize * languageChunks.size())
+    throw std::length_error("too many different languages");
+
+  auto & chunk = languageChunks[a / chunkSize];
+  LanguageInfo_c * infos = chunk.load(std::memory_order_relaxed);
+
+  if (!infos)
+  {
+    infos = new LanguageInfo_c[chunkSize];
+    infos[a % chunkSize] = createLanguageInfo(lang);
+    chunk.store(infos, std::memory_order_release);
+  }
+  else
+  {
+    infos[a % chunkSize] = createLanguageInfo(lang);
+  }
+
+  languageAtoms[lang] = a;
+
+  return a;
+}
+
+const LanguageInfo_c & getLanguageInfo(uint32_t atom)
+{
+  if (atom == 0) return emptyLanguage;
+
+  return languageChunks[atom / chunkSize].load(std::memory_order_acquire)[atom % chunkSize];
+}
+
+} }
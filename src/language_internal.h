@@ -0,0 +1,56 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#ifndef STLL_LANGUAGE_INTERNAL_H
+#define STLL_LANGUAGE_INTERNAL_H
+
+#include <harfbuzz/hb.h>
+
+#include <string>
+
+#include <stdint.h>
+
+namespace STLL { namespace internal {
+
+// within the layouter languages are represented by small integer atoms, so that
+// comparing them is cheap. Each language string gets its atom when it is used for the
+// first time, atoms are never released. The empty language has the atom 0
+class LanguageInfo_c
+{
+  public:
+    std::string lang;
+
+    // the harfbuzz language and script as taken from the language string, they
+    // are HB_LANGUAGE_INVALID and HB_SCRIPT_INVALID, when not given
+    hb_language_t hbLanguage;
+    hb_script_t hbScript;
+};
+
+// get the atom for a language string, this locks a mutex for all but the empty language,
+// so the layouter takes the atoms from the attribute index instead
+uint32_t getLanguageAtom(const std::string & lang);
+
+// get the information for an atom, this doesn't lock
+const LanguageInfo_c & getLanguageInfo(uint32_t atom);
+
+} }
+
+#endif
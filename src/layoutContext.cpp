@@ -0,0 +1,190 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#include "layoutContext_internal.h"
+
+#include <stll/layouter.h>
+
+#include <algorithm>
+
+namespace STLL {
+
+namespace internal {
+
+void * ScratchArena_c::allocateBlock(size_t bytes, size_t align)
+{
+  // the blocks get bigger, so that a large paragraph doesn't need too many of them
+  size_t size = std::max(bytes + align, std::max((size_t)16*1024, getCapacity()));
+
+  Block_c b;
+  b.data.reset(new char[size]);
+  b.size = size;
+
+  blocks.push_back(std::move(b));
+  allocations++;
+
+  size_t p = ((size_t)blocks.back().data.get() + align - 1) & ~(align - 1);
+  pos = p - (size_t)blocks.back().data.get() + bytes;
+  used += bytes;
+
+  return (void*)p;
+}
+
+void ScratchArena_c::reset(void)
+{
+  if (blocks.size() > 1)
+  {
+    size_t size = getCapacity();
+
+    blocks.clear();
+
+    Block_c b;
+    b.data.reset(new char[size]);
+    b.size = size;
+
+    blocks.push_back(std::move(b));
+    allocations++;
+  }
+
+  pos = 0;
+  used = 0;
+}
+
+size_t ScratchArena_c::getCapacity(void) const
+{
+  size_t res = 0;
+
+  for (const auto & b : blocks)
+    res += b.size;
+
+  return res;
+}
+
+std::u32string LayoutContextData_c::takeText(void)
+{
+  if (texts.empty())
+    return std::u32string();
+
+  std::u32string t = std::move(texts.back());
+  texts.pop_back();
+
+  return t;
+}
+
+void LayoutContextData_c::giveText(std::u32string && t)
+{
+  t.clear();
+  texts.push_back(std::move(t));
+}
+
+void LayoutContextData_c::prepareRun(runInfo & run)
+{
+  if (!commands.empty())
+  {
+    run.run = std::move(commands.back());
+    commands.pop_back();
+  }
+
+  if (!links.empty())
+  {
+    run.links = std::move(links.back());
+    links.pop_back();
+  }
+}
+
+void LayoutContextData_c::begin(void)
+{
+  if (inUse.exchange(true))
+    throw LayoutException_c("the layout context is already in use, each thread needs its own");
+
+  arena.reset();
+}
+
+void LayoutContextData_c::finish(void)
+{
+  // keep the vectors of the runs, but not their content, the commands
+  // contain the fonts and we don't want to keep them alive
+  for (auto & r : runs)
+  {
+    r.run.clear();
+    commands.push_back(std::move(r.run));
+    r.links.clear();
+    links.push_back(std::move(r.links));
+  }
+
+  runs.clear();
+  lines.clear();
+
+  size_t c = bufferCapacity();
+
+  if (c > lastCapacity) bufferGrowths++;
+  bufferGrowths += arena.getAllocations() - lastArenaAllocations;
+
+  if (stats)
+  {
+    stats->contextGrowths += bufferGrowths - lastBufferGrowths;
+    stats->paragraphs++;
+  }
+
+  lastCapacity = c;
+  lastArenaAllocations = arena.getAllocations();
+  lastBufferGrowths = bufferGrowths;
+
+  paragraphs++;
+  inUse = false;
+  measureOnly = false;
+}
+
+size_t LayoutContextData_c::bufferCapacity(void) const
+{
+  size_t res = runs.capacity() + lines.capacity() + key.text.capacity()
+             + texts.capacity() + commands.capacity() + links.capacity();
+
+  for (const auto & t : texts) res += t.capacity();
+  for (const auto & c : commands) res += c.capacity();
+  for (const auto & l : links) res += l.capacity();
+
+  return res;
+}
+
+}
+
+LayoutContext_c::LayoutContext_c(void) : data(new internal::LayoutContextData_c) { }
+
+LayoutContext_c::~LayoutContext_c(void) { }
+
+LayoutContextStatistics_c LayoutContext_c::getStatistics(void) const
+{
+  LayoutContextStatistics_c s;
+
+  s.paragraphs = data->paragraphs;
+  s.bufferGrowths = data->bufferGrowths;
+  s.arenaBytes = data->arena.getCapacity();
+
+  return s;
+}
+
+void LayoutContext_c::setLayoutStats(LayoutStats_c * stats)
+{
+  data->stats = stats;
+}
+
+}
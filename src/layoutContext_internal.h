@@ -0,0 +1,228 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#ifndef STLL_LAYOUT_CONTEXT_INTERNAL_H
+#define STLL_LAYOUT_CONTEXT_INTERNAL_H
+
+#include "layoutParagraph_internal.h"
+#include "shapeCache_internal.h"
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <memory>
+#include <chrono>
+#include <atomic>
+
+#include <stdint.h>
+
+namespace STLL { namespace internal {
+
+// a monotonic arena for the scratch data of one paragraph, memory is only
+// handed out and never returned. reset makes all the memory available again, the
+// blocks that were used during the last paragraph are then replaced by one block
+// of the combined size, so that a similar paragraph fits into a single block
+class ScratchArena_c
+{
+  public:
+
+    ScratchArena_c(void) { }
+    ScratchArena_c(const ScratchArena_c &) = delete;
+    ScratchArena_c & operator=(const ScratchArena_c &) = delete;
+
+    void * allocate(size_t bytes, size_t align)
+    {
+      if (!blocks.empty())
+      {
+        size_t p = (pos + align - 1) & ~(align - 1);
+
+        if (p + bytes <= blocks.back().size)
+        {
+          pos = p + bytes;
+          used += bytes;
+          return blocks.back().data.get() + p;
+        }
+      }
+
+      return allocateBlock(bytes, align);
+    }
+
+    // make all memory available again, all objects allocated before must be gone
+    void reset(void);
+
+    // number of blocks taken from the heap since the creation of the arena
+    uint64_t getAllocations(void) const { return allocations; }
+
+    // number of bytes in all the blocks
+    size_t getCapacity(void) const;
+
+    // number of bytes handed out since the last reset
+    size_t getUsed(void) const { return used; }
+
+  private:
+
+    class Block_c
+    {
+      public:
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    void * allocateBlock(size_t bytes, size_t align);
+
+    std::vector<Block_c> blocks;
+    size_t pos = 0;
+    size_t used = 0;
+    uint64_t allocations = 0;
+};
+
+// an allocator for standard containers that takes its memory from a scratch arena
+template <class T>
+class ArenaAllocator_c
+{
+  public:
+    typedef T value_type;
+
+    explicit ArenaAllocator_c(ScratchArena_c & a) : arena(&a) { }
+    template <class U> ArenaAllocator_c(const ArenaAllocator_c<U> & o) : arena(o.arena) { }
+
+    T * allocate(size_t n) { return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T *, size_t) { }
+
+    template <class U> bool operator==(const ArenaAllocator_c<U> & o) const { return arena == o.arena; }
+    template <class U> bool operator!=(const ArenaAllocator_c<U> & o) const { return arena != o.arena; }
+
+    ScratchArena_c * arena;
+};
+
+template <class T>
+using ScratchVector_c = std::vector<T, ArenaAllocator_c<T>>;
+
+template <class T>
+using ScratchDeque_c = std::deque<T, ArenaAllocator_c<T>>;
+
+// the data behind a LayoutContext_c, all the memory that is needed while a paragraph
+// is layouted, either it comes from the arena, or it is in one of the buffers that
+// keep their capacity between the paragraphs
+class LayoutContextData_c
+{
+  public:
+
+    ScratchArena_c arena;
+
+    // the runs and lines of the paragraph that is currently layouted
+    std::vector<runInfo> runs;
+    std::vector<lineInfo> lines;
+
+    // the key for the lookups in the shape cache
+    ShapeKey_c key;
+
+    // spare buffers: texts for the layout data views and the command and
+    // link vectors of the runs from the previous paragraph
+    std::vector<std::u32string> texts;
+    std::vector<decltype(runInfo::run)> commands;
+    std::vector<decltype(runInfo::links)> links;
+
+    // set while a paragraph is laid out, atomic so that two threads beginning
+    // at the same time can't both take the context
+    std::atomic<bool> inUse{false};
+
+    // create runs without drawing commands, for measuring paragraphs
+    bool measureOnly = false;
+
+    uint64_t paragraphs = 0;
+    uint64_t bufferGrowths = 0;
+
+    // the statistics that the layout adds its numbers to, nullptr when not wanted
+    LayoutStats_c * stats = nullptr;
+
+    // get an allocator for the arena
+    template <class T>
+    ArenaAllocator_c<T> alloc(void) { return ArenaAllocator_c<T>(arena); }
+
+    // take a spare text buffer and give it back
+    std::u32string takeText(void);
+    void giveText(std::u32string && t);
+
+    // give the run the spare command and link vectors
+    void prepareRun(runInfo & run);
+
+    // start and finish the layout of one paragraph, finish clears the runs
+    // and keeps their vectors for the next paragraph
+    void begin(void);
+    void finish(void);
+
+  private:
+
+    // the sum of the capacities of all buffers, the capacity of a buffer only grows, so when
+    // this sum has changed, one of the buffers has taken memory from the heap
+    size_t bufferCapacity(void) const;
+    size_t lastCapacity = 0;
+    uint64_t lastArenaAllocations = 0;
+    uint64_t lastBufferGrowths = 0;
+};
+
+// measure the time of one phase of the layout and add it to one of the fields of the
+// statistics, without statistics nothing is done
+class PhaseTimer_c
+{
+  public:
+    PhaseTimer_c(LayoutStats_c * s, uint64_t LayoutStats_c::* f) : field(s ? &(s->*f) : nullptr)
+    {
+      if (field) start = std::chrono::steady_clock::now();
+    }
+
+    ~PhaseTimer_c(void) { stop(); }
+
+    // end the phase before the timer goes out of scope
+    void stop(void)
+    {
+      if (field)
+        *field += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count();
+
+      field = nullptr;
+    }
+
+    PhaseTimer_c(const PhaseTimer_c &) = delete;
+    PhaseTimer_c & operator=(const PhaseTimer_c &) = delete;
+
+  private:
+    uint64_t * field;
+    std::chrono::steady_clock::time_point start;
+};
+
+// use a context for the layout of one paragraph
+class LayoutContextUse_c
+{
+  public:
+    explicit LayoutContextUse_c(LayoutContextData_c & c) : ctx(c) { ctx.begin(); }
+    ~LayoutContextUse_c(void) { ctx.finish(); }
+
+    LayoutContextUse_c(const LayoutContextUse_c &) = delete;
+    LayoutContextUse_c & operator=(const LayoutContextUse_c &) = delete;
+
+  private:
+    LayoutContextData_c & ctx;
+};
+
+} }
+
+#endif
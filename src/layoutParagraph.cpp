@@ -23,7 +23,7 @@
 #include <stll/layouter.h>
 
 #include <harfbuzz/hb.h>
-#include <harfbuzz/hb-ft.h>
+#include <harfbuzz/hb-ot.h>
 
 #include <fribidi/fribidi.h>
 
@@ -32,9 +32,20 @@
 
 #include "hyphen/hyphen.h"
 #include "hyphendictionaries_internal.h"
+#include "shapeCache_internal.h"
+#include "layoutParagraph_internal.h"
+#include "workerPool_internal.h"
+#include "language_internal.h"
+#include "layoutContext_internal.h"
 
 #include <algorithm>
 #include <map>
+#include <deque>
+#include <numeric>
+#include <limits>
+#include <cmath>
+#include <functional>
+#include <unordered_map>
 
 #include <cassert>
 
@@ -44,8 +55,10 @@ namespace STLL {
 // so let's see how does the whole thing work...
 //
 // At first we split the text into runs. A run is a section of the text that "belongs together"
-// line breaks only happen between runs. Also all the text in one run uses the same font. The text
-// in one run is layouted using harfbuzz.
+// line breaks only happen between runs. Also all the text in one run uses the same font. Consecutive
+// runs with the same direction, language and font form an item. Each item is shaped by harfbuzz
+// in one go and the result is then split into the runs. Only where harfbuzz tells us that splitting
+// is not safe the runs are shaped again on their own.
 //
 // Then the runs are assembled into the paragraph either using a greedy algorithm (fill lines as
 // far as possible and then start the next) or using something akin to TeX Paragraph layout
@@ -66,21 +79,34 @@ class LayoutDataView
 {
   private:
 
+    // the context that provides the memory for all the data
+    internal::LayoutContextData_c & ctx;
+
     std::u32string txt32;     // the text to layout, bidi-control characters are removed
 
     // we don't want to copy the attribute and the embedding levels, but the txt32
     // string may miss some of the characters of the original string, the string that
     // the provided attributes refert to
-    // So we use an index array to index into the original attributeIndex
-    std::vector<size_t> idx;
+    // So we use an index array to index into the original embedding levels
+    internal::ScratchVector_c<size_t> idx;
+
+    // the attribute of each character, looking them up in the attribute index
+    // each time is too slow. And whether the character has its own attribute
+    internal::ScratchVector_c<const CodepointAttributes_c *> atts;
+    internal::ScratchVector_c<bool> hasatts;
 
-    // original attributes and embedding levels
-    const AttributeIndex_c & attr;
-    const std::vector<FriBidiLevel> & embeddingLevels;
+    // the language atom of each character
+    internal::ScratchVector_c<uint32_t> langs;
+
+    // original embedding levels
+    const FriBidiLevel * embeddingLevels;
 
     // calculated linebreak and hyphenation position
-    std::vector<char> linebreaks;
-    std::vector<bool> hyphens;
+    internal::ScratchVector_c<char> linebreaks;
+    internal::ScratchVector_c<bool> hyphens;
+
+    // the position in the original text behind the last character looked at
+    size_t next;
 
     // check if a character is a bidi control character and should not go into
     // the output stream
@@ -95,27 +121,88 @@ class LayoutDataView
   public:
 
     // create the object, copy the string leaving out all the bidi control characters
-    LayoutDataView(const std::u32string & t, const AttributeIndex_c & a, const std::vector<FriBidiLevel> & e)
-      : attr(a), embeddingLevels(e)
+    // first and last can be used to only look at a section of the text, the attributes
+    // and embedding levels are still indexed with the position in the complete text
+    LayoutDataView(const std::u32string & t, const AttributeIndex_c & a, const FriBidiLevel * e,
+                   internal::LayoutContextData_c & c, size_t first = 0, size_t last = std::u32string::npos)
+      : ctx(c), txt32(c.takeText()), idx(c.alloc<size_t>()), atts(c.alloc<const CodepointAttributes_c *>()),
+        hasatts(c.alloc<bool>()), langs(c.alloc<uint32_t>()), embeddingLevels(e),
+        linebreaks(c.alloc<char>()), hyphens(c.alloc<bool>()), next(first)
+    {
+      last = std::min(last, t.size());
+
+      size_t n = last > first ? last - first : 0;
+      txt32.reserve(n);
+      idx.reserve(n);
+      atts.reserve(n);
+      hasatts.reserve(n);
+      langs.reserve(n);
+
+      append(t, a, last, std::u32string::npos);
+    }
+
+    // add characters behind the ones already in the view, until it contains size characters
+    // or the text ends, t and a must be the text and attributes the view was created with.
+    // The line breaks of the new characters must be calculated again
+    void grow(const std::u32string & t, const AttributeIndex_c & a, size_t size)
+    {
+      append(t, a, t.size(), size);
+    }
+
+    // the position in the original text behind the last character in the view
+    size_t textEnd(void) const { return next; }
+
+    ~LayoutDataView(void) { ctx.giveText(std::move(txt32)); }
+
+  private:
+
+    // add the characters of t up to last, but stop when the view contains size characters
+    void append(const std::u32string & t, const AttributeIndex_c & a, size_t last, size_t size)
     {
-      for (size_t i = 0; i < t.size(); i++)
+      if (next >= last || txt32.size() >= size) return;
+
+      // walk along the runs of the attribute index together with the text
+      size_t r = a.findRun(next);
+      uint32_t lang = a.runLanguage(r);
+
+      for (; next < last && txt32.size() < size; next++)
       {
+        size_t i = next;
+
         if (!isBidiCharacter(t[i]))
         {
+          if (a.runEnd(r) <= i)
+          {
+            while (a.runEnd(r) <= i) r++;
+            lang = a.runLanguage(r);
+          }
+
           txt32 += t[i];
           idx.push_back(i);
+          atts.push_back(&a.runAttribute(r));
+          hasatts.push_back(a.runHasAttribute(r));
+          langs.push_back(lang);
         }
       }
       linebreaks.resize(idx.size());
     }
 
+  public:
+
+    LayoutDataView(const LayoutDataView &) = delete;
+    LayoutDataView & operator=(const LayoutDataView &) = delete;
+
+    // the context for scratch memory
+    internal::LayoutContextData_c & context(void) const { return ctx; }
+
     // accessors for the data
     const std::u32string & txt(void) const { return txt32; }
     char32_t txt(size_t i) const { return txt32[i]; }
     size_t size(void) const { return txt32.size(); }
 
-    const CodepointAttributes_c & att(size_t i) const { return attr[idx[i]]; }
-    bool hasatt(size_t i) const { return attr.hasAttribute(idx[i]); }
+    const CodepointAttributes_c & att(size_t i) const { return *atts[i]; }
+    bool hasatt(size_t i) const { return hasatts[i]; }
+    uint32_t lang(size_t i) const { return langs[i]; }
 
     FriBidiLevel emb(size_t i) const { return embeddingLevels[idx[i]]; }
 
@@ -126,82 +213,132 @@ class LayoutDataView
     bool hyp(size_t i) const { return i < hyphens.size() && hyphens[i]; }
 };
 
+// the runs and lines are defined in the internal header, as they are part of a shaped
+// or incremental paragraph
+using internal::runInfo;
+using internal::lineInfo;
 
-// this structure contains the information of a run finished and ready or paragraph assembly
-typedef struct
-{
-  // the commands to output this run including the layer, the larger the number, the more in front to draw
-  std::vector<std::pair<size_t, CommandData_c>> run;
-
-  // the advance information of this run
-  int dx = 0;
-  int dy = 0;
 
-  // the embedding level (text direction) of this run
-  FriBidiLevel embeddingLevel = 0;
+// the following functions gather additional information about the text to layout
 
-  // line-break information for AFTER this run, for values see liblinebreak
-  char linebreak = LINEBREAK_NOBREAK;
+// the largest character in a piece of text, the loop is kept simple, so that
+// the compiler can vectorize it
+static char32_t maxCharacter(const char32_t * txt, size_t len)
+{
+  char32_t m = 0;
 
-  // the font used for this run... will probably be identical to
-  // the fonts in the run
-  std::shared_ptr<FontFace_c> font;
+  for (size_t i = 0; i < len; i++)
+    m = std::max(m, txt[i]);
 
-  // is this run a space run? Will be removed at line ends
-  bool space = false;
+  return m;
+}
 
-  // is this a soft hyphen?? will only be shown at line ends
-  bool shy = false;
+// create the text direction information using libfribidi
+// txt32 and base_dir go in, embedding_levels comes out, it must have space for one
+// level per character
+static void getBidiEmbeddingLevels(const std::u32string & txt32, const LayoutProperties_c & prop,
+                                   internal::LayoutContextData_c & ctx, FriBidiLevel * embedding_levels)
+{
+  internal::PhaseTimer_c timer(ctx.stats, &LayoutStats_c::bidiNs);
 
-  // ascender and descender of this run
-  int32_t ascender = 0;
-  int32_t descender = 0;
+  // all characters in front of the hebrew block are either left to right or neutral, in
+  // a left to right paragraph they all end up at level 0, so we don't need fribidi
+  if (prop.simpleTextShortcuts && prop.ltr && maxCharacter(txt32.data(), txt32.length()) < 0x0590)
+  {
+    std::fill(embedding_levels, embedding_levels+txt32.length(), 0);
+    return;
+  }
 
-  // link boxes for this run
-  std::vector<TextLayout_c::LinkInformation_c> links;
+  internal::ScratchVector_c<FriBidiCharType> bidiTypes(txt32.length(), 0, ctx.alloc<FriBidiCharType>());
+  fribidi_get_bidi_types(reinterpret_cast<const uint32_t*>(txt32.c_str()), txt32.length(), bidiTypes.data());
 
-#ifndef NDEBUG
-  // the text of this run, useful for debugging to see what is going on
-  std::u32string text;
-#endif
+  FriBidiParType base_dir = prop.ltr ? FRIBIDI_TYPE_LTR_VAL : FRIBIDI_TYPE_RTL_VAL;
 
-} runInfo;
+  if (fribidi_get_par_embedding_levels(bidiTypes.data(), txt32.length(), &base_dir, embedding_levels) == 0)
+  {
+    // throw an exception
+    throw LayoutException_c("unable to calculate embedding levels, possible out of memory");
+  }
+}
 
+// the line break classes of UAX #14 that the simple line breaking handles
+enum { LBC_NONE, LBC_AL, LBC_NU, LBC_SP, LBC_IS, LBC_EX, LBC_LF };
 
-// the following functions gather additional information about the text to layout
+// the line break classes of the ASCII characters, LBC_NONE for all characters
+// that are left to liblinebreak
+static const uint8_t simpleBreakClass[128] =
+{
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 6, 0, 0, 0, 0, 0,  // 0x00
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  // 0x10
+  3, 5, 0, 1, 0, 0, 1, 0, 0, 0, 1, 0, 4, 0, 4, 0,  // 0x20  !"#$%&'()*+,-./
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 4, 4, 1, 1, 1, 5,  // 0x30 0123456789:;<=>?
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x40 @A-O
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 1,  // 0x50 P-Z[\]^_
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x60 `a-o
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 0,  // 0x70 p-z{|}~
+};
 
-// create the text direction information using libfribidi
-// txt32 and base_dir go in, embedding_levels comes out
-static std::vector<FriBidiLevel> getBidiEmbeddingLevels(const std::u32string & txt32, const LayoutProperties_c & prop)
+// calculate the line-breaks for text that only contains characters with one of the
+// classes above, the result is the same as with liblinebreak. Returns false when the
+// text contains other characters, or combinations that are not handled here.
+// Only the text starting at from is looked at
+static bool getSimpleLinebreaks(LayoutDataView & view, size_t from)
 {
-  std::vector<FriBidiCharType> bidiTypes(txt32.length());
-  fribidi_get_bidi_types(reinterpret_cast<const uint32_t*>(txt32.c_str()), txt32.length(), bidiTypes.data());
+  size_t length = view.size();
 
-  std::vector<FriBidiLevel> embedding_levels(txt32.length());
-  FriBidiParType base_dir = prop.ltr ? FRIBIDI_TYPE_LTR_VAL : FRIBIDI_TYPE_RTL_VAL;
+  if (length <= from || maxCharacter(view.txt().data()+from, length-from) >= 128)
+    return false;
+
+  for (size_t i = from; i < length; i++)
+    if (simpleBreakClass[view.txt(i)] == LBC_NONE)
+      return false;
 
-  if (fribidi_get_par_embedding_levels(bidiTypes.data(), txt32.length(), &base_dir, embedding_levels.data()) == 0)
+  char * lnb = view.lnb();
+
+  for (size_t i = from; i+1 < length; i++)
   {
-    // throw an exception
-    throw LayoutException_c("unable to calculate embedding levels, possible out of memory");
+    uint8_t a = simpleBreakClass[view.txt(i)];
+    uint8_t b = simpleBreakClass[view.txt(i+1)];
+
+    if (a == LBC_LF)
+      lnb[i] = LINEBREAK_MUSTBREAK;                  // LB5
+    else if (b == LBC_LF || b == LBC_SP || b == LBC_IS || b == LBC_EX)
+      lnb[i] = LINEBREAK_NOBREAK;                    // LB6, LB7, LB13
+    else if (a == LBC_SP)
+      lnb[i] = LINEBREAK_ALLOWBREAK;                 // LB18
+    else if (a == LBC_AL || a == LBC_NU)
+      lnb[i] = LINEBREAK_NOBREAK;                    // LB23, LB25, LB28
+    else if (a == LBC_EX)
+      lnb[i] = LINEBREAK_ALLOWBREAK;                 // LB31
+    else if (b == LBC_AL)
+      lnb[i] = LINEBREAK_NOBREAK;                    // LB29
+    else
+      return false;                                  // numbers after IS depend on the version of UAX #14
   }
 
-  return embedding_levels;
+  lnb[length-1] = LINEBREAK_MUSTBREAK;               // LB3
+
+  return true;
 }
 
-// calculate positions of potential line-breaks using liblinebreak
-static void getLinebreaks(LayoutDataView & view)
+// calculate positions of potential line-breaks using liblinebreak, the text in front of from
+// is not looked at, from must be behind a line break opportunity
+static void getLinebreaks(LayoutDataView & view, const LayoutProperties_c & prop, size_t from = 0)
 {
+  internal::PhaseTimer_c timer(view.context().stats, &LayoutStats_c::linebreakNs);
+
+  if (prop.simpleTextShortcuts && getSimpleLinebreaks(view, from)) return;
+
   size_t length = view.size();
 
-  size_t runstart = 0;
+  size_t runstart = from;
 
   while (runstart < length)
   {
     size_t runpos = runstart+1;
 
     // accumulate text that uses the same language and is no bidi character
-    while (runpos < length && view.att(runstart).lang == view.att(runpos).lang)
+    while (runpos < length && view.lang(runstart) == view.lang(runpos))
     {
       runpos++;
     }
@@ -222,22 +359,28 @@ static void getLinebreaks(LayoutDataView & view)
 // find possible hyphenation places, of the returned positions
 // we right now ignore complex hyphenations and only take those
 // that correspond to simply adding a soft-hyphen
-static void getHyphens(LayoutDataView & view)
+// only the words between first and last are hyphenated, both must be word boundaries
+static void getHyphens(LayoutDataView & view, size_t first = 0, size_t last = std::u32string::npos)
 {
+  auto stats = view.context().stats;
+  internal::PhaseTimer_c timer(stats, &LayoutStats_c::hyphenationNs);
+
   std::vector<internal::HyphenDict<char32_t>::Hyphens> hyphens;
 
-  size_t sectionstart = 0;
+  last = std::min(last, view.size());
 
-  while (sectionstart < view.size())
+  size_t sectionstart = first;
+
+  while (sectionstart < last)
   {
     if (view.hasatt(sectionstart) && !view.att(sectionstart).lang.empty())
     {
       // initial stuff: separate words on spaces, find English words
-      std::string curLang = view.att(0).lang;
+      const std::string & curLang = view.att(sectionstart).lang;
 
       // find end of current language section
       size_t i = sectionstart + 1;
-      while (i < view.size() && view.hasatt(i) && view.att(i).lang == curLang) i++;
+      while (i < last && view.hasatt(i) && view.lang(i) == view.lang(sectionstart)) i++;
 
       auto dict = internal::getHyphenDict(curLang);
 
@@ -257,10 +400,11 @@ static void getHyphens(LayoutDataView & view)
           if (breaks[j-1] == WORDBREAK_BREAK)
           {
             // only hyphen, when the user has not done so manually
-            if (view.txt().find_first_of(U'\u00AD', wordstart) >= j)
+            if (view.txt().find_first_of(U'\u00AD', sectionstart+wordstart) >= sectionstart+j)
             {
               // assume a word from wordstart to j
-              dict->hyphenate(view.txt().substr(wordstart, j-wordstart), hyphens);
+              if (stats) stats->hyphenationLookups++;
+              dict->hyphenate(view.txt().substr(sectionstart+wordstart, j-wordstart), hyphens);
 
               for (size_t l = 0; l < j-wordstart+1; l++)
               {
@@ -314,50 +458,147 @@ static void addUnderline(runInfo & run, int32_t gx, int32_t gw, const LayoutProp
   }
 }
 
-// create a fun for the texte between runstart and spos
-static runInfo createRun(const LayoutDataView & view, size_t spos, size_t runstart,
-                         const LayoutProperties_c & prop,
-                         std::shared_ptr<FontFace_c> & font,
-                         hb_font_t * hb_ft_font
-                        )
+// a harfbuzz buffer that is reused for all shaping that a thread does, this
+// avoids allocating and freeing a buffer for each run
+class HarfbuzzBuffer_c
 {
-  // the resulting run
-  runInfo run;
+  private:
+    hb_buffer_t * buf;
 
-  // check, if this is a space run, on line ends space runs will be removed
-  run.space = view.txt(spos-1) == U' ' || view.txt(spos-1) == U'\n';
+  public:
+    HarfbuzzBuffer_c(void) : buf(hb_buffer_create()) { }
+    ~HarfbuzzBuffer_c(void) { hb_buffer_destroy(buf); }
 
-  // check, if this run is a soft hyphen. Soft hyphens are ignored and not output, except on line endings
-  run.shy = view.txt(runstart) == U'\u00AD';
+    // get the buffer, all content from the previous use is removed
+    hb_buffer_t * get(void)
+    {
+      hb_buffer_clear_contents(buf);
+      return buf;
+    }
+};
 
-  // we may only have this one caracter in the text, when the first character is a shy
-  assert(!run.shy || spos-runstart == 1);
+// shape a section of text using harfbuzz, the result is taken from the shape cache
+// when the same text has been shaped before with the same font, language and direction
+// txt is the whole text, start and len specify the section to shape, the rest of txt
+// is used as context for the shaper
+// the key of the context is used for the cache lookup, its content is overwritten
+// when cached is false the cache is neither searched nor filled, this is for text that is
+// not expected to come again
+static std::shared_ptr<const internal::ShapedGlyphs_c> shapeText(const std::u32string & txt, size_t start, size_t len,
+                                                                 uint32_t language, bool rtl,
+                                                                 const std::shared_ptr<FontFace_c> & font,
+                                                                 internal::LayoutContextData_c & ctx,
+                                                                 bool cached = true)
+{
+  // inlays don't have a font and are not shaped, we simply return the
+  // characters with one glyph per character and no advance
+  if (!font)
+  {
+    auto res = std::make_shared<internal::ShapedGlyphs_c>(len);
 
-  // Create a harfbuzz buffer
-  hb_buffer_t *buf = hb_buffer_create();
+    for (size_t i = 0; i < len; i++)
+      (*res)[i] = internal::ShapedGlyph_c{txt[start+i], (uint32_t)i, 0, 0, 0, 0, false};
 
-  // setup the language for the harfbuzz shaper
-  std::string language = view.att(runstart).lang;
-  if (!language.empty())
+    return res;
+  }
+
+  // harfbuzz looks at a limited number of characters before and after the
+  // text to shape, this context must be part of the key
+  const size_t maxContext = 5;
+
+  auto & k = ctx.key;
+
+  k.preContext = std::min(start, maxContext);
+  k.postContext = std::min(txt.length()-start-len, maxContext);
+  k.text.assign(txt, start-k.preContext, k.preContext+len+k.postContext);
+  k.font = font;
+  k.fontPtr = font.get();
+  k.lang = language;
+  k.rtl = rtl;
+
+  auto & cache = internal::getShapeCache();
+
+  if (cached)
   {
-    size_t i = language.find_first_of('-');
+    auto res = cache.find(k);
 
-    if (i != std::string::npos)
+    if (res)
     {
-      hb_script_t scr = hb_script_from_iso15924_tag(HB_TAG(language[i+1], language[i+2], language[i+3], language[i+4]));
-      hb_buffer_set_script(buf, scr);
-      hb_buffer_set_language(buf, hb_language_from_string(language.c_str(), i-1));
-    }
-    else
-    {
-      hb_buffer_set_language(buf, hb_language_from_string(language.c_str(), language.length()));
+      if (ctx.stats) ctx.stats->shapeCacheHits++;
+      return res;
     }
   }
 
-  if (!run.shy)
+  if (ctx.stats) ctx.stats->shapeCalls++;
+
+  // get the harfbuzz buffer of this thread
+  static thread_local HarfbuzzBuffer_c hbBuffer;
+  hb_buffer_t *buf = hbBuffer.get();
+
+  // setup the language for the harfbuzz shaper
+  const auto & info = internal::getLanguageInfo(language);
+
+  if (info.hbScript != HB_SCRIPT_INVALID)
+    hb_buffer_set_script(buf, info.hbScript);
+
+  if (info.hbLanguage != HB_LANGUAGE_INVALID)
+    hb_buffer_set_language(buf, info.hbLanguage);
+
+  // copy the text to layout into the harfbuzz buffer
+  hb_buffer_add_utf32(buf, reinterpret_cast<const uint32_t*>(k.text.c_str()), k.text.length(), k.preContext, len);
+
+  // set text direction for this run
+  hb_buffer_set_direction(buf, rtl ? HB_DIRECTION_RTL : HB_DIRECTION_LTR);
+
+  // shape using the plan and font that the font face keeps for us
+  hb_segment_properties_t props;
+  hb_buffer_get_segment_properties(buf, &props);
+  hb_shape_plan_execute(font->getShapePlan(props), font->getHarfbuzzFont(), buf, NULL, 0);
+
+  // get the output
+  unsigned int         glyph_count;
+  hb_glyph_info_t     *glyph_info   = hb_buffer_get_glyph_infos(buf, &glyph_count);
+  hb_glyph_position_t *glyph_pos    = hb_buffer_get_glyph_positions(buf, &glyph_count);
+
+  auto glyphs = std::make_shared<internal::ShapedGlyphs_c>(glyph_count);
+
+  for (size_t j = 0; j < glyph_count; j++)
+  {
+    (*glyphs)[j] = internal::ShapedGlyph_c{glyph_info[j].codepoint, glyph_info[j].cluster-k.preContext,
+                                           glyph_pos[j].x_advance, glyph_pos[j].y_advance,
+                                           glyph_pos[j].x_offset, glyph_pos[j].y_offset,
+                                           (hb_glyph_info_get_glyph_flags(glyph_info+j) & HB_GLYPH_FLAG_UNSAFE_TO_BREAK) != 0};
+  }
+
+  // the key is copied, so that k keeps its memory for the next lookup
+  if (cached)
+    cache.insert(k, glyphs);
+
+  return glyphs;
+}
+
+// the glyphs for one run, this is a section out of the glyphs of a shaped text
+// the attribute for a glyph is found at clusterBase + cluster
+typedef struct
+{
+  std::shared_ptr<const internal::ShapedGlyphs_c> glyphs;
+  size_t first = 0;
+  size_t count = 0;
+  size_t clusterBase = 0;
+} runGlyphs;
+
+// shape the text of a single run between runstart and spos
+static runGlyphs shapeRun(const LayoutDataView & view, size_t spos, size_t runstart,
+                          const std::shared_ptr<FontFace_c> & font)
+{
+  runGlyphs res;
+
+  bool rtl = view.emb(runstart) % 2 != 0;
+
+  if (view.txt(runstart) != U'\u00AD')
   {
-    // copy the text to layout into the harfbuzz buffer
-    hb_buffer_add_utf32(buf, reinterpret_cast<const uint32_t*>(view.txt().c_str()), -1, runstart, spos-runstart);
+    res.glyphs = shapeText(view.txt(), runstart, spos-runstart, view.lang(runstart), rtl, font,
+                           view.context());
   }
   else
   {
@@ -365,37 +606,123 @@ static runInfo createRun(const LayoutDataView & view, size_t spos, size_t runsta
     // not all fonts contain the proper character for this symbol, so we
     // first try the proper one, and if that is not available
     // we use hyphen-minus, which all should have
-    if (font->containsGlyph(U'\u2010'))
+    static const std::u32string hyphen(U"\u2010");
+    static const std::u32string hyphenMinus(U"\u002D");
+
+    res.glyphs = shapeText(font->containsGlyph(U'\u2010') ? hyphen : hyphenMinus, 0, 1, view.lang(runstart),
+                           rtl, font, view.context());
+  }
+
+  res.count = res.glyphs->size();
+  res.clusterBase = runstart;
+
+  return res;
+}
+
+// shape an item, that is a sequence of runs that share direction, language, font and
+// baseline, in one go and split the glyphs into the runs given by bounds
+// the run r goes from bounds[r] to bounds[r+1]
+// runs where the split is not safe, because harfbuzz has marked the glyph as unsafe to break
+// or because the clusters cross the run boundary, are shaped again on their own
+static void shapeItem(const LayoutDataView & view, const internal::ScratchVector_c<size_t> & bounds,
+                      const std::shared_ptr<FontFace_c> & font, internal::ScratchVector_c<runGlyphs> & res)
+{
+  auto & ctx = view.context();
+
+  size_t itemstart = bounds.front();
+  size_t runcount = bounds.size()-1;
+
+  auto glyphs = shapeText(view.txt(), itemstart, bounds.back()-itemstart, view.lang(itemstart),
+                          view.emb(itemstart) % 2 != 0, font, ctx);
+
+  // the run index for each character of the item
+  internal::ScratchVector_c<size_t> runOf(bounds.back()-itemstart, 0, ctx.alloc<size_t>());
+  for (size_t r = 0; r < runcount; r++)
+    for (size_t i = bounds[r]; i < bounds[r+1]; i++)
+      runOf[i-itemstart] = r;
+
+  res.resize(runcount);
+  internal::ScratchVector_c<bool> safe(runcount, true, ctx.alloc<bool>());
+  internal::ScratchVector_c<bool> hasStart(runcount, false, ctx.alloc<bool>());
+
+  for (size_t j = 0; j < glyphs->size(); j++)
+  {
+    const auto & g = (*glyphs)[j];
+    size_t r = runOf[g.cluster];
+
+    if (res[r].count == 0)
+      res[r].first = j;
+    else if (res[r].first + res[r].count != j)
+      safe[r] = false;
+
+    res[r].count++;
+
+    if (g.cluster == bounds[r]-itemstart)
+    {
+      hasStart[r] = true;
+
+      if (g.unsafeToBreak && r > 0)
+      {
+        safe[r] = false;
+        safe[r-1] = false;
+      }
+    }
+  }
+
+  for (size_t r = 0; r < runcount; r++)
+  {
+    if (!hasStart[r])
+    {
+      safe[r] = false;
+      if (r > 0) safe[r-1] = false;
+    }
+  }
+
+  for (size_t r = 0; r < runcount; r++)
+  {
+    if (safe[r])
     {
-      hb_buffer_add_utf32(buf, reinterpret_cast<const uint32_t*>(U"\u2010"), 1, 0, 1);
+      res[r].glyphs = glyphs;
+      res[r].clusterBase = itemstart;
     }
     else
     {
-      hb_buffer_add_utf32(buf, reinterpret_cast<const uint32_t*>(U"\u002D"), 1, 0, 1);
+      res[r] = shapeRun(view, bounds[r+1], bounds[r], font);
     }
   }
+}
+
+// create a fun for the texte between runstart and spos using the given glyphs
+static runInfo createRun(const LayoutDataView & view, size_t spos, size_t runstart,
+                         const LayoutProperties_c & prop,
+                         std::shared_ptr<FontFace_c> & font,
+                         const runGlyphs & shaped
+                        )
+{
+  // the resulting run, it gets the vectors of a previous run, when the context has some
+  runInfo run;
+  view.context().prepareRun(run);
+
+  // check, if this is a space run, on line ends space runs will be removed
+  run.space = view.txt(spos-1) == U' ' || view.txt(spos-1) == U'\n';
+
+  // check, if this run is a soft hyphen. Soft hyphens are ignored and not output, except on line endings
+  run.shy = view.txt(runstart) == U'\u00AD';
+
+  // we may only have this one caracter in the text, when the first character is a shy
+  assert(!run.shy || spos-runstart == 1);
 
   run.embeddingLevel = view.emb(runstart);
 
-  // set text direction for this run
-  if (run.embeddingLevel % 2 == 0)
-  {
-    hb_buffer_set_direction(buf, HB_DIRECTION_LTR);
-  }
-  else
+  const internal::ShapedGlyph_c * glyphs = shaped.glyphs->data() + shaped.first;
+  size_t glyph_count = shaped.count;
+
+  if (view.context().stats)
   {
-    hb_buffer_set_direction(buf, HB_DIRECTION_RTL);
+    view.context().stats->runs++;
+    view.context().stats->glyphs += glyph_count;
   }
 
-  // get the right font for this run and do the shaping
-  if (hb_ft_font)
-    hb_shape(hb_ft_font, buf, NULL, 0);
-
-  // get the output
-  unsigned int         glyph_count;
-  hb_glyph_info_t     *glyph_info   = hb_buffer_get_glyph_infos(buf, &glyph_count);
-  hb_glyph_position_t *glyph_pos    = hb_buffer_get_glyph_positions(buf, &glyph_count);
-
   // fill in some of the run information
   run.font = font;
   if (view.att(runstart).inlay)
@@ -417,11 +744,21 @@ static runInfo createRun(const LayoutDataView & view, size_t spos, size_t runsta
 
   run.linebreak = view.lnb(spos-1);
 
+  run.textStart = runstart;
+  run.textEnd = spos;
+
+  // when only measuring, the run needs no drawing commands and links
+  bool measure = view.context().measureOnly;
+
   // information for a hyperlink within the text
   size_t curLink = 0;
   TextLayout_c::Rectangle_c linkRect;
   int linkStart = 0;
 
+  // the absolute x-position of each glyph, the shaped glyphs might be
+  // shared with the shape cache, so we must not modify them
+  internal::ScratchVector_c<int32_t> glyph_x(glyph_count, 0, view.context().alloc<int32_t>());
+
   // off we go creating the drawing commands
   // BUT, we need to make sure we keep the logical order here
   // harfbuzz will reverse the order of commands, when set to RTL
@@ -432,7 +769,7 @@ static runInfo createRun(const LayoutDataView & view, size_t spos, size_t runsta
   for (size_t j=0; j < glyph_count; ++j)
   {
     // get the attribute for the current character
-    auto a = view.att(glyph_info[j].cluster);
+    const auto & a = view.att(shaped.clusterBase+glyphs[j].cluster);
 
     if (!a.inlay)
     {
@@ -442,11 +779,11 @@ static runInfo createRun(const LayoutDataView & view, size_t spos, size_t runsta
         linkStart = run.dx;
       }
 
-      glyph_pos[j].x_offset += run.dx;
-      run.dx += glyph_pos[j].x_advance;
+      glyph_x[j] = glyphs[j].x_offset + run.dx;
+      run.dx += glyphs[j].x_advance;
 
       // if we have a link, we include that information within the run
-      if (a.link)
+      if (a.link && !measure)
       {
         // link has changed
         if (curLink && curLink != a.link)
@@ -474,6 +811,18 @@ static runInfo createRun(const LayoutDataView & view, size_t spos, size_t runsta
     }
   }
 
+  // only the advance of the inlays is still missing, when measuring
+  if (measure)
+  {
+    for (size_t j=0; j < glyph_count; ++j)
+    {
+      const auto & a = view.att(shaped.clusterBase+glyphs[j].cluster);
+      if (a.inlay) run.dx += a.inlay->getRight();
+    }
+
+    return run;
+  }
+
   // now output using these absolute positions
   for (size_t jj=0; jj < glyph_count; ++jj)
   {
@@ -485,7 +834,7 @@ static runInfo createRun(const LayoutDataView & view, size_t spos, size_t runsta
     }
 
     // get the attribute for the current character
-    auto a = view.att(glyph_info[j].cluster);
+    const auto & a = view.att(shaped.clusterBase+glyphs[j].cluster);
 
     if (a.inlay)
     {
@@ -511,10 +860,10 @@ static runInfo createRun(const LayoutDataView & view, size_t spos, size_t runsta
     else
     {
       // output the glyph
-      glyphIndex_t gi = glyph_info[j].codepoint;
+      glyphIndex_t gi = glyphs[j].glyph;
 
-      int32_t gx = glyph_pos[j].x_offset;
-      int32_t gy = run.dy - (glyph_pos[j].y_offset)-view.att(runstart).baseline_shift;
+      int32_t gx = glyph_x[j];
+      int32_t gy = run.dy - (glyphs[j].y_offset)-view.att(runstart).baseline_shift;
 
       // output all shadows of the glyph
       for (size_t j = 0; j < view.att(runstart).shadows.size(); j++)
@@ -526,10 +875,10 @@ static runInfo createRun(const LayoutDataView & view, size_t spos, size_t runsta
       // output the final glyph
       run.run.push_back(std::make_pair(0, CommandData_c(font, gi, gx, gy, a.c, 0)));
 
-      addUnderline(run, gx, glyph_pos[j].x_advance+64, prop, a);
+      addUnderline(run, gx, glyphs[j].x_advance+64, prop, a);
 
       // we only support line wise scripts
-      if (glyph_pos[j].y_advance != 0)
+      if (glyphs[j].y_advance != 0)
         throw LayoutException_c("STLL only supports line based scripts and this text appears to be something else");
     }
   }
@@ -541,94 +890,136 @@ static runInfo createRun(const LayoutDataView & view, size_t spos, size_t runsta
     curLink = 0;
   }
 
-  // free harfbuzz buffer and fonts
-  hb_buffer_destroy(buf);
-
   return run;
 }
 
-// split the text to layout into runs
-static std::vector<runInfo> createTextRuns(const LayoutDataView & view, const LayoutProperties_c & prop)
+// find the end of the run that starts at runstart, the returned value
+// points at the first character AFTER the run
+static size_t findRunEnd(const LayoutDataView & view, size_t runstart, size_t last,
+                         const std::shared_ptr<FontFace_c> & font)
+{
+  size_t spos = runstart+1;
+
+  // Find end of current run. This run continues, as long as
+  while (   (spos < last)                                          // there is text left in our string
+         && (view.emb(runstart) == view.emb(spos))                 // text direction has not changed
+         && (view.lang(runstart) == view.lang(spos))               // text still has the same language
+         && (font == view.att(spos).font.get(view.txt(spos)))      // and the same font
+         && (view.att(runstart).baseline_shift == view.att(spos).baseline_shift)           //  and the same baseline
+         && (!view.att(spos).inlay)                                // and next char is not an inlay
+         && (!view.att(spos-1).inlay)                              // and we are an not inlay
+         && (   (view.lnb(spos-1) == LINEBREAK_NOBREAK)            // and line-break is not requested
+             || (view.lnb(spos-1) == LINEBREAK_INSIDEACHAR)
+            )
+         && (view.txt(spos) != U' ')                               // and there is no space (needed to adjust width for justification)
+         && (view.txt(spos-1) != U' ')
+         && (view.txt(spos) != U'\n')                              // also end run on forced line-breaks
+         && (view.txt(spos-1) != U'\n')
+         && (view.txt(spos) != U'\u00AD')                          // and on soft hyphen
+         && (!view.hyp(spos))
+        )
+  {
+    spos++;
+  }
+
+  return spos;
+}
+
+// split the text to layout into runs, only the text between first and last is
+// used, the text outside is only used as context for shaping, the runs are appended to runs
+static void createTextRuns(const LayoutDataView & view, const LayoutProperties_c & prop,
+                           size_t first, size_t last, std::vector<runInfo> & runs)
 {
-  // Get harfbuzz font structs for all required fonts within the text
-  std::map<const std::shared_ptr<FontFace_c>, hb_font_t *> hb_ft_fonts;
-  for (size_t i = 0; i < view.size(); i++)
-    for (auto f : view.att(i).font)
-      if (hb_ft_fonts.find(f) == hb_ft_fonts.end())
-        hb_ft_fonts[f] = hb_ft_font_create(f->getFace(), NULL);
+  auto & ctx = view.context();
+  auto stats = ctx.stats;
 
-  // runstart always contains the first character for the current run
-  size_t runstart = 0;
+  // itemstart always contains the first character for the current item
+  size_t itemstart = first;
 
-  // the result
-  std::vector<runInfo> runs;
+  // the boundaries of the runs of an item and their glyphs
+  internal::ScratchVector_c<size_t> bounds(ctx.alloc<size_t>());
+  internal::ScratchVector_c<runGlyphs> glyphs(ctx.alloc<runGlyphs>());
 
   // as long as there is something left in the text
-  while (runstart < view.size())
-  {
-    // pos points at the first character AFTER the current run
-    size_t spos = runstart+1;
-
-    // the font for this run
-    auto font = view.att(runstart).font.get(view.txt(runstart));
-
-    // Find end of current run. This run continues, as long as
-    while (   (spos < view.size())                                   // there is text left in our string
-           && (view.emb(runstart) == view.emb(spos))                 // text direction has not changed
-           && (view.att(runstart).lang == view.att(spos).lang)       // text still has the same language
-           && (font == view.att(spos).font.get(view.txt(spos)))      // and the same font
-           && (view.att(runstart).baseline_shift == view.att(spos).baseline_shift)           //  and the same baseline
-           && (!view.att(spos).inlay)                                // and next char is not an inlay
-           && (!view.att(spos-1).inlay)                              // and we are an not inlay
-           && (   (view.lnb(spos-1) == LINEBREAK_NOBREAK)            // and line-break is not requested
-               || (view.lnb(spos-1) == LINEBREAK_INSIDEACHAR)
-              )
-           && (view.txt(spos) != U' ')                               // and there is no space (needed to adjust width for justification)
-           && (view.txt(spos-1) != U' ')
-           && (view.txt(spos) != U'\n')                              // also end run on forced line-breaks
-           && (view.txt(spos-1) != U'\n')
-           && (view.txt(spos) != U'\u00AD')                          // and on soft hyphen
-           && (!view.hyp(spos))
-          )
+  while (itemstart < last)
+  {
+    internal::PhaseTimer_c itemizeTimer(stats, &LayoutStats_c::itemizeNs);
+
+    // the font for this item
+    auto font = view.att(itemstart).font.get(view.txt(itemstart));
+
+    // find all the runs that belong to the current item, an item continues as long as
+    // the runs have the same direction, language, font and baseline. Inlays and soft hyphens
+    // always have an item on their own
+    bounds.clear();
+    bounds.push_back(itemstart);
+    bounds.push_back(findRunEnd(view, itemstart, last, font));
+
+    if (font && !view.att(itemstart).inlay && view.txt(itemstart) != U'\u00AD')
     {
-      spos++;
+      while (   (bounds.back() < last)
+             && (view.emb(itemstart) == view.emb(bounds.back()))
+             && (view.lang(itemstart) == view.lang(bounds.back()))
+             && (font == view.att(bounds.back()).font.get(view.txt(bounds.back())))
+             && (view.att(itemstart).baseline_shift == view.att(bounds.back()).baseline_shift)
+             && (!view.att(bounds.back()).inlay)
+             && (view.txt(bounds.back()) != U'\u00AD')
+            )
+      {
+        bounds.push_back(findRunEnd(view, bounds.back(), last, font));
+      }
     }
 
-    // get the harbuzz foont structure
-    // inlays don't have fonts, but still need a run, that is why it might be
-    // possible to provide nullptrs to the run creator
-    hb_font_t * hbfont = nullptr;
-    if (font) hbfont = hb_ft_fonts[font];
-
-    // create and add the run
-    runs.emplace_back(createRun(view, spos, runstart, prop, font, hbfont));
-
-    // the manually insert soft hyphens are recognized and separated into single runs with
-    // the condition of the look above (before is recognized by the character
-    // comparison, behin is recognized by the linebreak condition
-    //
-    // but the automatically inserted hyphenation positions are just marked
-    // with the hyphenation flag, here we need to manually
-    // insert a run containing a soft hyphen character
-    // TODO it might be better to change the string
-    if (view.hyp(spos))
+    itemizeTimer.stop();
+
+    // get the glyphs for all the runs, when there is more than one run in the
+    // item, the whole item is shaped at once
+    glyphs.clear();
+
     {
-      AttributeIndex_c attra(view.att(runstart));
-      std::vector<FriBidiLevel> embedding_levelsa {view.emb(runstart)};
-      LayoutDataView viewa(U"\u00AD", attra, embedding_levelsa);
-      viewa.lnb()[0] = LINEBREAK_ALLOWBREAK;
+      internal::PhaseTimer_c shapeTimer(stats, &LayoutStats_c::shapingNs);
 
-      runs.emplace_back(createRun(viewa, 1, 0, prop, font, hbfont));
+      if (bounds.size() > 2)
+        shapeItem(view, bounds, font, glyphs);
+      else
+        glyphs.emplace_back(shapeRun(view, bounds[1], bounds[0], font));
     }
 
-    runstart = spos;
-  }
+    internal::PhaseTimer_c runsTimer(stats, &LayoutStats_c::runsNs);
 
-  // free harfbuzz font structures
-  for (auto & a : hb_ft_fonts)
-    hb_font_destroy(a.second);
+    for (size_t r = 0; r+1 < bounds.size(); r++)
+    {
+      size_t runstart = bounds[r];
+      size_t spos = bounds[r+1];
+
+      // create and add the run
+      // inlays don't have fonts, but still need a run, that is why it might be
+      // possible to provide nullptrs to the run creator
+      runs.emplace_back(createRun(view, spos, runstart, prop, font, glyphs[r]));
+
+      // the manually insert soft hyphens are recognized and separated into single runs with
+      // the condition of the look above (before is recognized by the character
+      // comparison, behin is recognized by the linebreak condition
+      //
+      // but the automatically inserted hyphenation positions are just marked
+      // with the hyphenation flag, here we need to manually
+      // insert a run containing a soft hyphen character
+      // TODO it might be better to change the string
+      if (view.hyp(spos))
+      {
+        static const std::u32string shy(U"\u00AD");
+        AttributeIndex_c attra(view.att(runstart));
+        FriBidiLevel levela = view.emb(runstart);
+        LayoutDataView viewa(shy, attra, &levela, ctx);
+        viewa.lnb()[0] = LINEBREAK_ALLOWBREAK;
+
+        runs.emplace_back(createRun(viewa, 1, 0, prop, font, shapeRun(viewa, 1, 0, font)));
+        runs.back().textStart = runs.back().textEnd = spos;
+      }
+    }
 
-  return runs;
+    itemstart = bounds.back();
+  }
 }
 
 // merge links into a text layout, shifting the link boxes by dx and dy
@@ -664,50 +1055,13 @@ static void mergeLinks(TextLayout_c & txt, const std::vector<TextLayout_c::LinkI
 #define LF_LAST 2
 #define LF_SMALL_SPACE 4
 
-// add a single line to the result layout
-// take the runs from the runs argument, start with runstart and end before spos
-// add to l
-// add at ypos between left and right
-// curWidth contains the sum of all the runs to add, curWidth already contains indent, if any
+// calculate the start of a line and the additional pixels to add to each space
+// for the alignment of the paragraph
+// curWidth contains the sum of all the runs of the line, curWidth already contains indent, if any
 // numSpace the number of spaces within all those runs
-static void addLine(int runstart, size_t spos, std::vector<runInfo> & runs, TextLayout_c & l,
-                    int ypos, int curWidth, int32_t left, int32_t right, int lineflags,
-                    int numSpace, const LayoutProperties_c & prop
-                   )
+static void alignLine(const LayoutProperties_c & prop, int32_t left, int32_t right, int32_t curWidth,
+                      int lineflags, int numSpace, int32_t & xpos, double & spaceadder)
 {
-  // first find out the order in which the runs must be
-  // this is fribidi terrain, start with the logical order
-  // and then use the embedding levels to reverse the
-  // ranges with the same level
-  std::vector<size_t> runorder(spos-runstart);
-  std::iota(runorder.begin(), runorder.end(), runstart);
-
-  // find the maximum level
-  FriBidiLevel max_level = 0;
-  for (auto ri : runorder)
-    max_level = std::max(max_level, runs[ri].embeddingLevel);
-
-  // reorder runs for current line
-  for (int i = max_level-1; i >= 0; i--)
-  {
-    // find starts of regions to reverse
-    for (size_t j = 0; j < runorder.size(); j++)
-    {
-      if (runs[runorder[j]].embeddingLevel > i)
-      {
-        // find the end of the current regions
-        size_t k = j+1;
-        while (k < runorder.size() && runs[runorder[k]].embeddingLevel > i)
-        {
-          k++;
-        }
-
-        std::reverse(runorder.begin()+j, runorder.begin()+k);
-        j = k;
-      }
-    }
-  }
-
   // calculate how much space is left on the line (for justification)
   int32_t spaceLeft = right - left - curWidth;
 
@@ -716,8 +1070,7 @@ static void addLine(int runstart, size_t spos, std::vector<runInfo> & runs, Text
   // additional pixels we add to each space
   //
   // TODO later on we want to output in logical order instead of left to right
-  int32_t xpos;
-  double spaceadder = 0;
+  spaceadder = 0;
 
   switch (prop.align)
   {
@@ -758,49 +1111,89 @@ static void addLine(int runstart, size_t spos, std::vector<runInfo> & runs, Text
       }
       break;
   }
+}
 
-  int32_t xpos2 = xpos;
-  numSpace = 0;
-
-  // place all elements of the line according to alignment
-  for (auto ri : runorder)
-  {
-    // output soft hyphen runs only, when the last in line
-    if (!runs[ri].shy || ri == spos-1)
+// add a single line to the result layout
+// take the runs from the runs argument, start with runstart and end before spos
+// add to l
+// add at ypos between left and right
+// curWidth contains the sum of all the runs to add, curWidth already contains indent, if any
+// numSpace the number of spaces within all those runs
+static void addLine(int runstart, size_t spos, const std::vector<runInfo> & runs, TextLayout_c & l,
+                    int ypos, int curWidth, int32_t left, int32_t right, int lineflags,
+                    int numSpace, const LayoutProperties_c & prop, internal::LayoutContextData_c & ctx
+                   )
+{
+  // first find out the order in which the runs must be
+  // this is fribidi terrain, start with the logical order
+  // and then use the embedding levels to reverse the
+  // ranges with the same level
+  internal::ScratchVector_c<size_t> runorder(spos-runstart, 0, ctx.alloc<size_t>());
+  std::iota(runorder.begin(), runorder.end(), runstart);
+
+  // find the maximum level
+  FriBidiLevel max_level = 0;
+  for (auto ri : runorder)
+    max_level = std::max(max_level, runs[ri].embeddingLevel);
+
+  // reorder runs for current line
+  for (int i = max_level-1; i >= 0; i--)
+  {
+    // find starts of regions to reverse
+    for (size_t j = 0; j < runorder.size(); j++)
     {
-      // output only non-space runs
-      if (!runs[ri].space)
+      if (runs[runorder[j]].embeddingLevel > i)
       {
-        for (auto & cc : runs[ri].run)
+        // find the end of the current regions
+        size_t k = j+1;
+        while (k < runorder.size() && runs[runorder[k]].embeddingLevel > i)
         {
-          cc.second.x += xpos2+spaceadder*numSpace;
-          cc.second.y += ypos;
+          k++;
         }
+
+        std::reverse(runorder.begin()+j, runorder.begin()+k);
+        j = k;
+      }
+    }
+  }
+
+  // find the start of the line and the additional space for justification
+  int32_t xpos;
+  double spaceadder;
+  alignLine(prop, left, right, curWidth, lineflags, numSpace, xpos, spaceadder);
+
+  int32_t xpos2 = xpos;
+  numSpace = 0;
+
+  // the horizontal shift for each run of the line, the runs themselves are not
+  // modified, so that they can be used for several layouts
+  internal::ScratchVector_c<double> runShift(spos-runstart, 0, ctx.alloc<double>());
+
+  // place all elements of the line according to alignment
+  for (auto ri : runorder)
+  {
+    // output soft hyphen runs only, when the last in line
+    if (!runs[ri].shy || ri == spos-1)
+    {
+      runShift[ri-runstart] = xpos2+spaceadder*numSpace;
+
+      if (!runs[ri].space)
+      {
+        // merge in the links, but only do this once, for the layer 0
+        mergeLinks(l, runs[ri].links, xpos2+spaceadder*numSpace, ypos);
       }
       else
       {
-        // in space runs, there may be an rectangular command that represents
-        // the underline, make that underline longer by spaceadder
-        // to accommodate larger spaces due to justification
-        for (auto & cc : runs[ri].run)
-        {
-          if (cc.second.command == CommandData_c::CMD_RECT)
-          {
-            cc.second.w += spaceadder;
-            cc.second.x += xpos2+spaceadder*numSpace;
-            cc.second.y += ypos;
-          }
-        }
-
         // the link rectangle in spaces also needs to get longer
-        if (!runs[ri].links.empty() && !runs[ri].links[0].areas.empty())
+        auto links = runs[ri].links;
+
+        if (!links.empty() && !links[0].areas.empty())
         {
-          runs[ri].links[0].areas[0].w += spaceadder;
+          links[0].areas[0].w += spaceadder;
         }
-      }
 
-      // merge in the links, but only do this once, for the layer 0
-      mergeLinks(l, runs[ri].links, xpos2+spaceadder*numSpace, ypos);
+        mergeLinks(l, links, xpos2+spaceadder*numSpace, ypos);
+      }
 
       // count the spaces
       if (runs[ri].space) numSpace++;
@@ -836,7 +1229,12 @@ static void addLine(int runstart, size_t spos, std::vector<runInfo> & runs, Text
         {
           for (auto & cc : runs[i].run)
             if (cc.first == maxlayer-layer-1)
-              l.addCommand(cc.second);
+            {
+              CommandData_c c = cc.second;
+              c.x += runShift[i-runstart];
+              c.y += ypos;
+              l.addCommand(c);
+            }
         }
         else
         {
@@ -849,7 +1247,11 @@ static void addLine(int runstart, size_t spos, std::vector<runInfo> & runs, Text
                 && (cc.second.command == CommandData_c::CMD_RECT)
                )
             {
-              l.addCommand(cc.second);
+              CommandData_c c = cc.second;
+              c.w += spaceadder;
+              c.x += runShift[i-runstart];
+              c.y += ypos;
+              l.addCommand(c);
             }
           }
         }
@@ -859,20 +1261,31 @@ static void addLine(int runstart, size_t spos, std::vector<runInfo> & runs, Text
 }
 
 // do the line breaking using the runs created before
-static TextLayout_c breakLines(std::vector<runInfo> & runs,
-                               const Shape_c & shape,
-                               const LayoutProperties_c & prop, int32_t ystart)
+// breaking starts at the run runstart at the vertical position ypos, the found lines are
+// appended to lines. At the start of each following line stop is called with the run and
+// vertical position of that line, when it returns true line breaking ends
+// the return value is the run where line breaking stopped
+static size_t breakLines(const std::vector<runInfo> & runs,
+                         const Shape_c & shape,
+                         const LayoutProperties_c & prop,
+                         size_t runstart, int32_t ypos, std::vector<lineInfo> & lines,
+                         const std::function<bool(size_t, int32_t)> & stop)
 {
   // layout a paragraph line by line
-  size_t runstart = 0;
-  int32_t ypos = ystart;
-  TextLayout_c l;
-  bool firstline = true;
+  bool firstline = runstart == 0;
   bool forcebreak = false;
+  bool firstcall = true;
 
   // while there are runs left to do
   while (runstart < runs.size())
   {
+    if (!firstcall && stop && stop(runstart, ypos))
+      return runstart;
+
+    firstcall = false;
+
+    size_t from = runstart;
+
     // accumulate enough runs to fill the line, this is done by accumulating runs
     // until we come to a place where we might break the line
     // then we check if the line would be too long with the new set of runs
@@ -983,35 +1396,44 @@ static TextLayout_c breakLines(std::vector<runInfo> & runs,
     // force break also when end of paragraph is reached
     forcebreak |= (spos == runs.size());
 
-    addLine(runstart, spos, runs, l, ypos+curAscend, curWidth,
-        shape.getLeft(ypos, ypos+curAscend-curDescend),
-        shape.getRight(ypos, ypos+curAscend-curDescend),
-        (firstline ? LF_FIRST : 0) + (forcebreak ? LF_LAST : 0), numSpace, prop);
-    if (firstline) l.setFirstBaseline(ypos+curAscend);
-    ypos = ypos + curAscend - curDescend;
+    lineInfo line;
+
+    line.runstart = runstart;
+    line.spos = spos;
+    line.from = from;
+    line.to = spos;
+    line.top = ypos;
+    line.bottom = ypos + curAscend - curDescend;
+    line.baseline = ypos+curAscend;
+    line.width = curWidth;
+    line.left = shape.getLeft(ypos, ypos+curAscend-curDescend);
+    line.right = shape.getRight(ypos, ypos+curAscend-curDescend);
+    line.flags = (firstline ? LF_FIRST : 0) + (forcebreak ? LF_LAST : 0);
+    line.spaces = numSpace;
+
+    lines.push_back(line);
+
+    ypos = line.bottom;
 
     // set the runstart at the next run and skip space runs
     runstart = spos;
     firstline = false;
   }
 
-  // set the final shape of the paragraph
-  l.setHeight(ypos);
-  l.setLeft(shape.getLeft2(ystart, ypos));
-  l.setRight(shape.getRight2(ystart, ypos));
-
-  return l;
+  return runs.size();
 }
 
 // do the line breaking using the runs created before, using an optimizing
 // paragraph layouting algorithm
-static TextLayout_c breakLinesOptimize(std::vector<runInfo> & runs,
-                                       const Shape_c & shape,
-                                       const LayoutProperties_c & prop, int32_t ystart)
+// the parameters are the same as for breakLines, except that stop is only called
+// at the start of each section after a forced line break
+static size_t breakLinesOptimize(const std::vector<runInfo> & runs,
+                                 const Shape_c & shape,
+                                 const LayoutProperties_c & prop,
+                                 size_t base, int32_t ystart, std::vector<lineInfo> & lines,
+                                 const std::function<bool(size_t, int32_t)> & stop,
+                                 internal::LayoutContextData_c & ctx)
 {
-  // layout a paragraph line by line
-  TextLayout_c l;
-
   // for details look into the TeX documentation...
   // This is a very similar method
 
@@ -1032,74 +1454,151 @@ static TextLayout_c breakLinesOptimize(std::vector<runInfo> & runs,
     bool start;
   } lineinfo;
 
-  std::vector<lineinfo> li (runs.size()+1);
+  const float infinite = std::numeric_limits<int>::max();
+
+  // all the following arrays are indexed relative to the run where we start
+  const size_t offset = base;
+
+  internal::ScratchVector_c<lineinfo> li(1, lineinfo(), ctx.alloc<lineinfo>());
 
-  li[0].from = 0;
+  // prefix sums over the runs, so that we can get the width and the number of spaces
+  // of a line without going over all the runs of the line. Soft hyphens are not
+  // included, they only count when they are at the end of the line
+  internal::ScratchVector_c<int32_t> widthSum(1, 0, ctx.alloc<int32_t>());
+  internal::ScratchVector_c<int32_t> spaceWidthSum(1, 0, ctx.alloc<int32_t>());
+  internal::ScratchVector_c<int> spaceSum(1, 0, ctx.alloc<int>());
+
+  // all these arrays get one entry for each run
+  li.reserve(runs.size()-base+1);
+  widthSum.reserve(runs.size()-base+1);
+  spaceWidthSum.reserve(runs.size()-base+1);
+  spaceSum.reserve(runs.size()-base+1);
+
+  li[0].from = base;
   li[0].demerits = 0;
   li[0].ypos = ystart;
+  li[0].linetype = 0;
+  li[0].hypen = false;
   li[0].start = true;
 
+  // the positions, where a line may start, these are all reachable positions within the
+  // current section that are not yet known to result in lines that are too long
+  internal::ScratchDeque_c<size_t> active(1, base, ctx.alloc<size_t>());
+
   // find the best paths to all the line break positions
-  for (size_t i = 1; i < runs.size()+1; i++)
+  for (size_t i = base+1; i < runs.size()+1; i++)
   {
-    li[i].demerits = std::numeric_limits<int>::max();
+    li.emplace_back();
+    li[i-offset].demerits = infinite;
+    li[i-offset].from = base;
+    li[i-offset].start = false;
+
+    widthSum.push_back(widthSum.back());
+    spaceWidthSum.push_back(spaceWidthSum.back());
+    spaceSum.push_back(spaceSum.back());
+
+    if (runs[i-1].space)
+    {
+      widthSum.back() += runs[i-1].dx*9/10;
+      spaceWidthSum.back() += runs[i-1].dx;
+      spaceSum.back()++;
+    }
+    else if (!runs[i-1].shy)
+    {
+      widthSum.back() += runs[i-1].dx;
+    }
 
     if (runs[i-1].linebreak == LINEBREAK_ALLOWBREAK || runs[i-1].linebreak == LINEBREAK_MUSTBREAK)
     {
-      for (size_t start = i; start > 0; start--)
+      // ignore spaces at the end of the line
+      size_t s2 = i;
+      while (s2 > base && runs[s2-1].space) s2--;
+
+      // ascender and descender of the line without the soft hyphen at the end
+      // these are collected while we go back over the possible line starts
+      int32_t coreAscend = 0;
+      int32_t coreDescend = 0;
+      size_t scanned = s2;
+
+      // go backwards over the possible line starts
+      for (size_t a = active.size(); a > 0; a--)
       {
-        // no need to look at lines with this infinite penalty
-        if (li[start-1].demerits == std::numeric_limits<int>::max())
-          continue;
-
-        int32_t Ascend = 0;
-        int32_t Descend = 0;
-        int32_t Width = 0;
-        size_t Space = 0;
+        size_t start = active[a-1];
+
+        if (ctx.stats) ctx.stats->candidatePairs++;
+
+        // ignore spaces at the start of the line
+        size_t s1 = start;
+        while (s1 < s2 && runs[s1].space) s1++;
+
+        while (scanned > s1)
+        {
+          scanned--;
+
+          if (!runs[scanned].shy)
+          {
+            coreAscend = std::max(coreAscend, runs[scanned].ascender);
+            coreDescend = std::min(coreDescend, runs[scanned].descender);
+          }
+        }
+
+        int32_t Width = widthSum[s2-offset] - widthSum[s1-offset];
+        int Space = spaceSum[s2-offset] - spaceSum[s1-offset];
+        int spaceWidth = spaceWidthSum[s2-offset] - spaceWidthSum[s1-offset];
         bool force = false;
-        int optimalStretch = 0;
-        int spaceWidth = 0;
 
-        if (start == 1)
+        if (start == base)
         {
           if (prop.align != LayoutProperties_c::ALG_CENTER)
-            Width = prop.indent;
+            Width += prop.indent;
+        }
+
+        int32_t coreWidth = Width;
+        int32_t Ascend = coreAscend;
+        int32_t Descend = coreDescend;
+
+        // a soft hyphen at the end of the line is shown
+        bool hyphen = s1 < s2 && runs[s2-1].shy;
+
+        if (hyphen)
+        {
+          Width += runs[s2-1].dx;
+          Ascend = std::max(Ascend, runs[s2-1].ascender);
+          Descend = std::min(Descend, runs[s2-1].descender);
         }
 
-        // ignore spaces at the start end end of the line
-        int s1 = start-1;
-        int s2 = i;
-        while (runs[s1].space) s1++;
-        while (runs[s2-1].space) s2--;
+        const lineinfo & from = li[start-offset];
+
+        int32_t left = shape.getLeft(from.ypos, from.ypos+Ascend-Descend);
+        int32_t right = shape.getRight(from.ypos, from.ypos+Ascend-Descend);
 
-        for (int j = s1; j < s2; j++)
+        // line has become too long, no need to go further back from here
+        bool overfull = false;
+
+        if (left+Width > right)
         {
-          if (!runs[j].shy || j == s2-1)
+          if (a < active.size())
           {
-            Ascend = std::max(Ascend, runs[j].ascender);
-            Descend = std::min(Descend, runs[j].descender);
-            if (runs[j].space)
-            {
-              Space++;
-              Width += runs[j].dx*9/10;
-              optimalStretch += runs[j].dx/10;
-              spaceWidth += runs[j].dx;
-            }
-            else
+            // when the line is too long even without the soft hyphen it will only get
+            // longer for all following break positions, so this start and all starts before
+            // it will never be used again
+            if (shape.getLeft(from.ypos, from.ypos+coreAscend-coreDescend)+coreWidth >
+                shape.getRight(from.ypos, from.ypos+coreAscend-coreDescend))
             {
-              Width += runs[j].dx;
+              active.erase(active.begin(), active.begin()+a);
             }
+
+            break;
           }
-        }
 
-        // line has become too long, no need to go further back from here
-        if (shape.getLeft(li[start-1].ypos, li[start-1].ypos+Ascend-Descend)+Width >
-          shape.getRight(li[start-1].ypos, li[start-1].ypos+Ascend-Descend))
-          break;
+          // even the line from the last possible start is too long, this happens when
+          // a single run is wider than the shape, we still take the line
+          // as otherwise there would be no possible way through the paragraph at all
+          overfull = true;
+        }
 
         //  how much do we need to stretch the line
-        float fillin = shape.getRight(li[start-1].ypos, li[start-1].ypos+Ascend-Descend) -
-        shape.getLeft(li[start-1].ypos, li[start-1].ypos+Ascend-Descend) - Width;
+        float fillin = right - left - Width;
 
         // what would be the optimum fillin to get exactly the right space size
         float optimalFillin = spaceWidth-Width;
@@ -1122,18 +1621,17 @@ static TextLayout_c breakLinesOptimize(std::vector<runInfo> & runs,
         float demerits = (10+badness)*(10+badness);
 
         // hypen demerits
-        if (runs[s2-1].shy && li[start-1].hypen)
+        if (hyphen && from.hypen)
         {
           demerits += 10000;
         }
 
-        if (abs(linetype - li[start-1].linetype) > 1) demerits += 10000;
-        if (linetype != li[start-1].linetype) demerits += 5000;
+        if (abs(linetype - from.linetype) > 1) demerits += 10000;
+        if (linetype != from.linetype) demerits += 5000;
 
         if (runs[i-1].linebreak == LINEBREAK_MUSTBREAK || i == runs.size())
         {
-          if (Width > (shape.getRight(li[start-1].ypos, li[start-1].ypos+Ascend-Descend) -
-                       shape.getLeft(li[start-1].ypos, li[start-1].ypos+Ascend-Descend))/3)
+          if (Width > (right - left)/3)
           {
             demerits = 0;
           }
@@ -1144,94 +1642,1440 @@ static TextLayout_c breakLinesOptimize(std::vector<runInfo> & runs,
           force = true;
         }
 
-        demerits += li[start-1].demerits;
+        demerits += from.demerits;
+
+        auto & cur = li[i-offset];
 
-        if (demerits < li[i].demerits)
+        if (demerits < cur.demerits)
         {
-          li[i].from = start-1;
-          li[i].demerits = demerits;
-
-          li[i].ascend = Ascend;
-          li[i].descend = Descend;
-          li[i].width = Width;
-          li[i].spaces = Space;
-          li[i].ypos = li[start-1].ypos + Ascend - Descend;
-          li[i].forcebreak = force;
-          li[i].linetype = linetype;
-          li[i].hypen = runs[s2-1].shy;
-          li[i].start = false;
+          cur.from = start;
+          cur.demerits = demerits;
+
+          cur.ascend = Ascend;
+          cur.descend = Descend;
+          cur.width = Width;
+          cur.spaces = Space;
+          cur.ypos = from.ypos + Ascend - Descend;
+          cur.forcebreak = force;
+          cur.linetype = linetype;
+          cur.hypen = hyphen;
+          cur.start = false;
         }
+
+        if (overfull) break;
       }
+
+      if (li[i-offset].demerits < infinite)
+        active.push_back(i);
     }
 
     if (runs[i-1].linebreak == LINEBREAK_MUSTBREAK || i == runs.size())
     {
       // store breaking points
       size_t ii = i;
-      std::vector<size_t> breaks;
+      internal::ScratchVector_c<size_t> breaks(ctx.alloc<size_t>());
 
-      while (!li[ii].start)
+      while (!li[ii-offset].start)
       {
         breaks.push_back(ii);
-        ii = li[ii].from;
+        ii = li[ii-offset].from;
       }
       breaks.push_back(ii);
 
       for (ii = breaks.size()-1; ii > 0; ii--)
       {
-        auto & bb = li[breaks[ii-1]];
-        auto & cc = li[breaks[ii]];
+        auto & bb = li[breaks[ii-1]-offset];
+        auto & cc = li[breaks[ii]-offset];
 
         size_t s1 = breaks[ii];
         size_t s2 = breaks[ii-1];
-        while (runs[s1].space) s1++;
-        while (runs[s2-1].space) s2--;
-        addLine(s1, s2, runs, l, cc.ypos + bb.ascend, bb.width,
-                shape.getLeft(cc.ypos, cc.ypos+bb.ascend-bb.descend),
-                shape.getRight(cc.ypos, cc.ypos+bb.ascend-bb.descend),
-                (ii == breaks.size()-1 ? LF_FIRST : 0) + (ii == 1 ? LF_LAST : 0) + LF_SMALL_SPACE, bb.spaces, prop);
-        if (ii == breaks.size()-1) l.setFirstBaseline(cc.ypos+bb.ascend);
-        cc.ypos = cc.ypos + bb.ascend - bb.descend;
+        while (s1 < s2 && runs[s1].space) s1++;
+        while (s2 > s1 && runs[s2-1].space) s2--;
+
+        lineInfo line;
+
+        line.runstart = s1;
+        line.spos = s2;
+        line.from = breaks[ii];
+        line.to = breaks[ii-1];
+        line.top = cc.ypos;
+        line.bottom = cc.ypos + bb.ascend - bb.descend;
+        line.baseline = cc.ypos + bb.ascend;
+        line.width = bb.width;
+        line.left = shape.getLeft(cc.ypos, cc.ypos+bb.ascend-bb.descend);
+        line.right = shape.getRight(cc.ypos, cc.ypos+bb.ascend-bb.descend);
+        line.flags = (ii == breaks.size()-1 ? LF_FIRST : 0) + (ii == 1 ? LF_LAST : 0) + LF_SMALL_SPACE;
+        line.spaces = bb.spaces;
+
+        lines.push_back(line);
       }
 
-      runs.erase(runs.begin(), runs.begin()+i);
-      li[0].ypos = li[i].ypos;
+      if (i < runs.size() && stop && stop(i, li[i-offset].ypos))
+        return i;
 
-      i = 0;
+      // start a new section at this position
+      base = i;
+
+      auto & cur = li[i-offset];
+
+      cur.from = i;
+      cur.demerits = 0;
+      cur.linetype = 0;
+      cur.hypen = false;
+      cur.start = true;
+
+      active.clear();
+      active.push_back(i);
     }
   }
 
-  l.setHeight(li[0].ypos);
-  l.setLeft(shape.getLeft2(ystart, li[0].ypos));
-  l.setRight(shape.getRight2(ystart, li[0].ypos));
+  return runs.size();
+}
+
+// create the final layout out of the lines found by one of the line breaking functions
+static TextLayout_c outputLines(const std::vector<runInfo> & runs, const std::vector<lineInfo> & lines,
+                                const Shape_c & shape, const LayoutProperties_c & prop,
+                                int32_t ystart, int32_t yend, internal::LayoutContextData_c & ctx)
+{
+  internal::PhaseTimer_c timer(ctx.stats, &LayoutStats_c::outputNs);
+
+  TextLayout_c l;
+
+  for (const auto & line : lines)
+  {
+    addLine(line.runstart, line.spos, runs, l, line.baseline, line.width, line.left, line.right,
+            line.flags, line.spaces, prop, ctx);
+
+    if (line.flags & LF_FIRST) l.setFirstBaseline(line.baseline);
+  }
+
+  // set the final shape of the paragraph
+  l.setHeight(yend);
+  l.setLeft(shape.getLeft2(ystart, yend));
+  l.setRight(shape.getRight2(ystart, yend));
 
   return l;
 }
 
+// create the metrics of the paragraph out of the lines found by one of the line breaking
+// functions, the values are the same as in the layout that outputLines would create
+static ParagraphMetrics_c measureLines(const std::vector<runInfo> & runs, const std::vector<lineInfo> & lines,
+                                       const Shape_c & shape, const LayoutProperties_c & prop,
+                                       int32_t ystart, int32_t yend, internal::LayoutContextData_c & ctx)
+{
+  internal::PhaseTimer_c timer(ctx.stats, &LayoutStats_c::outputNs);
 
-TextLayout_c layoutParagraph(const std::u32string & txt32, const AttributeIndex_c & attr,
-                             const Shape_c & shape, const LayoutProperties_c & prop, int32_t ystart)
+  ParagraphMetrics_c m;
+
+  m.lines.reserve(lines.size());
+
+  for (const auto & line : lines)
+  {
+    int32_t xpos;
+    double spaceadder;
+    alignLine(prop, line.left, line.right, line.width, line.flags, line.spaces, xpos, spaceadder);
+
+    // advance over the runs of the line in the same way as addLine
+    double xend = xpos;
+
+    for (size_t ri = line.runstart; ri < line.spos; ri++)
+    {
+      if (runs[ri].shy && ri != line.spos-1) continue;
+
+      if (!runs[ri].space)
+        xend += runs[ri].dx;
+      else if (line.flags & LF_SMALL_SPACE)
+        xend += spaceadder + 9*runs[ri].dx/10;
+      else
+        xend += spaceadder + runs[ri].dx;
+    }
+
+    ParagraphMetrics_c::Line_c l;
+
+    l.top = line.top;
+    l.bottom = line.bottom;
+    l.baseline = line.baseline;
+    l.left = xpos;
+    l.right = xend;
+
+    m.lines.push_back(l);
+
+    if (line.flags & LF_FIRST) m.firstBaseline = line.baseline;
+  }
+
+  m.height = yend;
+  m.left = shape.getLeft2(ystart, yend);
+  m.right = shape.getRight2(ystart, yend);
+
+  return m;
+}
+
+// calculate the widths for getContentWidths in one pass over the runs, the sections
+// between possible line breaks and the lines between mandatory breaks are measured
+// in the same way as breakLines does it: spaces at the start are skipped, soft hyphens
+// only count when they end a section. The first values are for the section and the line
+// that start the paragraph, so that the caller can add the indent
+static void calculateContentWidths(const std::vector<runInfo> & runs,
+                                   int32_t & minFirst, int32_t & minRest,
+                                   int32_t & maxFirst, int32_t & maxRest)
 {
-  // calculate embedding types for the text
-  auto embedding_levels = getBidiEmbeddingLevels(txt32, prop);
+  minFirst = minRest = maxFirst = maxRest = 0;
+
+  int32_t section = 0;
+  int32_t line = 0;
+  bool sectionStarted = false;
+  bool lineStarted = false;
+  bool firstSection = true;
+  bool firstLine = true;
+
+  for (size_t i = 0; i < runs.size(); i++)
+  {
+    const auto & r = runs[i];
+    bool last = i+1 == runs.size();
+
+    if (!r.space || sectionStarted)
+    {
+      section += r.dx;
+      sectionStarted = true;
+    }
+
+    if (!r.space || lineStarted)
+    {
+      if (!r.shy) line += r.dx;
+      lineStarted = true;
+    }
+
+    // the same break conditions as in breakLines
+    bool nextSpaceBreak = !last && runs[i+1].space;
+
+    bool mustBreak =    last
+                     || (r.linebreak == LINEBREAK_MUSTBREAK)
+                     || (nextSpaceBreak && runs[i+1].linebreak == LINEBREAK_MUSTBREAK);
+
+    bool mayBreak =    mustBreak
+                    || (nextSpaceBreak && runs[i+1].linebreak == LINEBREAK_ALLOWBREAK)
+                    || (!r.space && r.linebreak == LINEBREAK_ALLOWBREAK);
+
+    if (mayBreak)
+    {
+      if (firstSection)
+        minFirst = std::max(minFirst, section);
+      else
+        minRest = std::max(minRest, section);
+
+      section = 0;
+      sectionStarted = false;
+      firstSection = false;
+    }
+
+    if (mustBreak)
+    {
+      // a soft hyphen at the end of a line is visible
+      if (r.shy) line += r.dx;
+
+      if (firstLine)
+        maxFirst = std::max(maxFirst, line);
+      else
+        maxRest = std::max(maxRest, line);
+
+      line = 0;
+      lineStarted = false;
+      firstLine = false;
+    }
+  }
+}
+
+// combine the values of calculateContentWidths with the indent of the first line
+static ContentWidths_c combineContentWidths(const LayoutProperties_c & prop,
+                                            int32_t minFirst, int32_t minRest,
+                                            int32_t maxFirst, int32_t maxRest)
+{
+  int32_t indent = (prop.align != LayoutProperties_c::ALG_CENTER) ? prop.indent : 0;
+
+  ContentWidths_c w;
+
+  w.minContent = std::max(minFirst+indent, minRest);
+  w.maxContent = std::max(maxFirst+indent, maxRest);
+
+  return w;
+}
 
-  LayoutDataView view(txt32, attr, embedding_levels);
+// break the runs into lines starting at the run runstart and the vertical position ypos
+// with the line breaking algorithm selected in prop
+static size_t breakRuns(const std::vector<runInfo> & runs, const Shape_c & shape, const LayoutProperties_c & prop,
+                        size_t runstart, int32_t ypos, std::vector<lineInfo> & lines,
+                        internal::LayoutContextData_c & ctx,
+                        const std::function<bool(size_t, int32_t)> & stop = nullptr)
+{
+  internal::PhaseTimer_c timer(ctx.stats, &LayoutStats_c::breakingNs);
+
+  if (prop.optimizeLinebreaks)
+    return breakLinesOptimize(runs, shape, prop, runstart, ypos, lines, stop, ctx);
+  else
+    return breakLines(runs, shape, prop, runstart, ypos, lines, stop);
+}
+
+// do all the shape independent steps for a paragraph, the embedding levels
+// must have been calculated before, the runs are appended to runs
+static void createParagraphRuns(const std::u32string & txt32, const AttributeIndex_c & attr,
+                                const FriBidiLevel * embedding_levels, const LayoutProperties_c & prop,
+                                internal::LayoutContextData_c & ctx, std::vector<runInfo> & runs)
+{
+  LayoutDataView view(txt32, attr, embedding_levels, ctx);
 
   // calculate the possible line-break positions
-  getLinebreaks(view);
+  getLinebreaks(view, prop);
 
   // add hyphenation information, when requested
   if (prop.hyphenate) getHyphens(view);
 
   // create runs of layout text. Each run is a cohesive set, e.g. a word with a single font, ...
-  auto runs = createTextRuns(view, prop);
+  createTextRuns(view, prop, 0, view.size(), runs);
+}
+
+// shape the paragraph into runs
+static void shapeParagraph(const std::u32string & txt32, const AttributeIndex_c & attr,
+                           const LayoutProperties_c & prop, internal::LayoutContextData_c & ctx,
+                           std::vector<runInfo> & runs)
+{
+  // calculate embedding types for the text
+  internal::ScratchVector_c<FriBidiLevel> embedding_levels(txt32.length(), 0, ctx.alloc<FriBidiLevel>());
+  getBidiEmbeddingLevels(txt32, prop, ctx, embedding_levels.data());
+
+  createParagraphRuns(txt32, attr, embedding_levels.data(), prop, ctx, runs);
+}
+
+// break the runs into lines and create the layout
+static TextLayout_c breakParagraph(const std::vector<runInfo> & runs, const Shape_c & shape,
+                                   const LayoutProperties_c & prop, int32_t ystart,
+                                   internal::LayoutContextData_c & ctx)
+{
+  auto & lines = ctx.lines;
 
   // layout the runs into lines
-  if (prop.optimizeLinebreaks)
-    return breakLinesOptimize(runs, shape, prop, ystart);
-  else
-    return breakLines(runs, shape, prop, ystart);
+  lines.clear();
+  breakRuns(runs, shape, prop, 0, ystart, lines, ctx);
+
+  return outputLines(runs, lines, shape, prop, ystart, lines.empty() ? ystart : lines.back().bottom, ctx);
+}
+
+// end the last of the lines with the ellipsis of prop. The runs behind that line are removed
+// and the runs at the end of the line are removed or shortened until the ellipsis fits. The
+// view is the one that the runs were created from, it is needed to shape the shortened run
+static void addEllipsis(const LayoutDataView & view, const LayoutProperties_c & prop,
+                        std::vector<runInfo> & runs, std::vector<lineInfo> & lines)
+{
+  auto & ctx = view.context();
+  auto & line = lines.back();
+
+  // the ellipsis takes the attributes of the last visible text character, inlays
+  // have no font, so they are skipped
+  size_t a = line.spos;
+  while (a > 0 && (runs[a-1].space || runs[a-1].shy || !runs[a-1].font)) a--;
+
+  size_t apos = (a > 0) ? runs[a-1].textEnd-1 : 0;
+
+  std::shared_ptr<FontFace_c> font;
+  if (!prop.ellipsis.empty() && a > 0)
+    font = view.att(apos).font.get(prop.ellipsis[0]);
+
+  // the ellipsis is placed at the logical end of the line and gets the paragraph
+  // direction, so it is at the right end for left to right paragraphs and at the left
+  // end for right to left paragraphs
+  runInfo ellipsis;
+  bool hasEllipsis = font != nullptr;
+
+  if (hasEllipsis)
+  {
+    AttributeIndex_c attra(view.att(apos));
+    internal::ScratchVector_c<FriBidiLevel> levela(prop.ellipsis.size(), prop.ltr ? 0 : 1, ctx.alloc<FriBidiLevel>());
+    LayoutDataView viewa(prop.ellipsis, attra, levela.data(), ctx);
+    getLinebreaks(viewa, prop);
+
+    ellipsis = createRun(viewa, viewa.size(), 0, prop, font, shapeRun(viewa, viewa.size(), 0, font));
+    ellipsis.textStart = ellipsis.textEnd = apos+1;
+  }
+
+  int32_t indent = ((line.flags & LF_FIRST) && prop.align != LayoutProperties_c::ALG_CENTER) ? prop.indent : 0;
+  int32_t available = line.right - line.left - indent - ellipsis.dx;
+
+  // the width of the runs that stay, soft hyphens are not shown as the line doesn't end with them
+  int32_t width = 0;
+  for (size_t i = line.runstart; i < line.spos; i++)
+    if (!runs[i].shy) width += runs[i].dx;
+
+  // remove runs from the end until the rest fits, spaces and soft hyphens
+  // directly in front of the ellipsis are removed as well
+  size_t e = line.spos;
+
+  while (   (e > line.runstart)
+         && (runs[e-1].space || runs[e-1].shy || width > available))
+  {
+    e--;
+    if (!runs[e].shy) width -= runs[e].dx;
+  }
+
+  // try to put as much of the first removed run onto the line as fits, the run is
+  // shaped again with fewer and fewer characters, this is only done for normal text
+  // runs, never for inlays
+  runInfo part;
+  bool hasPart = false;
+
+  if (   (e < line.spos)
+      && !runs[e].space && !runs[e].shy && runs[e].font
+      && !view.att(runs[e].textStart).inlay)
+  {
+    size_t start = runs[e].textStart;
+    std::shared_ptr<FontFace_c> pfont = runs[e].font;
+
+    for (size_t k = runs[e].textEnd-1; k > start; k--)
+    {
+      // don't split within a character
+      if (view.lnb(k-1) == LINEBREAK_INSIDEACHAR) continue;
+
+      auto r = createRun(view, k, start, prop, pfont, shapeRun(view, k, start, pfont));
+
+      if (width + r.dx <= available)
+      {
+        width += r.dx;
+        part = std::move(r);
+        hasPart = true;
+        break;
+      }
+    }
+  }
+
+  runs.erase(runs.begin()+e, runs.end());
+
+  if (hasPart) runs.push_back(std::move(part));
+  if (hasEllipsis) runs.push_back(std::move(ellipsis));
+
+  line.spos = runs.size();
+  line.to = line.spos;
+  line.width = indent + width + (hasEllipsis ? runs.back().dx : 0);
+  line.spaces = 0;
+  for (size_t i = line.runstart; i < line.spos; i++)
+    if (runs[i].space) line.spaces++;
+
+  // the line now ends the paragraph, so it is not justified
+  line.flags |= LF_LAST;
 }
 
+// shape and break only as much of the text as is needed for prop.maxLines lines. The
+// text is processed in sections that double in size each time, until the lines are filled
+// or the text ends, so the work depends on the visible text and not on the length of the text.
+// Each section ends at a line break opportunity and the view always contains the text of
+// all sections plus the shaping context behind the current one, it only grows, so the line
+// breaks and hyphens are calculated once per character. When there is text left, the last
+// line gets the ellipsis
+// The lines are always created with the fast line breaking, the optimizing line breaking
+// would need the text up to the next forced line break. Runs and lines are in ctx
+static void layoutLimitedParagraph(const std::u32string & txt32, const AttributeIndex_c & attr,
+                                   const Shape_c & shape, const LayoutProperties_c & prop,
+                                   int32_t ystart, internal::LayoutContextData_c & ctx)
+{
+  auto & runs = ctx.runs;
+  auto & lines = ctx.lines;
+
+  // the bidi algorithm needs the whole paragraph, but it is cheap compared to the shaping
+  internal::ScratchVector_c<FriBidiLevel> embedding_levels(txt32.length(), 0, ctx.alloc<FriBidiLevel>());
+  getBidiEmbeddingLevels(txt32, prop, ctx, embedding_levels.data());
+
+  // stop at the start of the line behind the last allowed one
+  auto stop = [&lines, &prop](size_t, int32_t) -> bool { return lines.size() >= prop.maxLines; };
+
+  // the characters harfbuzz looks at around the text to shape, see shapeText
+  const size_t maxContext = 5;
+
+  LayoutDataView view(txt32, attr, embedding_levels.data(), ctx, 0, 0);
+
+  size_t done = 0;      // the text in front of this position in the view is in the runs
+  size_t section = 80*prop.maxLines;
+
+  while (true)
+  {
+    // the section ends at the first line break opportunity behind done+section, the
+    // break behind the last character of the view is only known at the end of the text
+    size_t from = done + section;
+    size_t want = from + maxContext + 1;
+    size_t last = 0;
+    bool complete = false;
+
+    while (last == 0 && !complete)
+    {
+      view.grow(txt32, attr, want);
+      getLinebreaks(view, prop, done);
+
+      complete = view.textEnd() == txt32.size();
+
+      for (size_t p = from; p < view.size(); p++)
+        if (view.lnb(p-1) == LINEBREAK_ALLOWBREAK || view.lnb(p-1) == LINEBREAK_MUSTBREAK)
+        {
+          last = p;
+          break;
+        }
+
+      // a long piece of text without break opportunity, look further
+      from = std::max(from, view.size());
+      want = done + 2*(want - done);
+    }
+
+    if (last == 0) last = view.size();
+
+    // harfbuzz must see the same characters behind the section as for the whole text, the
+    // line breaks of those characters are not needed before the next section
+    if (!complete && last + maxContext >= view.size())
+    {
+      view.grow(txt32, attr, last + maxContext + 1);
+      complete = view.textEnd() == txt32.size();
+    }
+
+    if (prop.hyphenate) getHyphens(view, done, last);
+
+    createTextRuns(view, prop, done, last, runs);
+
+    // the fast line breaking only depends on the run and the position where the line
+    // starts, so the lines in front of the last one stay as they are, the last one might
+    // get longer with the new runs
+    size_t start = 0;
+    int32_t ypos = ystart;
+
+    if (!lines.empty())
+    {
+      start = lines.back().from;
+      ypos = lines.back().top;
+      lines.pop_back();
+    }
+
+    size_t end = breakLines(runs, shape, prop, start, ypos, lines, stop);
+
+    bool textLeft = !complete || last < view.size();
+
+    if (end < runs.size())
+    {
+      // only spaces left at the end of the text don't need the ellipsis
+      bool more = textLeft;
+      for (size_t i = end; i < runs.size() && !more; i++)
+        more = !runs[i].space;
+
+      if (more) addEllipsis(view, prop, runs, lines);
+
+      return;
+    }
+
+    if (!textLeft)
+      return;
+
+    done = last;
+    section *= 2;
+  }
+}
+
+ShapedParagraph_c shapeParagraph(const std::u32string & txt32, const AttributeIndex_c & attr,
+                                 const LayoutProperties_c & prop)
+{
+  internal::LayoutContextData_c ctx;
+  internal::LayoutContextUse_c use(ctx);
+
+  auto data = std::make_shared<internal::ShapedParagraphData_c>();
+  shapeParagraph(txt32, attr, prop, ctx, data->runs);
+
+  return ShapedParagraph_c(data);
+}
+
+TextLayout_c breakParagraph(const ShapedParagraph_c & shaped, const Shape_c & shape,
+                            const LayoutProperties_c & prop, int32_t ystart, LayoutContext_c & context)
+{
+  if (!shaped)
+    throw LayoutException_c("the paragraph to break has not been shaped");
+
+  auto & ctx = context.getData();
+  internal::LayoutContextUse_c use(ctx);
+
+  return breakParagraph(shaped.getData()->runs, shape, prop, ystart, ctx);
+}
+
+TextLayout_c breakParagraph(const ShapedParagraph_c & shaped, const Shape_c & shape,
+                            const LayoutProperties_c & prop, int32_t ystart)
+{
+  LayoutContext_c context;
+  return breakParagraph(shaped, shape, prop, ystart, context);
+}
+
+TextLayout_c layoutParagraph(const std::u32string & txt32, const AttributeIndex_c & attr,
+                             const Shape_c & shape, const LayoutProperties_c & prop, int32_t ystart,
+                             LayoutContext_c & context)
+{
+  auto & ctx = context.getData();
+  internal::LayoutContextUse_c use(ctx);
+
+  if (prop.maxLines > 0)
+  {
+    layoutLimitedParagraph(txt32, attr, shape, prop, ystart, ctx);
+
+    return outputLines(ctx.runs, ctx.lines, shape, prop, ystart,
+                       ctx.lines.empty() ? ystart : ctx.lines.back().bottom, ctx);
+  }
+
+  shapeParagraph(txt32, attr, prop, ctx, ctx.runs);
+
+  return breakParagraph(ctx.runs, shape, prop, ystart, ctx);
+}
+
+TextLayout_c layoutParagraph(const std::u32string & txt32, const AttributeIndex_c & attr,
+                             const Shape_c & shape, const LayoutProperties_c & prop, int32_t ystart)
+{
+  LayoutContext_c context;
+  return layoutParagraph(txt32, attr, shape, prop, ystart, context);
+}
+
+ParagraphMetrics_c measureParagraph(const std::u32string & txt32, const AttributeIndex_c & attr,
+                                    const Shape_c & shape, const LayoutProperties_c & prop, int32_t ystart,
+                                    LayoutContext_c & context)
+{
+  auto & ctx = context.getData();
+  internal::LayoutContextUse_c use(ctx);
+
+  ctx.measureOnly = true;
+
+  if (prop.maxLines > 0)
+  {
+    layoutLimitedParagraph(txt32, attr, shape, prop, ystart, ctx);
+  }
+  else
+  {
+    shapeParagraph(txt32, attr, prop, ctx, ctx.runs);
+
+    ctx.lines.clear();
+    breakRuns(ctx.runs, shape, prop, 0, ystart, ctx.lines, ctx);
+  }
+
+  return measureLines(ctx.runs, ctx.lines, shape, prop, ystart,
+                      ctx.lines.empty() ? ystart : ctx.lines.back().bottom, ctx);
+}
+
+ParagraphMetrics_c measureParagraph(const std::u32string & txt32, const AttributeIndex_c & attr,
+                                    const Shape_c & shape, const LayoutProperties_c & prop, int32_t ystart)
+{
+  LayoutContext_c context;
+  return measureParagraph(txt32, attr, shape, prop, ystart, context);
+}
+
+ParagraphMetrics_c measureParagraph(const ShapedParagraph_c & shaped, const Shape_c & shape,
+                                    const LayoutProperties_c & prop, int32_t ystart)
+{
+  if (!shaped)
+    throw LayoutException_c("the paragraph to measure has not been shaped");
+
+  internal::LayoutContextData_c ctx;
+  internal::LayoutContextUse_c use(ctx);
+
+  const auto & runs = shaped.getData()->runs;
+
+  ctx.lines.clear();
+  breakRuns(runs, shape, prop, 0, ystart, ctx.lines, ctx);
+
+  return measureLines(runs, ctx.lines, shape, prop, ystart,
+                      ctx.lines.empty() ? ystart : ctx.lines.back().bottom, ctx);
+}
+
+bool ParagraphContinuation_c::isFinished(void) const
+{
+  return !shaped || run >= shaped.getData()->runs.size();
+}
+
+TextLayout_c layoutParagraphPart(ParagraphContinuation_c & cont, const Shape_c & shape,
+                                 const LayoutProperties_c & prop, int32_t maxHeight,
+                                 uint32_t maxLines)
+{
+  if (cont.isFinished())
+  {
+    TextLayout_c l;
+    l.setHeight(cont.ypos);
+    return l;
+  }
+
+  const auto & runs = cont.shaped.getData()->runs;
+
+  internal::LayoutContextData_c ctx;
+  internal::LayoutContextUse_c use(ctx);
+
+  int32_t ystart = cont.ypos;
+  int32_t ylimit = ystart + maxHeight;
+
+  // stop at the start of a line, when one of the limits has been reached, the
+  // line breaking functions don't call this for the first line, so there is
+  // always at least one line
+  auto stop = [&](size_t, int32_t y) -> bool
+  {
+    return    (maxLines > 0 && ctx.lines.size() >= maxLines)
+           || (maxHeight > 0 && y >= ylimit);
+  };
+
+  ctx.lines.clear();
+  size_t end = breakRuns(runs, shape, prop, cont.run, ystart, ctx.lines, ctx, stop);
+
+  // the last line may reach beyond the height limit, in that case it is left for the
+  // next part, the normal line breaking only depends on the run where the line starts
+  // and on the vertical position, so it will create the same line again
+  if (   !prop.optimizeLinebreaks
+      && maxHeight > 0
+      && ctx.lines.size() > 1
+      && ctx.lines.back().bottom > ylimit)
+  {
+    end = ctx.lines.back().from;
+    ctx.lines.pop_back();
+  }
+
+  int32_t yend = ctx.lines.empty() ? ystart : ctx.lines.back().bottom;
+
+  cont.run = end;
+  cont.ypos = yend;
+
+  return outputLines(runs, ctx.lines, shape, prop, ystart, yend, ctx);
+}
+
+ContentWidths_c getContentWidths(const ShapedParagraph_c & shaped, const LayoutProperties_c & prop)
+{
+  if (!shaped)
+    throw LayoutException_c("the paragraph to measure has not been shaped");
+
+  const auto & d = *shaped.getData();
+
+  std::lock_guard<std::mutex> lock(d.widthsMutex);
+
+  if (!d.widthsValid)
+  {
+    calculateContentWidths(d.runs, d.minFirst, d.minRest, d.maxFirst, d.maxRest);
+    d.widthsValid = true;
+  }
+
+  return combineContentWidths(prop, d.minFirst, d.minRest, d.maxFirst, d.maxRest);
+}
+
+ContentWidths_c getContentWidths(const std::u32string & txt32, const AttributeIndex_c & attr,
+                                 const LayoutProperties_c & prop)
+{
+  internal::LayoutContextData_c ctx;
+  internal::LayoutContextUse_c use(ctx);
+
+  ctx.measureOnly = true;
+  shapeParagraph(txt32, attr, prop, ctx, ctx.runs);
+
+  int32_t minFirst, minRest, maxFirst, maxRest;
+  calculateContentWidths(ctx.runs, minFirst, minRest, maxFirst, maxRest);
+
+  return combineContentWidths(prop, minFirst, minRest, maxFirst, maxRest);
+}
+
+std::vector<TextLayout_c> layoutParagraphs(const std::vector<ParagraphJob_c> & jobs, unsigned int workers)
+{
+  std::vector<TextLayout_c> res(jobs.size());
+
+  // each job writes only its own result, so the order in which the
+  // jobs are done doesn't matter
+  internal::getWorkerPool().run(jobs.size(), workers, [&jobs, &res](size_t i)
+  {
+    // each worker keeps its scratch memory from one paragraph to the next
+    static thread_local LayoutContext_c context;
+
+    const auto & j = jobs[i];
+
+    if (!j.shape)
+      throw LayoutException_c("a paragraph job has no shape");
+
+    res[i] = layoutParagraph(j.txt32, j.attr, *j.shape, j.prop, j.ystart, context);
+  });
+
+  return res;
+}
+
+// check, if the text contains bidi control characters that the LayoutDataView removes
+static bool hasBidiControls(const std::u32string & txt32)
+{
+  return txt32.find_first_of(U"\U0000202A\U0000202B\U0000202C") != std::u32string::npos;
+}
+
+// characters that separate words, the text is always shaped again in whole
+// words, so edits start and end after one of those
+static bool isWordSeparator(char32_t c)
+{
+  return c == U' ' || c == U'\n';
+}
+
+IncrementalParagraph_c::IncrementalParagraph_c(const std::u32string & txt32, const AttributeIndex_c & attr,
+                                               const LayoutProperties_c & prop) :
+  data(new internal::IncrementalParagraphData_c)
+{
+  data->txt = txt32;
+  data->attr = attr;
+  data->prop = prop;
+  data->bidiControls = hasBidiControls(txt32);
+  data->shaped = std::make_shared<internal::ShapedParagraphData_c>();
+
+  internal::LayoutContextData_c ctx;
+  internal::LayoutContextUse_c use(ctx);
+
+  data->levels.resize(txt32.length());
+  getBidiEmbeddingLevels(txt32, prop, ctx, data->levels.data());
+  createParagraphRuns(txt32, attr, data->levels.data(), prop, ctx, data->shaped->runs);
+}
+
+IncrementalParagraph_c::~IncrementalParagraph_c(void) { }
+
+const std::u32string & IncrementalParagraph_c::getText(void) const { return data->txt; }
+
+const AttributeIndex_c & IncrementalParagraph_c::getAttributes(void) const { return data->attr; }
+
+ShapedParagraph_c IncrementalParagraph_c::getShaped(void) const { return ShapedParagraph_c(data->shaped); }
+
+TextLayout_c IncrementalParagraph_c::layout(const Shape_c & shape, int32_t ystart)
+{
+  auto & d = *data;
+
+  internal::LayoutContextData_c ctx;
+  internal::LayoutContextUse_c use(ctx);
+
+  d.lines.clear();
+  breakRuns(d.shaped->runs, shape, d.prop, 0, ystart, d.lines, ctx);
+
+  d.ystart = ystart;
+  d.yend = d.lines.empty() ? ystart : d.lines.back().bottom;
+  d.broken = true;
+
+  return outputLines(d.shaped->runs, d.lines, shape, d.prop, d.ystart, d.yend, ctx);
+}
+
+TextLayout_c IncrementalParagraph_c::edit(size_t offset, size_t removed, const std::u32string & inserted,
+                                          const AttributeIndex_c & attr, const Shape_c & shape, int32_t ystart)
+{
+  auto & d = *data;
+
+  if (offset > d.txt.size())
+    throw LayoutException_c("the edit starts behind the end of the paragraph");
+
+  removed = std::min(removed, d.txt.size()-offset);
+
+  d.txt.replace(offset, removed, inserted);
+  d.attr.replace(offset, removed, inserted.size(), attr);
+
+  // the runs might be shared with paragraphs handed out by getShaped, those must not change
+  if (d.shaped.use_count() > 1)
+    d.shaped = std::make_shared<internal::ShapedParagraphData_c>(*d.shaped);
+
+  d.shaped->widthsValid = false;
+
+  auto & runs = d.shaped->runs;
+
+  // with bidi control characters the positions within the runs don't match
+  // the positions within the text, so we do everything again
+  internal::LayoutContextData_c ctx;
+  internal::LayoutContextUse_c use(ctx);
+
+  if (d.bidiControls || hasBidiControls(d.txt))
+  {
+    d.levels.resize(d.txt.length());
+    getBidiEmbeddingLevels(d.txt, d.prop, ctx, d.levels.data());
+    d.bidiControls = hasBidiControls(d.txt);
+    runs.clear();
+    createParagraphRuns(d.txt, d.attr, d.levels.data(), d.prop, ctx, runs);
+
+    return layout(shape, ystart);
+  }
+
+  // the embedding levels are calculated for the whole paragraph, this is fast compared to
+  // the other steps. Where the levels have changed outside of the edit, the text
+  // needs to be shaped again, so the changed region [c0, c1) might grow
+  std::vector<FriBidiLevel> levels(d.txt.length());
+  getBidiEmbeddingLevels(d.txt, d.prop, ctx, levels.data());
+
+  size_t c0 = offset;
+  size_t c1 = offset + inserted.size();
+
+  for (size_t i = 0; i < offset; i++)
+    if (levels[i] != d.levels[i])
+    {
+      c0 = i;
+      break;
+    }
+
+  for (size_t i = d.txt.size(); i > c1; i--)
+    if (levels[i-1] != d.levels[i-1+removed-inserted.size()])
+    {
+      c1 = i;
+      break;
+    }
+
+  d.levels = std::move(levels);
+
+  // extend the region to whole words and a bit more, so that the line breaks, hyphens
+  // and the shaping context of the text outside of the region stay as they are
+  const size_t margin = 6;
+
+  size_t rs = c0 > margin ? c0 - margin : 0;
+  while (rs > 0 && !isWordSeparator(d.txt[rs-1])) rs--;
+
+  size_t re = std::min(c1 + margin, d.txt.size());
+  while (re < d.txt.size() && !isWordSeparator(d.txt[re-1])) re++;
+
+  // the end of the region within the old text
+  size_t reOld = re + removed - inserted.size();
+
+  // create the runs for the region, the view contains a bit of text around the region
+  // as context for the line breaking and shaping
+  size_t ws = rs > 5 ? rs - 5 : 0;
+  size_t we = std::min(re + 5, d.txt.size());
+
+  std::vector<runInfo> newRuns;
+
+  {
+    LayoutDataView view(d.txt, d.attr, d.levels.data(), ctx, ws, we);
+
+    getLinebreaks(view, d.prop);
+    if (d.prop.hyphenate) getHyphens(view);
+
+    createTextRuns(view, d.prop, rs-ws, re-ws, newRuns);
+  }
+
+  for (auto & r : newRuns)
+  {
+    r.textStart += ws;
+    r.textEnd += ws;
+  }
+
+  // replace the runs of the region, runs always start at the region borders
+  // because there is a space in front of them
+  auto runAt = [&runs](size_t pos)
+  {
+    return std::lower_bound(runs.begin(), runs.end(), pos,
+                            [](const runInfo & r, size_t p) { return r.textStart < p; }) - runs.begin();
+  };
+
+  size_t r0 = runAt(rs);
+  size_t r1 = runAt(reOld);
+
+  for (size_t r = r1; r < runs.size(); r++)
+  {
+    runs[r].textStart = runs[r].textStart + inserted.size() - removed;
+    runs[r].textEnd = runs[r].textEnd + inserted.size() - removed;
+  }
+
+  runs.erase(runs.begin()+r0, runs.begin()+r1);
+  runs.insert(runs.begin()+r0, std::make_move_iterator(newRuns.begin()), std::make_move_iterator(newRuns.end()));
+
+  // the runs from r0 to n1 are new, behind that the runs are the same as before, but
+  // their index has changed by dr
+  size_t n1 = r0 + newRuns.size();
+  ptrdiff_t dr = (ptrdiff_t)newRuns.size() - (ptrdiff_t)(r1 - r0);
+
+  if (!d.broken || ystart != d.ystart)
+    return layout(shape, ystart);
+
+  // take over the lines in front of the new runs, for the greedy algorithm a line stays
+  // when the following line ends in front of the new runs, because the greedy algorithm looks
+  // into the next line to decide where to break. The optimizing algorithm handles sections
+  // between forced breaks, so we keep all the sections that end in front of the new runs
+  size_t keep = 0;
+
+  if (d.prop.optimizeLinebreaks)
+  {
+    for (size_t j = 0; j < d.lines.size(); j++)
+      if ((d.lines[j].flags & LF_LAST) && d.lines[j].to <= r0)
+        keep = j+1;
+  }
+  else
+  {
+    while (keep+1 < d.lines.size() && d.lines[keep+1].to <= r0)
+      keep++;
+  }
+
+  std::vector<lineInfo> lines(d.lines.begin(), d.lines.begin()+keep);
+
+  size_t runstart = keep ? lines.back().to : 0;
+  int32_t ypos = keep ? lines.back().bottom : ystart;
+
+  // stop breaking lines, as soon as a line starts behind the new runs at the
+  // same position as a line of the old layout, from there on the lines are the same
+  size_t old = keep;
+  bool optimize = d.prop.optimizeLinebreaks;
+
+  auto stop = [&](size_t s, int32_t y)
+  {
+    if (s < n1) return false;
+
+    size_t so = s - dr;
+
+    while (old < d.lines.size() && d.lines[old].from < so) old++;
+
+    return    old < d.lines.size()
+           && d.lines[old].from == so
+           && d.lines[old].top == y
+           && (!optimize || (d.lines[old].flags & LF_FIRST));
+  };
+
+  if (breakRuns(runs, shape, d.prop, runstart, ypos, lines, ctx, stop) < runs.size())
+  {
+    for (size_t j = old; j < d.lines.size(); j++)
+    {
+      lineInfo l = d.lines[j];
+
+      l.runstart += dr;
+      l.spos += dr;
+      l.from += dr;
+      l.to += dr;
+
+      lines.push_back(l);
+    }
+  }
+  else
+  {
+    d.yend = lines.empty() ? ystart : lines.back().bottom;
+  }
+
+  d.lines = std::move(lines);
+
+  return outputLines(runs, d.lines, shape, d.prop, d.ystart, d.yend, ctx);
+}
+
+namespace internal {
+
+// the state of a dynamic label
+class DynamicLabelData_c
+{
+  public:
+    std::u32string prefix, value, suffix;
+
+    // the attributes of the text with the initial value, the length of the initial
+    // value and the attribute of the values
+    AttributeIndex_c attr;
+    size_t initialLength;
+    AttributeIndex_c valueAttr;
+
+    std::shared_ptr<const Shape_c> shape;
+    LayoutProperties_c prop;
+    int32_t ystart;
+
+    // the prepared glyphs: the font, the index into glyphs for each character, and whether
+    // the characters i and j can be placed next to each other in pairs[i*glyphs.size()+j]
+    // the space has its own entry, spaceIndex is npos, when it uses a different font
+    std::shared_ptr<FontFace_c> font;
+    std::unordered_map<char32_t, size_t> index;
+    std::vector<std::pair<glyphIndex_t, int32_t>> glyphs;
+    std::vector<bool> pairs;
+    size_t spaceIndex = std::string::npos;
+    uint32_t lang = 0;
+
+    // true, when the font has rules that might change the prepared glyphs in sequences
+    // longer than the pairs, then the value is shaped to check the glyphs before an update
+    bool verify = false;
+
+    // the runs and lines of the current layout, when fast is true, the
+    // value is in the runs starting at valueRun
+    std::vector<runInfo> runs;
+    std::vector<lineInfo> lines;
+    bool fast = false;
+    size_t valueRun = 0;
+    size_t valueRuns = 0;
+
+    TextLayout_c layout;
+    uint64_t fastUpdates = 0;
+
+    // memory for the updates: the glyphs of the value, the complete text to check
+    // them against and the embedding levels for the view of the value
+    LayoutContextData_c ctx;
+    std::shared_ptr<ShapedGlyphs_c> shaped;
+    std::u32string text;
+    std::vector<FriBidiLevel> levels;
+};
+
+}
+
+// check, if a shaped text consists of exactly the given glyphs placed one after the other
+static bool isPlainShaping(const internal::ShapedGlyphs_c & g,
+                           std::initializer_list<std::pair<glyphIndex_t, int32_t>> expected)
+{
+  if (g.size() != expected.size()) return false;
+
+  size_t i = 0;
+
+  for (const auto & e : expected)
+  {
+    if (   g[i].glyph != e.first || g[i].x_advance != e.second || g[i].cluster != i
+        || g[i].y_advance != 0 || g[i].x_offset != 0 || g[i].y_offset != 0)
+      return false;
+
+    i++;
+  }
+
+  return true;
+}
+
+// find out, which rules of the font go beyond the pairs for the prepared characters, keys
+// are the prepared characters. The lookups the layout uses for the value are checked, when
+// one of them substitutes a prepared glyph or positions it depending on other glyphs, the
+// updates need to verify the glyphs. When the value can change the glyphs around it, there
+// are no fast updates at all
+static void findLabelRules(internal::DynamicLabelData_c & d, const std::u32string & keys)
+{
+  hb_font_t * font = d.font->getHarfbuzzFont();
+  hb_face_t * face = hb_font_get_face(font);
+
+  // the glyphs the rules see for the characters of the value and the space
+  std::vector<hb_codepoint_t> value;
+  hb_codepoint_t space = HB_SET_VALUE_INVALID;
+
+  for (auto c : keys)
+  {
+    hb_codepoint_t g;
+
+    if (!hb_font_get_nominal_glyph(font, c, &g)) continue;
+
+    if (c == U' ')
+      space = g;
+    else
+      value.push_back(g);
+  }
+
+  // the plan is the one shapeText uses for the value
+  const auto & info = internal::getLanguageInfo(d.lang);
+
+  hb_segment_properties_t props = HB_SEGMENT_PROPERTIES_DEFAULT;
+  props.direction = HB_DIRECTION_LTR;
+  if (info.hbScript != HB_SCRIPT_INVALID) props.script = info.hbScript;
+  if (info.hbLanguage != HB_LANGUAGE_INVALID) props.language = info.hbLanguage;
+
+  hb_shape_plan_t * plan = d.font->getShapePlan(props);
+
+  hb_set_t * lookups = hb_set_create();
+  hb_set_t * context = hb_set_create();
+  hb_set_t * after = hb_set_create();
+  hb_set_t * input = hb_set_create();
+
+  auto containsValue = [&value](hb_set_t * set)
+  {
+    for (auto g : value)
+      if (hb_set_has(set, g))
+        return true;
+
+    return false;
+  };
+
+  for (hb_tag_t table : { HB_OT_TAG_GSUB, HB_OT_TAG_GPOS })
+  {
+    hb_set_clear(lookups);
+    hb_ot_shape_plan_collect_lookups(plan, table, lookups);
+
+    hb_codepoint_t l = HB_SET_VALUE_INVALID;
+
+    while (hb_set_next(lookups, &l))
+    {
+      hb_set_clear(context);
+      hb_set_clear(after);
+      hb_set_clear(input);
+      hb_ot_layout_lookup_collect_glyphs(face, table, l, context, input, after, nullptr);
+      hb_set_union(context, after);
+
+      bool valueInput = containsValue(input);
+      bool valueContext = containsValue(context);
+
+      // pairs of glyphs are checked when the label is created, but substitutions
+      // might apply to longer sequences only and positions might depend on more context
+      if (valueInput && (table == HB_OT_TAG_GSUB || valueContext || hb_set_has(context, space)))
+        d.verify = true;
+
+      // the rule changes other glyphs depending on the value
+      if (valueContext)
+      {
+        for (auto g : value)
+          hb_set_del(input, g);
+
+        if (!hb_set_is_empty(input))
+          d.index.clear();
+      }
+    }
+  }
+
+  hb_set_destroy(input);
+  hb_set_destroy(after);
+  hb_set_destroy(context);
+  hb_set_destroy(lookups);
+}
+
+// layout the complete text of the label and find out, if the next update can be done fast
+static void layoutLabel(internal::DynamicLabelData_c & d)
+{
+  std::u32string txt = d.prefix + d.value + d.suffix;
+
+  AttributeIndex_c attr = d.attr;
+  attr.replace(d.prefix.size(), d.initialLength, d.value.size(), d.valueAttr);
+
+  internal::LayoutContextUse_c use(d.ctx);
+
+  d.runs.clear();
+  shapeParagraph(txt, attr, d.prop, d.ctx, d.runs);
+
+  d.lines.clear();
+  breakRuns(d.runs, *d.shape, d.prop, 0, d.ystart, d.lines, d.ctx);
+
+  d.layout = outputLines(d.runs, d.lines, *d.shape, d.prop, d.ystart,
+                         d.lines.empty() ? d.ystart : d.lines.back().bottom, d.ctx);
+
+  // the value must be in runs of its own on a single left to right line
+  d.fast = false;
+
+  if (   !d.font || d.value.empty() || !d.prop.ltr || d.lines.size() != 1 || hasBidiControls(txt)
+      || (!d.prefix.empty() && d.prefix.back() != U' ')
+      || (!d.suffix.empty() && d.suffix.front() != U' ')
+     )
+    return;
+
+  for (const auto & r : d.runs)
+    if (r.embeddingLevel != 0)
+      return;
+
+  size_t p0 = d.prefix.size();
+  size_t p1 = p0 + d.value.size();
+
+  size_t r0 = 0;
+  while (r0 < d.runs.size() && d.runs[r0].textStart < p0) r0++;
+
+  size_t r1 = r0;
+  while (r1 < d.runs.size() && d.runs[r1].textStart < p1)
+  {
+    if (d.runs[r1].space || d.runs[r1].shy || d.runs[r1].font != d.font)
+      return;
+
+    r1++;
+  }
+
+  if (r1 == r0 || d.runs[r0].textStart != p0 || d.runs[r1-1].textEnd != p1)
+    return;
+
+  d.fast = true;
+  d.valueRun = r0;
+  d.valueRuns = r1 - r0;
+}
+
+// replace the runs of the value with a run created from the prepared glyphs, returns
+// false, when this is not possible and the label needs to be layouted completely
+static bool updateLabel(internal::DynamicLabelData_c & d, const std::u32string & value)
+{
+  if (!d.fast || value.empty()) return false;
+
+  size_t n = d.glyphs.size();
+  size_t prev = d.prefix.empty() ? std::string::npos : d.spaceIndex;
+
+  internal::LayoutContextUse_c use(d.ctx);
+
+  auto & g = *d.shaped;
+  g.clear();
+
+  for (size_t i = 0; i < value.size(); i++)
+  {
+    auto it = d.index.find(value[i]);
+
+    if (it == d.index.end()) return false;
+    if (prev != std::string::npos && !d.pairs[prev*n+it->second]) return false;
+
+    prev = it->second;
+    g.push_back(internal::ShapedGlyph_c{d.glyphs[prev].first, (uint32_t)i, d.glyphs[prev].second, 0, 0, 0, false});
+  }
+
+  if (!d.suffix.empty() && d.spaceIndex != std::string::npos && !d.pairs[prev*n+d.spaceIndex])
+    return false;
+
+  size_t p0 = d.prefix.size();
+
+  // the pairs don't see rules that look at more than two characters, like contextual
+  // alternates or ligatures. When the font has such rules for the prepared glyphs, the value
+  // is shaped within the complete text and must give the same glyphs. The values of a label
+  // rarely come again, so they are not put into the shape cache
+  if (d.verify)
+  {
+    d.text.assign(d.prefix);
+    d.text.append(value);
+    d.text.append(d.suffix);
+
+    auto s = shapeText(d.text, p0, value.size(), d.lang, false, d.font, d.ctx, false);
+
+    if (s->size() != g.size()) return false;
+
+    for (size_t i = 0; i < g.size(); i++)
+      if (   (*s)[i].glyph != g[i].glyph || (*s)[i].x_advance != g[i].x_advance || (*s)[i].cluster != i
+          || (*s)[i].y_advance != 0 || (*s)[i].x_offset != 0 || (*s)[i].y_offset != 0)
+        return false;
+  }
+
+  if (d.levels.size() < value.size())
+    d.levels.resize(value.size(), 0);
+
+  runGlyphs shaped;
+  shaped.glyphs = d.shaped;
+  shaped.count = g.size();
+
+  runInfo run;
+
+  {
+    LayoutDataView view(value, d.valueAttr, d.levels.data(), d.ctx);
+    run = createRun(view, value.size(), 0, d.prop, d.font, shaped);
+  }
+
+  size_t last = d.valueRun + d.valueRuns;
+
+  run.linebreak = d.runs[last-1].linebreak;
+  run.textStart = p0;
+  run.textEnd = p0 + value.size();
+
+  // the new width of the line, when the line gets too long, the text needs to be broken
+  auto & line = d.lines[0];
+
+  int32_t width = line.width + run.dx;
+  for (size_t r = d.valueRun; r < last; r++)
+    width -= d.runs[r].dx;
+
+  if (line.left + width > line.right)
+    return false;
+
+  line.width = width;
+
+  // put the new run into the place of the old ones, the vectors of the old runs are kept for the next update
+  for (size_t r = d.valueRun; r < last; r++)
+  {
+    d.runs[r].run.clear();
+    d.ctx.commands.push_back(std::move(d.runs[r].run));
+    d.runs[r].links.clear();
+    d.ctx.links.push_back(std::move(d.runs[r].links));
+  }
+
+  for (size_t r = last; r < d.runs.size(); r++)
+  {
+    d.runs[r].textStart = d.runs[r].textStart + value.size() - d.value.size();
+    d.runs[r].textEnd = d.runs[r].textEnd + value.size() - d.value.size();
+  }
+
+  d.runs[d.valueRun] = std::move(run);
+
+  if (d.valueRuns > 1)
+  {
+    d.runs.erase(d.runs.begin()+d.valueRun+1, d.runs.begin()+last);
+
+    line.spos -= d.valueRuns-1;
+    line.to -= d.valueRuns-1;
+    d.valueRuns = 1;
+  }
+
+  d.layout = outputLines(d.runs, d.lines, *d.shape, d.prop, d.ystart, line.bottom, d.ctx);
+
+  return true;
+}
+
+DynamicLabel_c::DynamicLabel_c(const std::u32string & prefix, const std::u32string & value, const std::u32string & suffix,
+                               const AttributeIndex_c & attr, std::shared_ptr<const Shape_c> shape,
+                               const LayoutProperties_c & prop, int32_t ystart, const std::u32string & charset) :
+  data(new internal::DynamicLabelData_c)
+{
+  if (!shape)
+    throw LayoutException_c("a dynamic label needs a shape");
+
+  auto & d = *data;
+
+  d.prefix = prefix;
+  d.value = value;
+  d.suffix = suffix;
+  d.attr = attr;
+  d.initialLength = value.size();
+  d.valueAttr = AttributeIndex_c(attr[prefix.size()]);
+  d.shape = std::move(shape);
+  d.prop = prop;
+  d.ystart = ystart;
+  d.shaped = std::make_shared<internal::ShapedGlyphs_c>();
+
+  // prepare the glyphs of the characters, only characters that are shaped into a single
+  // plain glyph of the font of the first character are used
+  const auto & a = d.valueAttr[0];
+
+  if (!a.inlay)
+  {
+    internal::LayoutContextUse_c use(d.ctx);
+
+    uint32_t lang = d.lang = d.valueAttr.runLanguage(0);
+    std::u32string keys;
+
+    for (auto c : charset + U" ")
+    {
+      auto f = a.font.get(c);
+
+      if (!d.font) d.font = f;
+      if (!f || f != d.font || keys.find(c) != std::u32string::npos) continue;
+
+      auto s = shapeText(std::u32string(1, c), 0, 1, lang, false, f, d.ctx);
+
+      if (s->size() != 1) continue;
+
+      std::pair<glyphIndex_t, int32_t> e((*s)[0].glyph, (*s)[0].x_advance);
+
+      if (!isPlainShaping(*s, { e })) continue;
+
+      if (c == U' ')
+        d.spaceIndex = d.glyphs.size();
+      else
+        d.index[c] = d.glyphs.size();
+
+      keys.push_back(c);
+      d.glyphs.push_back(e);
+    }
+
+    // when the space uses the same font but could not be prepared, we can't
+    // check the neighbours of the value, so all updates layout the complete text
+    if (d.spaceIndex == std::string::npos && a.font.get(U' ') == d.font)
+      d.index.clear();
+
+    // find out which characters can be placed next to each other without shaping
+    size_t n = d.glyphs.size();
+    d.pairs.resize(n*n);
+
+    for (size_t i = 0; i < n; i++)
+      for (size_t j = 0; j < n; j++)
+      {
+        std::u32string txt { keys[i], keys[j] };
+        auto s = shapeText(txt, 0, 2, lang, false, d.font, d.ctx);
+
+        d.pairs[i*n+j] = isPlainShaping(*s, { d.glyphs[i], d.glyphs[j] });
+      }
+
+    if (d.font && !d.index.empty())
+      findLabelRules(d, keys);
+  }
+
+  layoutLabel(d);
+}
+
+DynamicLabel_c::~DynamicLabel_c(void) { }
+
+TextLayout_c DynamicLabel_c::update(const std::u32string & value)
+{
+  auto & d = *data;
+
+  if (updateLabel(d, value))
+  {
+    d.fastUpdates++;
+    d.value = value;
+  }
+  else
+  {
+    d.value = value;
+    layoutLabel(d);
+  }
+
+  return d.layout;
+}
+
+const TextLayout_c & DynamicLabel_c::getLayout(void) const { return data->layout; }
+
+const std::u32string & DynamicLabel_c::getValue(void) const { return data->value; }
+
+uint64_t DynamicLabel_c::getFastUpdates(void) const { return data->fastUpdates; }
+
+void DynamicLabel_c::setLayoutStats(LayoutStats_c * stats) { data->ctx.stats = stats; }
 
 }
@@ -0,0 +1,147 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#ifndef STLL_LAYOUT_PARAGRAPH_INTERNAL_H
+#define STLL_LAYOUT_PARAGRAPH_INTERNAL_H
+
+#include <stll/layouter.h>
+
+#include <fribidi/fribidi.h>
+
+#include <linebreak.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+namespace STLL { namespace internal {
+
+// this structure contains the information of a run finished and ready or paragraph assembly
+typedef struct
+{
+  // the commands to output this run including the layer, the larger the number, the more in front to draw
+  std::vector<std::pair<size_t, CommandData_c>> run;
+
+  // the advance information of this run
+  int dx = 0;
+  int dy = 0;
+
+  // the embedding level (text direction) of this run
+  FriBidiLevel embeddingLevel = 0;
+
+  // line-break information for AFTER this run, for values see liblinebreak
+  char linebreak = LINEBREAK_NOBREAK;
+
+  // the font used for this run... will probably be identical to
+  // the fonts in the run
+  std::shared_ptr<FontFace_c> font;
+
+  // is this run a space run? Will be removed at line ends
+  bool space = false;
+
+  // is this a soft hyphen?? will only be shown at line ends
+  bool shy = false;
+
+  // ascender and descender of this run
+  int32_t ascender = 0;
+  int32_t descender = 0;
+
+  // link boxes for this run
+  std::vector<TextLayout_c::LinkInformation_c> links;
+
+  // the section of the text that this run was created from, positions are
+  // within the text without bidi control characters. Automatically inserted
+  // hyphens have an empty section
+  size_t textStart = 0;
+  size_t textEnd = 0;
+
+#ifndef NDEBUG
+  // the text of this run, useful for debugging to see what is going on
+  std::u32string text;
+#endif
+
+} runInfo;
+
+// the data behind a ShapedParagraph_c, the runs are never modified
+// after shaping, so several line breaking calls can use them at the same time
+class ShapedParagraphData_c
+{
+  public:
+    std::vector<runInfo> runs;
+
+    // the content widths of the runs, they are calculated on first use by
+    // getContentWidths, the first values are for the first line that might have
+    // an indent, the rest values for all other lines, whoever changes the runs
+    // must reset widthsValid
+    mutable std::mutex widthsMutex;
+    mutable bool widthsValid = false;
+    mutable int32_t minFirst = 0, minRest = 0;
+    mutable int32_t maxFirst = 0, maxRest = 0;
+
+    ShapedParagraphData_c(void) { }
+
+    // copies are made to change the runs, so the widths are not taken over
+    ShapedParagraphData_c(const ShapedParagraphData_c & s) : runs(s.runs) { }
+};
+
+// one line as found by the line breaking, the runs from runstart to spos
+// are output into the line. from and to are the break positions before
+// spaces at the line ends are removed
+typedef struct
+{
+  size_t runstart, spos;
+  size_t from, to;
+
+  int32_t top, bottom, baseline;
+  int32_t width, left, right;
+
+  int flags;
+  int spaces;
+} lineInfo;
+
+// the state of an incremental paragraph, the text with its attributes and
+// embedding levels, the shaped runs and the lines of the last layout
+class IncrementalParagraphData_c
+{
+  public:
+    std::u32string txt;
+    AttributeIndex_c attr;
+    LayoutProperties_c prop;
+    std::vector<FriBidiLevel> levels;
+
+    // the text contains bidi control characters, the positions in the runs
+    // then don't match the positions in the text
+    bool bidiControls = false;
+
+    std::shared_ptr<ShapedParagraphData_c> shaped;
+
+    // the lines of the last layout and its vertical extent, broken is
+    // false, when there was no layout yet
+    std::vector<lineInfo> lines;
+    int32_t ystart = 0;
+    int32_t yend = 0;
+    bool broken = false;
+};
+
+} }
+
+#endif
@@ -22,6 +22,10 @@
 
 #include <stll/layouter.h>
 
+#include "language_internal.h"
+
+#include <functional>
+
 namespace STLL {
 
 TextLayout_c::TextLayout_c(TextLayout_c&& src) :
@@ -77,4 +81,104 @@ void TextLayout_c::shift(int32_t dx, int32_t dy)
     }
 }
 
+// a hash over the attribute fields that are cheap to get at, attributes that are
+// equal always get the same hash
+static size_t hashAttribute(const CodepointAttributes_c & a)
+{
+  size_t h = std::hash<std::string>()(a.lang);
+
+  h = h*31 + a.c.r();
+  h = h*31 + a.c.g();
+  h = h*31 + a.c.b();
+  h = h*31 + a.c.a();
+  h = h*31 + a.flags;
+  h = h*31 + a.baseline_shift;
+  h = h*31 + a.link;
+  h = h*31 + a.shadows.size();
+  h = h*31 + (size_t)a.inlay.get();
+
+  for (const auto & f : a.font)
+    h = h*31 + (size_t)f.get();
+
+  return h;
+}
+
+AttributeIndex_c::AttributeIndex_c(CodepointAttributes_c a)
+{
+  languages.push_back(internal::getLanguageAtom(a.lang));
+  val.emplace_back(std::make_shared<const CodepointAttributes_c>(std::move(a)));
+  runs.push_back(Run_c{0, 0});
+}
+
+uint32_t AttributeIndex_c::intern(const CodepointAttributes_c & a)
+{
+  size_t h = hashAttribute(a);
+
+  auto r = interned.equal_range(h);
+
+  for (auto i = r.first; i != r.second; ++i)
+    if (*val[i->second] == a)
+      return i->second;
+
+  uint32_t v = val.size();
+  val.emplace_back(std::make_shared<const CodepointAttributes_c>(a));
+  languages.push_back(internal::getLanguageAtom(a.lang));
+  interned.insert(std::make_pair(h, v));
+
+  return v;
+}
+
+void AttributeIndex_c::assign(size_t start, size_t end, uint32_t v)
+{
+  if (start >= end) return;
+
+  // the value that the indices behind the range need to keep
+  uint32_t after = runs[findRun(end)].value;
+
+  auto cmp = [](const Run_c & r, size_t p) { return r.start < p; };
+
+  auto i = std::lower_bound(runs.begin(), runs.end(), start, cmp);
+  auto j = std::lower_bound(i, runs.end(), end, cmp);
+
+  bool endIsStart = (j != runs.end()) && (j->start == end);
+
+  i = runs.erase(i, j);
+  if (!endIsStart) i = runs.insert(i, Run_c{end, after});
+  i = runs.insert(i, Run_c{start, v});
+
+  // merge with the neighbours, when they have the same value
+  if ((i+1) != runs.end() && (i+1)->value == v) runs.erase(i+1);
+  if (i != runs.begin() && (i-1)->value == v) runs.erase(i);
+}
+
+void AttributeIndex_c::replace(size_t start, size_t removed, size_t inserted, const AttributeIndex_c & a)
+{
+  std::vector<Run_c> res;
+
+  // append a run to res, removing empty runs and merging runs with the same value
+  auto add = [&res](size_t s, uint32_t v)
+  {
+    if (!res.empty() && res.back().start == s) res.pop_back();
+    if (res.empty() || res.back().value != v) res.push_back(Run_c{s, v});
+  };
+
+  // the runs in front of the replaced range stay as they are
+  for (size_t r = 0; r < runs.size() && runs[r].start < start; r++)
+    add(runs[r].start, runs[r].value);
+
+  // the runs of the inserted indices, these always get an attribute, even
+  // where a uses its first attribute
+  for (size_t r = 0; r < a.runs.size() && a.runs[r].start < inserted; r++)
+    add(start + a.runs[r].start, intern(*a.val[a.runs[r].value]));
+
+  // the runs behind the replaced range move
+  size_t r = findRun(start+removed);
+  add(start+inserted, runs[r].value);
+
+  for (r++; r < runs.size(); r++)
+    add(runs[r].start - removed + inserted, runs[r].value);
+
+  runs = std::move(res);
+}
+
 }
@@ -25,16 +25,35 @@
 #include FT_FREETYPE_H
 #include FT_OUTLINE_H
 #include FT_LCD_FILTER_H
+#include FT_TRUETYPE_TABLES_H
+#include FT_SIZES_H
+#include FT_MODULE_H
+#include FT_ADVANCES_H
 
 #include <hb.h>
-#include <hb-ft.h>
+#include <hb-ot.h>
 
 #include <vector>
 #include <string>
 #include <memory>
+#include <map>
+#include <set>
+#include <tuple>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
 
 #include <cassert>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 namespace STLL {
 
 // TODO the fontFace_c constructor and library interface is not perfect...
@@ -47,64 +66,1029 @@ FontFace_c::GlyphSlot_c::GlyphSlot_c(const FT_GlyphSlotRec_* ft) :
   data((uint8_t*)ft->bitmap.buffer)
   {}
 
+namespace internal {
+
+FontFileResource_c mapFontFile(const std::string & pathname)
+{
+  int fd = open(pathname.c_str(), O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0)
+  {
+    throw FreetypeException_c(std::string("Could not open Font '") + pathname + "' maybe "
+                              "file is spelled wrong or file is broken");
+  }
+
+  struct stat st;
+
+  if (fstat(fd, &st) != 0 || st.st_size <= 0)
+  {
+    close(fd);
+    throw FreetypeException_c(std::string("Could not read Font '") + pathname + "'");
+  }
+
+  size_t s = st.st_size;
+  void * p = mmap(nullptr, s, PROT_READ, MAP_SHARED, fd, 0);
+
+  // the mapping stays valid after closing the file
+  close(fd);
+
+  if (p == MAP_FAILED)
+  {
+    throw FreetypeException_c(std::string("Could not map Font '") + pathname + "'");
+  }
+
+  std::shared_ptr<uint8_t> data(static_cast<uint8_t*>(p), [s](uint8_t * d) { munmap(d, s); });
+
+  return FontFileResource_c(data, s, pathname);
+}
+
+}
+
+// when the font resource is a file, map it into memory, so that all
+// the FreeType faces of the different threads can share the data
+static internal::FontFileResource_c loadFontFile(const internal::FontFileResource_c & r)
+{
+  if (r.getDatasize() != 0) return r;
+
+  return internal::mapFontFile(r.getDescription());
+}
+
+namespace internal {
+
+// each thread gets a unique number, other than std::thread::id these are never reused, so
+// resources of a thread that ended can never be mistaken for those of a new thread
+static std::atomic<uint64_t> nextThreadNumber(1);
+
+static uint64_t threadNumber(void)
+{
+  static thread_local uint64_t n = nextThreadNumber++;
+  return n;
+}
+
+// objects that keep resources for each thread that uses them derive from this
+// class, so that the resources can be released when the thread ends
+class ThreadResources_c
+{
+  public:
+    virtual ~ThreadResources_c() {}
+
+    // release the resources of the given thread, this is called by the thread itself
+    virtual void releaseThread(uint64_t thread) = 0;
+};
+
+// the list of objects that keep resources for a thread, each thread has its own
+// list and when the thread ends all of them release the resources of the thread
+class ThreadRegistry_c
+{
+  public:
+    ~ThreadRegistry_c()
+    {
+      // the newest first, because the sizes of a font are created after
+      // the face of the thread and must be released before it
+      for (auto i = owners.rbegin(); i != owners.rend(); ++i)
+        if (auto o = i->lock())
+          o->releaseThread(threadNumber());
+    }
+
+    void add(std::weak_ptr<ThreadResources_c> o)
+    {
+      // drop the objects that are gone from time to time
+      if (owners.size() >= cleanup)
+      {
+        owners.erase(std::remove_if(owners.begin(), owners.end(),
+                                    [](const std::weak_ptr<ThreadResources_c> & w) { return w.expired(); }),
+                     owners.end());
+        cleanup = 2*owners.size() + 16;
+      }
+
+      owners.push_back(std::move(o));
+    }
+
+  private:
+    std::vector<std::weak_ptr<ThreadResources_c>> owners;
+    size_t cleanup = 16;
+};
+
+// remember that the object keeps resources for the calling thread
+static void addThreadResources(std::weak_ptr<ThreadResources_c> o)
+{
+  static thread_local ThreadRegistry_c registry;
+  registry.add(std::move(o));
+}
+
+// a running count of the memory used by font files and font faces. The objects belonging
+// to one shard of a font cache add and remove their memory here, when they create or free
+// something, so the cache never has to walk over its fonts to know its size. The objects
+// keep the account alive, as they might outlive the cache
+class MemoryAccount_c
+{
+  public:
+    void add(size_t b) { bytes += b; }
+    void remove(size_t b) { bytes -= b; }
+    size_t get(void) const { return bytes; }
+
+  private:
+    std::atomic<size_t> bytes{0};
+};
+
+// the net number of bytes that FreeType allocated through the memory of the libraries in the
+// calling thread, the difference before and after a FreeType call is the memory the call kept
+static thread_local int64_t freeTypeThreadBytes = 0;
+
+// measure the memory FreeType keeps allocated for the calling thread while this object exists
+class FreeTypeMeasure_c
+{
+  public:
+    size_t get(void) const
+    {
+      int64_t d = freeTypeThreadBytes - start;
+      return d > 0 ? d : 0;
+    }
+
+  private:
+    int64_t start = freeTypeThreadBytes;
+};
+
+// one font file opened with FreeType, it is shared by all sizes of the font. Each
+// thread gets its own face for the file, the sizes are FT_Size objects on these faces
+class FontFile_c : public ThreadResources_c, public std::enable_shared_from_this<FontFile_c>, boost::noncopyable
+{
+  public:
+    FontFile_c(std::shared_ptr<FreeTypeLibrary_c> l, const FontFileResource_c & r,
+               std::shared_ptr<MemoryAccount_c> a = nullptr);
+    ~FontFile_c();
+
+    // create a new size on the face of the calling thread, the face is created, when
+    // the thread doesn't have one yet. bytes is set to the memory FreeType allocated for the size
+    std::pair<FT_Face, FT_Size> newSize(uint32_t size, size_t & bytes);
+
+    // free a size that was created by the thread owner. A face must only be used by its
+    // thread, so sizes of other threads are freed the next time their thread creates a size
+    void doneSize(uint64_t owner, FT_Size s);
+
+    // close the face of a thread that ends, together with all its sizes
+    void releaseThread(uint64_t thread) override;
+
+    // memory used by the FreeType faces of all threads and the HarfBuzz face
+    size_t getMemoryUsage(void);
+
+    // count the memory of a shape plan for the given key, plans are cached by the
+    // HarfBuzz face, so each key is only counted once for the file
+    void addShapePlan(const std::tuple<uint32_t, const void *, uint32_t> & key);
+
+    // the characters of the font, see FontFace_c
+    std::vector<uint16_t> coverageIndex;
+    std::vector<uint64_t> coverage;
+
+    // the HarfBuzz face of the font file, it is shared by the HarfBuzz fonts of all sizes and
+    // threads, so that the tables, accelerators and shape plans HarfBuzz keeps are only there once.
+    // HarfBuzz faces may be used by several threads at the same time
+    hb_face_t * hbFace;
+
+    // the account for the memory of this file and all sizes of it, may be empty
+    const std::shared_ptr<MemoryAccount_c> account;
+
+  private:
+
+    class Face_c
+    {
+      public:
+        FT_Face f = nullptr;
+        size_t bytes = 0;
+        std::vector<FT_Size> released;
+    };
+
+    std::shared_ptr<FreeTypeLibrary_c> lib;
+    FontFileResource_c data;  // the font file in memory
+
+    // the face opened by the constructor, it is given to the first thread that needs one
+    FT_Face spare;
+    size_t spareBytes;
+
+    // memory used without the FreeType faces and shape plans
+    size_t baseBytes;
+
+    // the memory of the FreeType faces including the spare one, as measured when they were opened
+    size_t facesBytes;
+
+    // the shape plans counted so far
+    std::set<std::tuple<uint32_t, const void *, uint32_t>> plans;
+
+    void count(size_t b) { if (account) account->add(b); }
+
+    std::mutex mutex;
+    std::map<uint64_t, Face_c> faces;
+};
+
+// the HarfBuzz objects are opaque and allocated outside of our control, so a fixed overhead is
+// counted for each face, font and shape plan. The face only references the font data and builds
+// its accelerators lazily, the plans keep their feature maps and lookup lists. These are rough
+// values for common fonts, everything else we count is measured
+static const size_t hbFaceBytes = 16384;
+static const size_t hbFontBytes = 512;
+static const size_t hbPlanBytes = 4096;
+
+FontFile_c::FontFile_c(std::shared_ptr<FreeTypeLibrary_c> l, const FontFileResource_c & r,
+                       std::shared_ptr<MemoryAccount_c> a) :
+                account(std::move(a)), lib(l), data(loadFontFile(r))
+{
+  FreeTypeMeasure_c measure;
+  FT_Face f = spare = lib->newFace(data, 0);
+  spareBytes = measure.get();
+
+  // create the coverage bitmap from the character map
+  coverageIndex.assign(0x110000 >> 8, 0);
+  coverage.assign(4, 0);
+
+  FT_UInt gi;
+  FT_ULong c = FT_Get_First_Char(f, &gi);
+
+  while (gi != 0)
+  {
+    if (c < 0x110000)
+    {
+      auto & b = coverageIndex[c >> 8];
+
+      if (b == 0)
+      {
+        b = coverage.size() / 4;
+        coverage.resize(coverage.size() + 4, 0);
+      }
+
+      coverage[4*b + ((c >> 6) & 3)] |= uint64_t(1) << (c & 63);
+    }
+
+    c = FT_Get_Next_Char(f, c, &gi);
+  }
+
+  // the font data is in memory and stays there as long as this object exists
+  hb_blob_t * blob = hb_blob_create(reinterpret_cast<const char*>(data.getData().get()), data.getDatasize(),
+                                    HB_MEMORY_MODE_READONLY, nullptr, nullptr);
+  hbFace = hb_face_create(blob, 0);
+  hb_blob_destroy(blob);
+
+  baseBytes = sizeof(FontFile_c)
+            + coverageIndex.size() * sizeof(uint16_t)
+            + coverage.size() * sizeof(uint64_t)
+            + hbFaceBytes;
+  facesBytes = spareBytes;
+
+  count(baseBytes + facesBytes);
+}
+
+FontFile_c::~FontFile_c()
+{
+  if (account) account->remove(baseBytes + facesBytes + plans.size() * hbPlanBytes);
+
+  hb_face_destroy(hbFace);
+
+  if (spare)
+    lib->doneFace(spare);
+
+  // the sizes still left on the faces are freed together with them
+  for (auto & i : faces)
+    if (i.second.f)
+      lib->doneFace(i.second.f);
+}
+
+std::pair<FT_Face, FT_Size> FontFile_c::newSize(uint32_t size, size_t & bytes)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto & face = faces[threadNumber()];
+
+  if (!face.f)
+  {
+    if (spare)
+    {
+      face.f = spare;
+      face.bytes = spareBytes;
+      spare = nullptr;
+    }
+    else
+    {
+      FreeTypeMeasure_c measure;
+      face.f = lib->newFace(data, 0);
+      face.bytes = measure.get();
+      facesBytes += face.bytes;
+      count(face.bytes);
+    }
+
+    // the face is closed when the thread ends
+    addThreadResources(shared_from_this());
+  }
+
+  for (auto s : face.released)
+    FT_Done_Size(s);
+
+  face.released.clear();
+
+  FreeTypeMeasure_c measure;
+  FT_Size s;
+
+  if (FT_New_Size(face.f, &s))
+  {
+    throw FreetypeException_c(std::string("Could not create a new size for font '") +
+                              data.getDescription() + "'");
+  }
+
+  if (FT_Activate_Size(s) || FT_Set_Pixel_Sizes(face.f, (size+32)/64, (size+32)/64))
+  {
+    FT_Done_Size(s);
+
+    throw FreetypeException_c(std::string("Could not set the requested file to font '") +
+                              data.getDescription() + "'");
+  }
+
+  bytes = measure.get();
+
+  return std::make_pair(face.f, s);
+}
+
+size_t FontFile_c::getMemoryUsage(void)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  return baseBytes + facesBytes + plans.size() * hbPlanBytes;
+}
+
+void FontFile_c::addShapePlan(const std::tuple<uint32_t, const void *, uint32_t> & key)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  if (plans.insert(key).second)
+    count(hbPlanBytes);
+}
+
+void FontFile_c::doneSize(uint64_t owner, FT_Size s)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto i = faces.find(owner);
+
+  // when the face of the thread is gone, the size went with it
+  if (i == faces.end()) return;
+
+  if (owner == threadNumber())
+    FT_Done_Size(s);
+  else
+    i->second.released.push_back(s);
+}
+
+void FontFile_c::releaseThread(uint64_t thread)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto i = faces.find(thread);
+
+  if (i == faces.end()) return;
+
+  if (i->second.f)
+  {
+    lib->doneFace(i->second.f);
+    facesBytes -= i->second.bytes;
+    if (account) account->remove(i->second.bytes);
+  }
+
+  faces.erase(i);
+}
+
+// the FreeType size and harfbuzz structures of one thread for a font face, the face is
+// the one of the font file for this thread, the harfbuzz structures are created lazily,
+// the key for the shape plans is script, language and direction
+class FontInstance_c
+{
+  public:
+    FT_Face f = nullptr;
+    FT_Size s = nullptr;
+    hb_font_t * hbFont = nullptr;
+    std::map<std::tuple<uint32_t, const void *, uint32_t>, hb_shape_plan_t *> shapePlans;
+
+    // approximate memory used by the structures above, the structures are only
+    // changed by the thread of the instance, this may also be read by others
+    std::atomic<size_t> bytes{0};
+
+    // the account of the font file, may be null
+    MemoryAccount_c * account = nullptr;
+
+    // count memory for a newly created structure
+    void addBytes(size_t b)
+    {
+      bytes += b;
+      if (account) account->add(b);
+    }
+};
+
+static std::atomic<uint64_t> nextFontFaceId(1);
+
+// the instances of all threads that use a font face, the instance of a thread is
+// released when the thread ends, all others when the font face is destroyed
+class FontFaceData_c : public ThreadResources_c, public std::enable_shared_from_this<FontFaceData_c>, boost::noncopyable
+{
+  public:
+    FontFaceData_c(std::shared_ptr<FontFile_c> f, uint32_t s) : id(nextFontFaceId++), file(std::move(f)), size(s)
+    {
+      if (file->account) file->account->add(baseBytes());
+    }
+    ~FontFaceData_c();
+
+    // get the instance of the calling thread, create it, when necessary
+    FontInstance_c & get(void);
+
+    void releaseThread(uint64_t thread) override;
+
+    // approximate memory used by the instances of all threads
+    size_t getMemoryUsage(void);
+
+    // unique number of this font face, used to find the instances in the per thread cache
+    const uint64_t id;
+
+    // the memory of the font face and this object without the instances
+    static size_t baseBytes(void) { return sizeof(FontFace_c) + sizeof(FontFaceData_c); }
+
+  private:
+
+    // free the structures of an instance that belongs to the given thread
+    void destroy(uint64_t thread, FontInstance_c & i);
+
+    std::shared_ptr<FontFile_c> file;
+    uint32_t size;
+
+    std::mutex mutex;
+    std::map<uint64_t, std::unique_ptr<FontInstance_c>> instances;
+};
+
+FontFaceData_c::~FontFaceData_c()
+{
+  for (auto & i : instances)
+    destroy(i.first, *i.second);
+
+  if (file->account) file->account->remove(baseBytes());
+}
+
+void FontFaceData_c::destroy(uint64_t thread, FontInstance_c & i)
+{
+  for (auto & p : i.shapePlans)
+    hb_shape_plan_destroy(p.second);
+
+  if (i.hbFont)
+    hb_font_destroy(i.hbFont);
+
+  file->doneSize(thread, i.s);
+
+  if (i.account) i.account->remove(i.bytes);
+}
+
+FontInstance_c & FontFaceData_c::get(void)
+{
+  // each thread remembers the instances it used last, so that in the normal case
+  // no lock is required. The ids of font faces are never reused, so entries of
+  // font faces that no longer exist are never found
+  static thread_local std::array<std::pair<uint64_t, FontInstance_c *>, 8> recent {};
+
+  auto & r = recent[id % recent.size()];
+
+  if (r.first == id) return *r.second;
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto i = instances.find(threadNumber());
+
+  if (i == instances.end())
+  {
+    // the instance is only stored once the size exists, when that fails there
+    // must not be an empty instance left behind
+    size_t sizeBytes;
+    auto fs = file->newSize(size, sizeBytes);
+    std::unique_ptr<FontInstance_c> n(new FontInstance_c);
+    n->f = fs.first;
+    n->s = fs.second;
+    n->account = file->account.get();
+    n->addBytes(sizeof(FontInstance_c) + sizeBytes);
+
+    i = instances.insert(std::make_pair(threadNumber(), std::move(n))).first;
+
+    // the instance is released when the thread ends
+    addThreadResources(shared_from_this());
+  }
+
+  r = std::make_pair(id, i->second.get());
+
+  return *i->second;
+}
+
+void FontFaceData_c::releaseThread(uint64_t thread)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto i = instances.find(thread);
+
+  if (i == instances.end()) return;
+
+  destroy(thread, *i->second);
+  instances.erase(i);
+}
+
+size_t FontFaceData_c::getMemoryUsage(void)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  size_t res = baseBytes();
+
+  for (auto & i : instances)
+    res += i.second->bytes;
+
+  return res;
+}
+
+}
+
 FontFace_c::FontFace_c(std::shared_ptr<FreeTypeLibrary_c> l, const internal::FontFileResource_c & r, uint32_t s) :
-                lib(l), rec(r), size(s)
+                FontFace_c(std::make_shared<internal::FontFile_c>(l, r), r, s)
 {
-  f = lib->newFace(r, s);
+}
+
+FontFace_c::FontFace_c(std::shared_ptr<internal::FontFile_c> fi, const internal::FontFileResource_c & r, uint32_t s) :
+                file(std::move(fi)), rec(r), size(s), data(std::make_shared<internal::FontFaceData_c>(file, s))
+{
+  coverageIndex = file->coverageIndex.data();
+  coverage = file->coverage.data();
+
+  // create the instance of this thread to get the metrics of the size
+  auto & i = data->get();
+
+  height = i.s->metrics.height;
+  ascender = i.s->metrics.ascender;
+  descender = i.s->metrics.descender;
+  underlinePosition = static_cast<int64_t>(i.f->underline_position*i.s->metrics.y_scale) / 65536;
+  underlineThickness = static_cast<int64_t>(i.f->underline_thickness*i.s->metrics.y_scale) / 65536;
 }
 
 FontFace_c::~FontFace_c()
 {
-  lib->doneFace(f);
+  // the instances are released together with the data, it might be kept
+  // a little longer by a thread that is just ending
+}
+
+internal::FontInstance_c & FontFace_c::getInstance(void) const
+{
+  return data->get();
+}
+
+internal::FontInstance_c & FontFace_c::activate(void) const
+{
+  auto & i = getInstance();
+
+  // the other sizes of the font file share the face, so our size might not be the active one
+  if (i.f->size != i.s)
+    FT_Activate_Size(i.s);
+
+  return i;
+}
+
+FT_Face FontFace_c::getFace(void) const
+{
+  return activate().f;
+}
+
+// the advance of a glyph exactly as FreeType calculates it for the size of the instance, the
+// same way hb_ft_font_create does it: unhinted and rounded from 16.16 to 26.6
+static hb_position_t getGlyphHAdvance(hb_font_t *, void * fontData, hb_codepoint_t glyph, void *)
+{
+  auto & i = *static_cast<internal::FontInstance_c *>(fontData);
+
+  // the other sizes of the font file share the face, so our size might not be the active one
+  if (i.f->size != i.s)
+    FT_Activate_Size(i.s);
+
+  FT_Fixed v;
+
+  if (FT_Get_Advance(i.f, glyph, FT_LOAD_DEFAULT | FT_LOAD_NO_HINTING, &v))
+    return 0;
+
+  return (v + (1 << 9)) >> 10;
+}
+
+// the glyph of a character from the character map of FreeType, for fonts without a cmap table
+static hb_bool_t getNominalGlyph(hb_font_t *, void * fontData, hb_codepoint_t unicode, hb_codepoint_t * glyph, void *)
+{
+  auto & i = *static_cast<internal::FontInstance_c *>(fontData);
+
+  *glyph = FT_Get_Char_Index(i.f, unicode);
+
+  return *glyph != 0;
+}
+
+// the extents of a glyph from FreeType, for fonts without the tables HarfBuzz reads them from
+static hb_bool_t getGlyphExtents(hb_font_t *, void * fontData, hb_codepoint_t glyph, hb_glyph_extents_t * extents, void *)
+{
+  auto & i = *static_cast<internal::FontInstance_c *>(fontData);
+
+  if (i.f->size != i.s)
+    FT_Activate_Size(i.s);
+
+  if (FT_Load_Glyph(i.f, glyph, FT_LOAD_DEFAULT | FT_LOAD_NO_HINTING))
+    return false;
+
+  extents->x_bearing = i.f->glyph->metrics.horiBearingX;
+  extents->y_bearing = i.f->glyph->metrics.horiBearingY;
+  extents->width = i.f->glyph->metrics.width;
+  extents->height = -i.f->glyph->metrics.height;
+
+  return true;
+}
+
+// the font functions shared by all instances, created once and never changed. For sfnt fonts
+// only the advances come from FreeType, all other fonts (like BDF, PCF or Type1) have none of
+// the tables HarfBuzz needs, so the characters map to glyphs and the extents via FreeType, too
+static hb_font_funcs_t * getFontFuncs(bool sfnt)
+{
+  static hb_font_funcs_t * funcs[2] = { nullptr, nullptr };
+  static std::once_flag once;
+
+  std::call_once(once, []()
+  {
+    for (int s = 0; s < 2; s++)
+    {
+      auto f = hb_font_funcs_create();
+      hb_font_funcs_set_glyph_h_advance_func(f, getGlyphHAdvance, nullptr, nullptr);
+
+      if (s == 0)
+      {
+        hb_font_funcs_set_nominal_glyph_func(f, getNominalGlyph, nullptr, nullptr);
+        hb_font_funcs_set_glyph_extents_func(f, getGlyphExtents, nullptr, nullptr);
+      }
+
+      hb_font_funcs_make_immutable(f);
+      funcs[s] = f;
+    }
+  });
+
+  return funcs[sfnt ? 1 : 0];
+}
+
+hb_font_t * FontFace_c::getHarfbuzzFont(void)
+{
+  auto & i = getInstance();
+
+  if (!i.hbFont)
+  {
+    // all glyph metrics but the advances come from the font tables, scaled like
+    // hb_ft_font_create does it for the FreeType size. Fonts without these tables
+    // get the glyphs and extents from FreeType, see getFontFuncs
+    hb_font_t * parent = hb_font_create(file->hbFace);
+    hb_ot_font_set_funcs(parent);
+
+    // bitmap fonts have no units, their scale is the pixel size
+    if (i.f->units_per_EM)
+      hb_font_set_scale(parent,
+                        ((uint64_t)i.s->metrics.x_scale * i.f->units_per_EM + (1u<<15)) >> 16,
+                        ((uint64_t)i.s->metrics.y_scale * i.f->units_per_EM + (1u<<15)) >> 16);
+    else
+      hb_font_set_scale(parent, i.s->metrics.x_ppem * 64, i.s->metrics.y_ppem * 64);
+
+    hb_font_set_ppem(parent, i.s->metrics.x_ppem, i.s->metrics.y_ppem);
+
+    // the advances come from FreeType, the rounding of HarfBuzz differs for some glyphs
+    // and sizes. The sub font inherits scale and ppem and keeps the parent alive
+    i.hbFont = hb_font_create_sub_font(parent);
+    hb_font_set_funcs(i.hbFont, getFontFuncs(FT_IS_SFNT(i.f)), &i, nullptr);
+    hb_font_destroy(parent);
+
+    i.addBytes(2*hbFontBytes);
+  }
+
+  return i.hbFont;
+}
+
+hb_shape_plan_t * FontFace_c::getShapePlan(const hb_segment_properties_t & props)
+{
+  auto & i = getInstance();
+
+  auto k = std::make_tuple((uint32_t)props.script, (const void *)props.language, (uint32_t)props.direction);
+
+  auto p = i.shapePlans.find(k);
+
+  if (p != i.shapePlans.end())
+    return p->second;
+
+  // the plan is cached by the face of the font file, so all sizes and threads share it
+  hb_shape_plan_t * plan = hb_shape_plan_create_cached(file->hbFace, &props, NULL, 0, NULL);
+
+  i.shapePlans[k] = plan;
+  // the plan belongs to the HarfBuzz face, the instance only keeps a map entry for it
+  i.addBytes(sizeof(k) + sizeof(plan) + 4*sizeof(void *));
+  file->addShapePlan(k);
+
+  return plan;
+}
+
+size_t FontFace_c::getMemoryUsage(void) const
+{
+  return data->getMemoryUsage();
 }
 
 uint32_t FontFace_c::getHeight(void) const
 {
-  return f->size->metrics.height;
+  return height;
 }
 
 int32_t FontFace_c::getAscender(void) const
 {
-  return f->size->metrics.ascender;
+  return ascender;
 }
 
 int32_t FontFace_c::getDescender(void) const
 {
-  return f->size->metrics.descender;
+  return descender;
 }
 
 int32_t FontFace_c::getUnderlinePosition(void) const
 {
-  return static_cast<int64_t>(f->underline_position*f->size->metrics.y_scale) / 65536;
+  return underlinePosition;
 }
 
 int32_t FontFace_c::getUnderlineThickness(void) const
 {
-  return static_cast<int64_t>(f->underline_thickness*f->size->metrics.y_scale) / 65536;
+  return underlineThickness;
 }
 
-std::shared_ptr<FontFace_c> FontCache_c::getFont(const internal::FontFileResource_c & res, uint32_t size)
+namespace internal {
+
+// the data of a font cache, the cache is split into several shards, each
+// with its own lock, so that threads getting different fonts don't block each other
+class FontCacheData_c
+{
+  public:
+
+    class FontFaceParameter_c
+    {
+      public:
+        FontFileResource_c res;
+        uint32_t size;
+
+        FontFaceParameter_c(const FontFileResource_c r, uint32_t s) : res(std::move(r)), size(s) {}
+
+        bool operator<(const FontFaceParameter_c & b) const
+        {
+          if (res < b.res) return true;
+          if (b.res < res) return false;
+
+          if (size < b.size) return true;
+          return false;
+        }
+    };
+
+    // a font in the cache, the entries form a list ordered by their last use,
+    // key points to the key of the entry in the map
+    class Entry_c
+    {
+      public:
+        std::shared_ptr<FontFace_c> face;
+        const FontFaceParameter_c * key = nullptr;
+        Entry_c * newer = nullptr;
+        Entry_c * older = nullptr;
+    };
+
+    // one part of the cache, all sizes of a font file are in the same shard
+    class Shard_c
+    {
+      public:
+        std::mutex mutex;
+
+        // all open fonts, used to check whether they have all been released
+        // on library destruction
+        std::map<FontFaceParameter_c, Entry_c> fonts;
+
+        // the opened font files, they are kept alive by the font faces of their sizes
+        std::map<FontFileResource_c, std::weak_ptr<FontFile_c> > files;
+
+        // the ends of the list of the entries, ordered by their last use
+        Entry_c * newest = nullptr;
+        Entry_c * oldest = nullptr;
+
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+
+        // the memory used by the files and fonts of this shard, they update it
+        // themselves, whenever they create or free something
+        std::shared_ptr<MemoryAccount_c> account = std::make_shared<MemoryAccount_c>();
+
+        void unlink(Entry_c * e);
+        void makeNewest(Entry_c * e);
+
+        // remove a font from the shard, the font file is forgotten as well, when
+        // this was its last size
+        void remove(Entry_c * e);
+    };
+
+    // remove unused fonts, the least recently used first, until the cache uses
+    // no more than the given size or there are no more unused fonts
+    void trim(size_t size, size_t firstShard);
+
+    // the memory used by all shards
+    size_t getBytes(void) const;
+
+    std::array<Shard_c, 8> shards;
+
+    std::atomic<size_t> budget{0};
+};
+
+// all sizes of a font file go into the same shard, so that they can share the opened file
+static size_t shardIndex(const FontFileResource_c & r, size_t shards)
+{
+  return (std::hash<std::string>()(r.getDescription()) ^ ((size_t)r.getData().get() >> 4)) % shards;
+}
+
+void FontCacheData_c::Shard_c::unlink(Entry_c * e)
+{
+  if (e->newer) e->newer->older = e->older; else newest = e->older;
+  if (e->older) e->older->newer = e->newer; else oldest = e->newer;
+
+  e->newer = e->older = nullptr;
+}
+
+void FontCacheData_c::Shard_c::makeNewest(Entry_c * e)
+{
+  e->older = newest;
+  e->newer = nullptr;
+
+  if (newest) newest->newer = e; else oldest = e;
+
+  newest = e;
+}
+
+void FontCacheData_c::Shard_c::remove(Entry_c * e)
 {
-  FontFaceParameter_c ffp(res, size);
+  unlink(e);
+
+  // erasing the entry frees the font, which removes its memory from the account
+  FontFileResource_c res = e->key->res;
+  fonts.erase(fonts.find(*e->key));
 
-  auto i = fonts.find(ffp);
+  auto f = files.find(res);
+
+  if (f != files.end() && f->second.expired())
+    files.erase(f);
+}
+
+size_t FontCacheData_c::getBytes(void) const
+{
+  size_t res = 0;
 
-  if (i != fonts.end())
+  for (auto & shard : shards)
+    res += shard.account->get();
+
+  return res;
+}
+
+void FontCacheData_c::trim(size_t size, size_t firstShard)
+{
+  // start with the shard of the font just added, it is the most likely one to contain
+  // unused fonts, only one shard is locked at a time
+  for (size_t n = 0; n < shards.size(); n++)
   {
-    auto a = i->second;
+    auto & shard = shards[(firstShard + n) % shards.size()];
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    // go from the least recently used font to the newest one, fonts that are used by
+    // somebody except the cache stay, as only the cache can hand out new references
+    // the use count can not increase while we hold the lock
+    Entry_c * e = shard.oldest;
+
+    while (e)
+    {
+      if (getBytes() <= size) return;
 
-    if (a) return a;
+      Entry_c * next = e->newer;
+
+      if (e->face.use_count() == 1)
+      {
+        shard.remove(e);
+        shard.evictions++;
+      }
+
+      e = next;
+    }
   }
+}
 
-  // TODO... race maybe someone else opens a font here?
+}
 
-  auto a = std::make_shared<FontFace_c>(lib, res, size);
+FontCache_c::FontCache_c(std::shared_ptr<FreeTypeLibrary_c> l) : data(new internal::FontCacheData_c), lib(l)
+{
+}
+
+FontCache_c::FontCache_c(void) : FontCache_c(std::make_shared<FreeTypeLibrary_c>())
+{
+}
+
+FontCache_c::~FontCache_c()
+{
+}
+
+std::shared_ptr<FontFace_c> FontCache_c::getFont(const internal::FontFileResource_c & res, uint32_t size)
+{
+  internal::FontCacheData_c::FontFaceParameter_c ffp(res, size);
+
+  size_t si = internal::shardIndex(res, data->shards.size());
+  auto & shard = data->shards[si];
+
+  std::shared_ptr<FontFace_c> a;
+
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
 
-  fonts.insert(std::make_pair(ffp, a));
+    auto i = shard.fonts.find(ffp);
+
+    if (i != shard.fonts.end())
+    {
+      shard.hits++;
+      shard.unlink(&i->second);
+      shard.makeNewest(&i->second);
+
+      return i->second.face;
+    }
+
+    shard.misses++;
+
+    // all sizes of a font file share the opened file
+    auto & file = shard.files[res];
+    auto fi = file.lock();
+
+    if (!fi)
+    {
+      fi = std::make_shared<internal::FontFile_c>(lib, res, shard.account);
+      file = fi;
+    }
+
+    a = std::make_shared<FontFace_c>(fi, res, size);
+
+    auto e = shard.fonts.insert(std::make_pair(ffp, internal::FontCacheData_c::Entry_c())).first;
+    e->second.face = a;
+    e->second.key = &e->first;
+    shard.makeNewest(&e->second);
+  }
+
+  // the new font is in use by us, so it will not be removed
+  size_t budget = data->budget;
+
+  if (budget != 0 && data->getBytes() > budget)
+    data->trim(budget, si);
 
   return a;
 }
 
+void FontCache_c::clear(void)
+{
+  for (auto & shard : data->shards)
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    internal::FontCacheData_c::Entry_c * e = shard.oldest;
+
+    while (e)
+    {
+      auto next = e->newer;
+
+      if (e->face.use_count() == 1)
+        shard.remove(e);
+
+      e = next;
+    }
+  }
+}
+
+void FontCache_c::setBudget(size_t b)
+{
+  data->budget = b;
+
+  if (b)
+    data->trim(b, 0);
+}
+
+FontCacheStatistics_c FontCache_c::getStatistics(void)
+{
+  FontCacheStatistics_c s;
+
+  for (auto & shard : data->shards)
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    s.hits += shard.hits;
+    s.misses += shard.misses;
+    s.evictions += shard.evictions;
+    s.faces += shard.fonts.size();
+  }
+
+  s.bytes = data->getBytes();
+  s.budget = data->budget;
+  s.freetypeBytes = lib->getMemoryStatistics().bytes;
+
+  return s;
+}
 
 Font_c FontCache_c::getFont(const FontResource_c & res, uint32_t size)
 {
@@ -139,6 +1123,8 @@ FontFace_c::GlyphSlot_c FontFace_c::renderGlyph(glyphIndex_t glyphIndex, SubPixe
       break;
   }
 
+  FT_Face f = activate().f;
+
   /* load glyph image into the slot (erase previous one) */
   if (FT_Load_Glyph(f, glyphIndex, FT_LOAD_TARGET_LIGHT)) return 0;
   if (FT_Render_Glyph(f->glyph, rm)) return 0;
@@ -151,13 +1137,225 @@ FontFace_c::GlyphSlot_c FontFace_c::renderGlyph(glyphIndex_t glyphIndex, SubPixe
   return GlyphSlot_c(f->glyph);
 }
 
-bool FontFace_c::containsGlyph(char32_t ch)
+namespace internal {
+
+// the allocator of a FreeType library. Each block has a header containing its size. Freed
+// blocks up to maxPooled bytes are kept in one list per size class and reused for the
+// next allocation of that class, until the pool holds poolLimit bytes. FreeType uses the
+// library from several threads at the same time, each size class has its own lock, so
+// that threads only wait for each other, when they use blocks of the same class, and
+// the statistics are atomics, larger blocks don't need a lock at all
+class FreeTypeMemory_c : boost::noncopyable
+{
+  public:
+    FreeTypeMemory_c(void)
+    {
+      rec.user = this;
+      rec.alloc = [](FT_Memory m, long size) -> void * {
+        return static_cast<FreeTypeMemory_c*>(m->user)->allocate(size);
+      };
+      rec.free = [](FT_Memory m, void * block) {
+        static_cast<FreeTypeMemory_c*>(m->user)->release(block);
+      };
+      rec.realloc = [](FT_Memory m, long curSize, long newSize, void * block) -> void * {
+        return static_cast<FreeTypeMemory_c*>(m->user)->reallocate(curSize, newSize, block);
+      };
+    }
+
+    ~FreeTypeMemory_c(void)
+    {
+      for (auto & c : pool)
+        while (c.head)
+        {
+          Header_c * n = *reinterpret_cast<Header_c**>(c.head+1);
+          free(c.head);
+          c.head = n;
+        }
+    }
+
+    FT_Memory getMemory(void) { return &rec; }
+
+    FreeTypeMemoryStatistics_c getStatistics(void)
+    {
+      FreeTypeMemoryStatistics_c s;
+
+      s.bytes = bytes;
+      s.peakBytes = peakBytes;
+      s.pooledBytes = pooledBytes;
+      s.allocations = allocations;
+      s.poolHits = poolHits;
+
+      return s;
+    }
+
+  private:
+
+    // the header in front of each block, it keeps the blocks aligned
+    union Header_c
+    {
+      size_t size;
+      std::max_align_t align;
+    };
+
+    // the freed blocks of one size class, the padding keeps the locks of neighbouring
+    // classes in different cache lines, so that they don't slow each other down
+    class SizeClass_c
+    {
+      public:
+        std::mutex mutex;
+        Header_c * head = nullptr;
+        char padding[64];
+    };
+
+    static const size_t granularity = 16;
+    static const size_t maxPooled = 512;
+    static const size_t poolLimit = 1024*1024;
+
+    static size_t sizeClass(size_t size) { return (size + granularity - 1) / granularity; }
+
+    void addBytes(size_t s)
+    {
+      size_t b = bytes += s;
+      size_t p = peakBytes;
+
+      while (p < b && !peakBytes.compare_exchange_weak(p, b)) {}
+    }
+
+    void * allocate(long size)
+    {
+      if (size <= 0) return nullptr;
+
+      size_t s = size;
+      Header_c * h = nullptr;
+
+      allocations++;
+      addBytes(s);
+
+      if (s <= maxPooled)
+      {
+        auto & c = pool[sizeClass(s)];
+
+        std::lock_guard<std::mutex> lock(c.mutex);
+
+        if (c.head)
+        {
+          h = c.head;
+          c.head = *reinterpret_cast<Header_c**>(h+1);
+          pooledBytes -= sizeClass(s) * granularity;
+          poolHits++;
+        }
+      }
+
+      if (!h)
+      {
+        // pooled blocks are allocated with the full size of their class, so that
+        // they can be reused for all sizes of the class
+        size_t a = s <= maxPooled ? sizeClass(s) * granularity : s;
+        h = static_cast<Header_c*>(malloc(sizeof(Header_c) + a));
+
+        if (!h)
+        {
+          bytes -= s;
+          return nullptr;
+        }
+      }
+
+      h->size = s;
+      freeTypeThreadBytes += s;
+      return h+1;
+    }
+
+    void release(void * block)
+    {
+      if (!block) return;
+
+      Header_c * h = static_cast<Header_c*>(block) - 1;
+      size_t s = h->size;
+
+      bytes -= s;
+      freeTypeThreadBytes -= s;
+
+      if (s <= maxPooled)
+      {
+        size_t a = sizeClass(s) * granularity;
+
+        // reserve the space in the pool first, so that the limit holds with many threads
+        if (pooledBytes.fetch_add(a) + a <= poolLimit)
+        {
+          auto & c = pool[sizeClass(s)];
+
+          std::lock_guard<std::mutex> lock(c.mutex);
+
+          *reinterpret_cast<Header_c**>(block) = c.head;
+          c.head = h;
+
+          return;
+        }
+
+        pooledBytes -= a;
+      }
+
+      free(h);
+    }
+
+    void * reallocate(long curSize, long newSize, void * block)
+    {
+      if (!block) return allocate(newSize);
+
+      Header_c * h = static_cast<Header_c*>(block) - 1;
+
+      // the block is large enough when it stays within its size class
+      if (   newSize > 0 && h->size <= maxPooled && (size_t)newSize <= maxPooled
+          && sizeClass(newSize) == sizeClass(h->size))
+      {
+        if ((size_t)newSize > h->size)
+          addBytes(newSize - h->size);
+        else
+          bytes -= h->size - newSize;
+
+        freeTypeThreadBytes += (int64_t)newSize - (int64_t)h->size;
+        h->size = newSize;
+
+        return block;
+      }
+
+      void * n = allocate(newSize);
+
+      if (n)
+      {
+        memcpy(n, block, std::min(curSize, newSize));
+        release(block);
+      }
+
+      return n;
+    }
+
+    FT_MemoryRec_ rec;
+
+    std::array<SizeClass_c, maxPooled / granularity + 1> pool;
+
+    std::atomic<size_t> bytes{0};
+    std::atomic<size_t> peakBytes{0};
+    std::atomic<size_t> pooledBytes{0};
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> poolHits{0};
+};
+
+// the library internals, FreeType needs the accesses to the library itself
+// (opening and closing faces) to be serialized
+class FreeTypeLibraryData_c
 {
-  return FT_Get_Char_Index(f, ch) != 0;
+  public:
+    FreeTypeMemory_c memory;
+    std::mutex mutex;
+};
+
 }
 
 FT_Face FreeTypeLibrary_c::newFace(const internal::FontFileResource_c & r, uint32_t size)
 {
+  std::lock_guard<std::mutex> lock(data->mutex);
+
   FT_Face f;
   FT_Open_Args a;
   if (r.getDatasize() == 0) {
@@ -178,9 +1376,9 @@ FT_Face FreeTypeLibrary_c::newFace(const internal::FontFileResource_c & r, uint3
                               "file is spelled wrong or file is broken");
   }
 
-  if (FT_Set_Pixel_Sizes(f, (size+32)/64, (size+32)/64))
+  if (size != 0 && FT_Set_Pixel_Sizes(f, (size+32)/64, (size+32)/64))
   {
-    doneFace(f);
+    FT_Done_Face(f);
 
     throw FreetypeException_c(std::string("Could not set the requested file to font '") +
                               r.getDescription() + "'");
@@ -204,7 +1402,7 @@ FT_Face FreeTypeLibrary_c::newFace(const internal::FontFileResource_c & r, uint3
     {
       if (FT_Set_Charmap(f, f->charmaps[i]))
       {
-        doneFace(f);
+        FT_Done_Face(f);
         throw FreetypeException_c(std::string("Could not set a unicode character map to font '") +
                                   r.getDescription() + "'. Maybe the font doesn't have one?");
       }
@@ -212,40 +1410,97 @@ FT_Face FreeTypeLibrary_c::newFace(const internal::FontFileResource_c & r, uint3
     }
   }
 
-  doneFace(f);
+  FT_Done_Face(f);
   throw FreetypeException_c(std::string("Could not find a unicode character map to font '") +
                             r.getDescription() + "'. Maybe the font doesn't have one?");
 }
 
 void FreeTypeLibrary_c::doneFace(FT_Face f)
 {
+  std::lock_guard<std::mutex> lock(data->mutex);
+
   FT_Done_Face(f);
 }
 
 FreeTypeLibrary_c::~FreeTypeLibrary_c()
 {
-  FT_Done_FreeType(lib);
+  FT_Done_Library(lib);
 }
 
-FreeTypeLibrary_c::FreeTypeLibrary_c()
+FreeTypeLibrary_c::FreeTypeLibrary_c() : data(new internal::FreeTypeLibraryData_c)
 {
-  if (FT_Init_FreeType(&lib))
+  if (FT_New_Library(data->memory.getMemory(), &lib))
   {
     throw FreetypeException_c("Could not initialize font rendering library instance");
   }
 
+  // the same setup as FT_Init_FreeType does it
+  FT_Add_Default_Modules(lib);
+  FT_Set_Default_Properties(lib);
+
   FT_Library_SetLcdFilter(lib, FT_LCD_FILTER_DEFAULT);
 }
 
-std::shared_ptr<FontFace_c> Font_c::get(char32_t codepoint) const
+FreeTypeMemoryStatistics_c FreeTypeLibrary_c::getMemoryStatistics(void) const
+{
+  return data->memory.getStatistics();
+}
+
+namespace internal {
+
+// a small direct mapped table of codepoints and the index of the face that
+// was found for them. Each entry contains the codepoint in the upper 24 bits
+// and the face index plus 1 in the lower 8 bits, 0 is an empty entry.
+// Entries are single atomic words, so all threads using a font can share the table
+class FontFallbackMemo_c
+{
+  public:
+    std::array<std::atomic<uint32_t>, 512> entries;
+
+    FontFallbackMemo_c(void)
+    {
+      for (auto & e : entries)
+        e.store(0, std::memory_order_relaxed);
+    }
+};
+
+}
+
+void Font_c::add(std::shared_ptr<FontFace_c> f)
+{
+  fonts.emplace_back(std::move(f));
+
+  // copies of this font made before still share the old memo, which
+  // is right for their list of faces, so we need a new one
+  memo = std::make_shared<internal::FontFallbackMemo_c>();
+}
+
+const std::shared_ptr<FontFace_c> & Font_c::get(char32_t codepoint) const
 {
-  for (auto f : fonts)
-    if (f->containsGlyph(codepoint)) return f;
+  static const std::shared_ptr<FontFace_c> none;
+
+  if (fonts.empty()) return none;
+
+  auto & e = memo->entries[(codepoint ^ (codepoint >> 9)) % memo->entries.size()];
+  uint32_t v = e.load(std::memory_order_relaxed);
+
+  if ((v & 0xFF) && (v >> 8) == codepoint)
+    return fonts[(v & 0xFF) - 1];
+
+  // not known, search the faces, when no face contains the codepoint the first one is used
+  size_t idx = 0;
+
+  for (size_t i = 0; i < fonts.size(); i++)
+    if (fonts[i]->containsGlyph(codepoint))
+    {
+      idx = i;
+      break;
+    }
 
-  if (fonts.size())
-    return fonts[0];
+  if (idx < 255 && codepoint < 0x1000000)
+    e.store((codepoint << 8) | (idx+1), std::memory_order_relaxed);
 
-  return 0;
+  return fonts[idx];
 }
 
 
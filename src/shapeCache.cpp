@@ -0,0 +1,181 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#include "shapeCache_internal.h"
+
+
+namespace STLL {
+
+namespace internal {
+
+// rough estimate of the memory required for one entry, the fixed part accounts
+// for the hash map node, the entry and the glyph vector object
+static size_t entrySize(const ShapeKey_c & k, const ShapedGlyphs_c & g)
+{
+  return 128 + k.text.size()*sizeof(char32_t) + g.size()*sizeof(ShapedGlyph_c);
+}
+
+void ShapeCache_c::Shard_c::unlink(Entry_c & e)
+{
+  if (e.newer) e.newer->older = e.older; else newest = e.older;
+  if (e.older) e.older->newer = e.newer; else oldest = e.newer;
+
+  e.newer = e.older = nullptr;
+}
+
+void ShapeCache_c::Shard_c::makeNewest(Entry_c & e)
+{
+  e.older = newest;
+  e.newer = nullptr;
+
+  if (newest) newest->newer = &e; else oldest = &e;
+  newest = &e;
+}
+
+void ShapeCache_c::Shard_c::trim(size_t size)
+{
+  while (bytes > size && oldest)
+  {
+    Entry_c & e = *oldest;
+
+    bytes -= e.bytes;
+    unlink(e);
+    cache.erase(cache.find(*e.key));
+  }
+}
+
+std::shared_ptr<const ShapedGlyphs_c> ShapeCache_c::find(const ShapeKey_c & k)
+{
+  auto & shard = getShard(k);
+
+  std::lock_guard<std::mutex> lock(shard.mutex);
+
+  auto i = shard.cache.find(k);
+
+  if (i == shard.cache.end())
+  {
+    shard.misses++;
+    return nullptr;
+  }
+
+  shard.hits++;
+
+  if (shard.newest != &i->second)
+  {
+    shard.unlink(i->second);
+    shard.makeNewest(i->second);
+  }
+
+  return i->second.glyphs;
+}
+
+void ShapeCache_c::insert(ShapeKey_c k, std::shared_ptr<const ShapedGlyphs_c> g)
+{
+  auto & shard = getShard(k);
+
+  size_t s = entrySize(k, *g);
+  size_t b = budget / shards.size();
+
+  // things that don't fit into the budget of the shard are not stored at all
+  if (s > b) return;
+
+  std::lock_guard<std::mutex> lock(shard.mutex);
+
+  auto i = shard.cache.insert(std::make_pair(std::move(k), Entry_c{std::move(g), s}));
+
+  // when someone else was faster, keep the existing entry
+  if (!i.second) return;
+
+  shard.trim(b - s);
+
+  i.first->second.key = &i.first->first;
+  shard.makeNewest(i.first->second);
+  shard.bytes += s;
+}
+
+void ShapeCache_c::setBudget(size_t b)
+{
+  budget = b;
+
+  for (auto & shard : shards)
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.trim(b / shards.size());
+  }
+}
+
+void ShapeCache_c::clear(void)
+{
+  for (auto & shard : shards)
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    shard.cache.clear();
+    shard.newest = shard.oldest = nullptr;
+    shard.bytes = 0;
+    shard.hits = 0;
+    shard.misses = 0;
+  }
+}
+
+ShapeCacheStatistics_c ShapeCache_c::getStatistics(void)
+{
+  ShapeCacheStatistics_c s;
+
+  for (auto & shard : shards)
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    s.hits += shard.hits;
+    s.misses += shard.misses;
+    s.entries += shard.cache.size();
+    s.bytes += shard.bytes;
+  }
+
+  s.budget = budget;
+
+  return s;
+}
+
+ShapeCache_c & getShapeCache(void)
+{
+  static ShapeCache_c cache;
+  return cache;
+}
+
+}
+
+ShapeCacheStatistics_c getShapeCacheStatistics(void)
+{
+  return internal::getShapeCache().getStatistics();
+}
+
+void setShapeCacheBudget(size_t bytes)
+{
+  internal::getShapeCache().setBudget(bytes);
+}
+
+void clearShapeCache(void)
+{
+  internal::getShapeCache().clear();
+}
+
+}
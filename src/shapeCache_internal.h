@@ -0,0 +1,170 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#ifndef STLL_SHAPE_CACHE_INTERNAL_H
+#define STLL_SHAPE_CACHE_INTERNAL_H
+
+#include <stll/layouter.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <array>
+#include <atomic>
+
+#include <stdint.h>
+
+namespace STLL { namespace internal {
+
+// one glyph as it comes out of harfbuzz, the cluster is relative to
+// the start of the text that was shaped
+class ShapedGlyph_c
+{
+  public:
+    glyphIndex_t glyph;
+    uint32_t cluster;
+    int32_t x_advance;
+    int32_t y_advance;
+    int32_t x_offset;
+    int32_t y_offset;
+
+    // when true, the text must not be split in front of the cluster of this
+    // glyph without shaping both sides again
+    bool unsafeToBreak;
+};
+
+typedef std::vector<ShapedGlyph_c> ShapedGlyphs_c;
+
+// the key for the shaping cache, it contains everything that influences the
+// result of the shaping
+class ShapeKey_c
+{
+  public:
+    // the text to shape, including the context that harfbuzz looks at
+    // before and after the text
+    std::u32string text;
+    uint8_t preContext;
+    uint8_t postContext;
+
+    // the font that was used, we keep a weak pointer, so that the cache does not keep
+    // fonts alive, the raw pointer is only used for hashing
+    std::weak_ptr<FontFace_c> font;
+    const FontFace_c * fontPtr;
+
+    uint32_t lang;  // the language atom
+    bool rtl;
+
+    bool operator==(const ShapeKey_c & b) const
+    {
+      return    fontPtr == b.fontPtr
+             && !font.owner_before(b.font) && !b.font.owner_before(font)
+             && rtl == b.rtl
+             && preContext == b.preContext
+             && postContext == b.postContext
+             && text == b.text
+             && lang == b.lang;
+    }
+};
+
+class ShapeKeyHash_c
+{
+  public:
+    size_t operator()(const ShapeKey_c & k) const
+    {
+      return std::hash<std::u32string>()(k.text)
+           ^ ((size_t)k.lang << 24)
+           ^ ((size_t)k.fontPtr >> 4)
+           ^ (size_t)k.rtl
+           ^ ((size_t)k.preContext << 8)
+           ^ ((size_t)k.postContext << 16);
+    }
+};
+
+// a bounded cache for shaped text, it is shared between all threads. The entries are
+// distributed onto several shards by the hash of their key, each shard has its own lock,
+// so that threads shaping different texts don't wait for each other
+class ShapeCache_c
+{
+  private:
+    class Entry_c
+    {
+      public:
+        std::shared_ptr<const ShapedGlyphs_c> glyphs;
+        size_t bytes;
+
+        // the entries of a shard form a list, ordered by their last use, the
+        // key is required to remove the oldest entry from the map
+        const ShapeKey_c * key = nullptr;
+        Entry_c * newer = nullptr;
+        Entry_c * older = nullptr;
+    };
+
+    class Shard_c
+    {
+      public:
+        std::mutex mutex;
+
+        // the nodes of the map never move, so the list can point into it
+        std::unordered_map<ShapeKey_c, Entry_c, ShapeKeyHash_c> cache;
+        Entry_c * newest = nullptr;
+        Entry_c * oldest = nullptr;
+
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t bytes = 0;
+
+        // remove an entry from the list or put it in front of the list
+        void unlink(Entry_c & e);
+        void makeNewest(Entry_c & e);
+
+        // remove the least recently used entries until we are at or below the given size
+        void trim(size_t size);
+    };
+
+    std::array<Shard_c, 8> shards;
+
+    // the budget of the whole cache, each shard gets an equal part of it
+    std::atomic<size_t> budget{4*1024*1024};
+
+    Shard_c & getShard(const ShapeKey_c & k) { return shards[ShapeKeyHash_c()(k) % shards.size()]; }
+
+  public:
+
+    // find an entry in the cache, returns nullptr when not available
+    std::shared_ptr<const ShapedGlyphs_c> find(const ShapeKey_c & k);
+
+    // add a new entry to the cache
+    void insert(ShapeKey_c k, std::shared_ptr<const ShapedGlyphs_c> g);
+
+    void setBudget(size_t b);
+    void clear(void);
+
+    ShapeCacheStatistics_c getStatistics(void);
+};
+
+// the one cache instance that the layouter uses
+ShapeCache_c & getShapeCache(void);
+
+} }
+
+#endif
@@ -0,0 +1,166 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#include "workerPool_internal.h"
+
+#include <algorithm>
+
+namespace STLL { namespace internal {
+
+WorkerPool_c::~WorkerPool_c(void)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quit = true;
+  }
+
+  start.notify_all();
+
+  for (auto & t : threads)
+    t.join();
+}
+
+void WorkerPool_c::run(size_t count, unsigned int workers, const std::function<void(size_t)> & t)
+{
+  if (count == 0) return;
+
+  if (workers == 0) workers = std::max(1u, std::thread::hardware_concurrency());
+  if (workers > count) workers = count;
+
+  std::lock_guard<std::mutex> batchLock(batchMutex);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    while (threads.size() < workers)
+    {
+      queues.emplace_back(new Queue_c);
+      threads.emplace_back(&WorkerPool_c::worker, this, threads.size());
+    }
+
+    // hand out the tasks in blocks, so that each worker starts with
+    // the same amount of work
+    for (size_t w = 0; w < workers; w++)
+    {
+      queues[w]->work.clear();
+
+      for (size_t i = count*w/workers; i < count*(w+1)/workers; i++)
+        queues[w]->work.push_back(i);
+    }
+
+    task = &t;
+    batchWorkers = workers;
+    busy = workers;
+    error = nullptr;
+    batch++;
+  }
+
+  start.notify_all();
+
+  std::exception_ptr e;
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this]() { return busy == 0; });
+
+    task = nullptr;
+    std::swap(e, error);
+  }
+
+  if (e) std::rethrow_exception(e);
+}
+
+bool WorkerPool_c::getWork(size_t w, size_t & idx)
+{
+  {
+    auto & q = *queues[w];
+    std::lock_guard<std::mutex> lock(q.mutex);
+
+    if (!q.work.empty())
+    {
+      idx = q.work.front();
+      q.work.pop_front();
+      return true;
+    }
+  }
+
+  // nothing left for us, steal from the others
+  for (size_t i = 1; i < batchWorkers; i++)
+  {
+    auto & q = *queues[(w+i) % batchWorkers];
+    std::lock_guard<std::mutex> lock(q.mutex);
+
+    if (!q.work.empty())
+    {
+      idx = q.work.back();
+      q.work.pop_back();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void WorkerPool_c::worker(size_t w)
+{
+  uint64_t done = 0;
+
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      start.wait(lock, [this, w, done]() { return quit || (batch != done && w < batchWorkers); });
+
+      if (quit) return;
+
+      done = batch;
+    }
+
+    size_t idx;
+
+    while (getWork(w, idx))
+    {
+      try
+      {
+        (*task)(idx);
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) error = std::current_exception();
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      busy--;
+      if (busy == 0) finished.notify_all();
+    }
+  }
+}
+
+WorkerPool_c & getWorkerPool(void)
+{
+  static WorkerPool_c pool;
+  return pool;
+}
+
+} }
@@ -0,0 +1,91 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#ifndef STLL_WORKER_POOL_INTERNAL_H
+#define STLL_WORKER_POOL_INTERNAL_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+#include <stdint.h>
+
+namespace STLL { namespace internal {
+
+// a pool of worker threads for batches of independent tasks. The threads are kept
+// between the batches, so that the per thread state (FreeType faces, harfbuzz
+// buffers) is reused. Each worker gets a block of the tasks, when it runs out of
+// work it steals from the end of the blocks of the other workers
+class WorkerPool_c
+{
+  public:
+
+    ~WorkerPool_c(void);
+
+    // call task for all indices from 0 to count-1 using the given number of workers,
+    // 0 workers means one per hardware thread. The function returns when all calls
+    // are finished, the first exception thrown by a task is passed on to the caller.
+    // When several threads call this function, the batches are run one after the other
+    void run(size_t count, unsigned int workers, const std::function<void(size_t)> & task);
+
+  private:
+
+    // the tasks of one worker, the owner takes from the front, others steal from the back
+    class Queue_c
+    {
+      public:
+        std::mutex mutex;
+        std::deque<size_t> work;
+    };
+
+    void worker(size_t w);
+    bool getWork(size_t w, size_t & idx);
+
+    // only one batch at a time
+    std::mutex batchMutex;
+
+    // protects the batch information below
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable finished;
+
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<Queue_c>> queues;
+
+    const std::function<void(size_t)> * task = nullptr;
+    unsigned int batchWorkers = 0;
+    uint64_t batch = 0;
+    unsigned int busy = 0;
+    bool quit = false;
+    std::exception_ptr error;
+};
+
+// the one pool that the library uses
+WorkerPool_c & getWorkerPool(void);
+
+} }
+
+#endif